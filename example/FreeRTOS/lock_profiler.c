@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+static const char *TAG = "example";
+
+/*
+锁竞争分析的例子：
+sem.c里拿着互斥量vTaskDelay了5秒，count_sem.c用xSemaphoreTake(..., 0)轮询，
+这两种写法运行的时候都看不出问题，只会表现为别的任务莫名其妙地慢。
+这里用lock_take/lock_give代替xSemaphoreTake/xSemaphoreGive，按锁统计：
+1. 拿了多少次，多少次需要等(竞争)，等了多久，超时和轮询失败了多少次
+2. 互斥量拿着多久(持有时间)，现在在谁手里
+3. 高优先级任务在等低优先级任务手里的互斥量(优先级反转)，FreeRTOS会临时提高持有者的优先级，
+   但是高优先级任务还是要等持有者把活干完
+4. 拿着锁调用了会阻塞的函数：阻塞之前调用lock_prof_check_blocking(或者用lock_prof_delay代替vTaskDelay)，
+   另外持有时间超过一个tick的也单独计数，基本上都是中间阻塞过或者被抢占了
+*/
+
+#define LOCK_PROF_MAX 16
+
+typedef struct
+{
+    SemaphoreHandle_t handle;
+    const char *name;
+    bool is_mutex;           // 只有互斥量有持有者和持有时间
+
+    // 当前持有者，只对互斥量有效
+    TaskHandle_t owner;
+    char owner_name[16];
+    UBaseType_t owner_prio;  // 拿到锁时的优先级
+    int64_t acquired_us;
+
+    uint32_t takes;          // 成功拿到的次数
+    uint32_t contended;      // 没能马上拿到，需要等的次数
+    uint32_t timeouts;       // 等了还是没拿到
+    uint32_t poll_fails;     // 等待时间为0，直接失败
+    uint32_t inversions;     // 比持有者优先级高的任务在等
+    uint64_t wait_sum_us;
+    uint32_t wait_max_us;
+    uint32_t releases;       // 统计过持有时间的次数
+    uint64_t hold_sum_us;
+    uint32_t hold_max_us;
+    uint32_t long_holds;     // 持有超过一个tick
+    uint32_t blocking_holds; // 拿着锁调用了会阻塞的函数
+    const char *blocking_where;
+    char hold_max_owner[16]; // 持有最久的是谁
+} lock_prof_t;
+
+static lock_prof_t locks[LOCK_PROF_MAX];
+static int lock_count;
+static portMUX_TYPE prof_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/*登记一个已经创建好的互斥量或者信号量*/
+lock_prof_t *lock_prof_register(SemaphoreHandle_t handle, const char *name, bool is_mutex)
+{
+    if (handle == NULL || lock_count >= LOCK_PROF_MAX)
+        return NULL;
+    lock_prof_t *lock = &locks[lock_count++];
+    memset(lock, 0, sizeof(*lock));
+    lock->handle = handle;
+    lock->name = name;
+    lock->is_mutex = is_mutex;
+    return lock;
+}
+
+lock_prof_t *lock_prof_create_mutex(const char *name)
+{
+    return lock_prof_register(xSemaphoreCreateMutex(), name, true);
+}
+
+lock_prof_t *lock_prof_create_counting(const char *name, UBaseType_t max_count, UBaseType_t initial_count)
+{
+    return lock_prof_register(xSemaphoreCreateCounting(max_count, initial_count), name, false);
+}
+
+/*代替xSemaphoreTake*/
+BaseType_t lock_take(lock_prof_t *lock, TickType_t ticks_to_wait)
+{
+    // 先不等待试一次，拿不到说明有竞争
+    if (xSemaphoreTake(lock->handle, 0) != pdTRUE)
+    {
+        if (ticks_to_wait == 0)
+        {
+            taskENTER_CRITICAL(&prof_mux);
+            lock->poll_fails++;
+            taskEXIT_CRITICAL(&prof_mux);
+            return pdFALSE;
+        }
+        UBaseType_t my_prio = uxTaskPriorityGet(NULL);
+        taskENTER_CRITICAL(&prof_mux);
+        lock->contended++;
+        if (lock->is_mutex && lock->owner && my_prio > lock->owner_prio)
+            lock->inversions++;
+        taskEXIT_CRITICAL(&prof_mux);
+
+        int64_t start = esp_timer_get_time();
+        BaseType_t ok = xSemaphoreTake(lock->handle, ticks_to_wait);
+        uint32_t wait_us = esp_timer_get_time() - start;
+
+        taskENTER_CRITICAL(&prof_mux);
+        lock->wait_sum_us += wait_us;
+        if (wait_us > lock->wait_max_us)
+            lock->wait_max_us = wait_us;
+        if (ok != pdTRUE)
+            lock->timeouts++;
+        taskEXIT_CRITICAL(&prof_mux);
+        if (ok != pdTRUE)
+            return pdFALSE;
+    }
+
+    // 拿到了
+    int64_t now = esp_timer_get_time();
+    UBaseType_t prio = 0;
+    char name[sizeof(lock->owner_name)] = {0};
+    if (lock->is_mutex)
+    {
+        prio = uxTaskPriorityGet(NULL);
+        snprintf(name, sizeof(name), "%s", pcTaskGetName(NULL));
+    }
+    taskENTER_CRITICAL(&prof_mux);
+    lock->takes++;
+    if (lock->is_mutex)
+    {
+        lock->owner = xTaskGetCurrentTaskHandle();
+        lock->owner_prio = prio;
+        lock->acquired_us = now;
+        memcpy(lock->owner_name, name, sizeof(name));
+    }
+    taskEXIT_CRITICAL(&prof_mux);
+    return pdTRUE;
+}
+
+/*代替xSemaphoreGive*/
+BaseType_t lock_give(lock_prof_t *lock)
+{
+    if (lock->is_mutex && lock->owner == xTaskGetCurrentTaskHandle())
+    {
+        uint32_t hold_us = esp_timer_get_time() - lock->acquired_us;
+        taskENTER_CRITICAL(&prof_mux);
+        lock->releases++;
+        lock->hold_sum_us += hold_us;
+        if (hold_us > lock->hold_max_us)
+        {
+            lock->hold_max_us = hold_us;
+            memcpy(lock->hold_max_owner, lock->owner_name, sizeof(lock->hold_max_owner));
+        }
+        if (hold_us > portTICK_PERIOD_MS * 1000)
+            lock->long_holds++;
+        lock->owner = NULL;
+        taskEXIT_CRITICAL(&prof_mux);
+    }
+    return xSemaphoreGive(lock->handle);
+}
+
+/*
+在会阻塞的调用(vTaskDelay、等队列、等网络……)之前调用，
+当前任务手里拿着互斥量的话记一笔，where是调用的位置，要是常量字符串
+*/
+void lock_prof_check_blocking(const char *where)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < lock_count; i++)
+    {
+        if (locks[i].owner == self)
+        {
+            taskENTER_CRITICAL(&prof_mux);
+            locks[i].blocking_holds++;
+            locks[i].blocking_where = where;
+            taskEXIT_CRITICAL(&prof_mux);
+        }
+    }
+}
+
+/*代替vTaskDelay*/
+void lock_prof_delay(TickType_t ticks)
+{
+    lock_prof_check_blocking("vTaskDelay");
+    vTaskDelay(ticks);
+}
+
+/*打印每个锁的统计，按总等待时间从多到少，打印完清零*/
+void lock_prof_report(void)
+{
+    static lock_prof_t snap[LOCK_PROF_MAX];
+    int count = lock_count;
+    taskENTER_CRITICAL(&prof_mux);
+    memcpy(snap, locks, sizeof(lock_prof_t) * count);
+    for (int i = 0; i < count; i++)
+    {
+        lock_prof_t *lock = &locks[i];
+        lock->takes = lock->contended = lock->timeouts = lock->poll_fails = lock->inversions = 0;
+        lock->wait_sum_us = lock->hold_sum_us = 0;
+        lock->wait_max_us = lock->hold_max_us = 0;
+        lock->releases = lock->long_holds = lock->blocking_holds = 0;
+    }
+    taskEXIT_CRITICAL(&prof_mux);
+
+    // 等待时间最长的锁最值得先看
+    for (int i = 1; i < count; i++)
+    {
+        lock_prof_t tmp = snap[i];
+        int j = i - 1;
+        while (j >= 0 && snap[j].wait_sum_us < tmp.wait_sum_us)
+        {
+            snap[j + 1] = snap[j];
+            j--;
+        }
+        snap[j + 1] = tmp;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        lock_prof_t *lock = &snap[i];
+        ESP_LOGI(TAG, "%s (%s): takes %" PRIu32 " contended %" PRIu32 " timeouts %" PRIu32 " poll fails %" PRIu32,
+                 lock->name, lock->is_mutex ? "mutex" : "semaphore",
+                 lock->takes, lock->contended, lock->timeouts, lock->poll_fails);
+        if (lock->contended)
+            ESP_LOGI(TAG, "  wait avg %" PRIu32 "us max %" PRIu32 "us",
+                     (uint32_t)(lock->wait_sum_us / lock->contended), lock->wait_max_us);
+        if (!lock->is_mutex)
+            continue;
+        if (lock->releases)
+            ESP_LOGI(TAG, "  hold avg %" PRIu32 "us max %" PRIu32 "us by %s, over 1 tick %" PRIu32,
+                     (uint32_t)(lock->hold_sum_us / lock->releases), lock->hold_max_us, lock->hold_max_owner, lock->long_holds);
+        if (lock->owner)
+            ESP_LOGI(TAG, "  held by %s for %" PRIi64 "us", lock->owner_name, esp_timer_get_time() - lock->acquired_us);
+        if (lock->inversions)
+            ESP_LOGW(TAG, "  %" PRIu32 " times a higher priority task waited for it", lock->inversions);
+        if (lock->blocking_holds)
+            ESP_LOGW(TAG, "  held across %s %" PRIu32 " times", lock->blocking_where, lock->blocking_holds);
+    }
+}
+
+/******************************例子******************************/
+
+static lock_prof_t *pv_mutex;     // sem.c里的互斥量
+static lock_prof_t *quota_sem;    // count_sem.c里的计数信号量
+static lock_prof_t *data_mutex;   // 高低优先级任务共用的互斥量
+static int pv = 0;
+
+// 和sem.c一样，拿着互斥量延时
+static void pv_task(void *pvParam)
+{
+    while (1)
+    {
+        lock_take(pv_mutex, portMAX_DELAY);
+        for (int i = 0; i < 5; i++)
+        {
+            pv++;
+            lock_prof_delay(pdMS_TO_TICKS(100));
+        }
+        lock_give(pv_mutex);
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
+
+// 和count_sem.c一样，轮询配额
+static void quota_task(void *pvParam)
+{
+    while (1)
+    {
+        lock_take(quota_sem, 0);
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
+
+static void quota_refill_task(void *pvParam)
+{
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(600));
+        lock_give(quota_sem);
+    }
+}
+
+// 低优先级任务拿着互斥量干5ms的活
+static void low_task(void *pvParam)
+{
+    while (1)
+    {
+        lock_take(data_mutex, portMAX_DELAY);
+        int64_t end = esp_timer_get_time() + 5000;
+        while (esp_timer_get_time() < end)
+            ;
+        lock_give(data_mutex);
+        vTaskDelay(1);
+    }
+}
+
+// 高优先级任务时不时也要用一下
+static void high_task(void *pvParam)
+{
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(7));
+        lock_take(data_mutex, portMAX_DELAY);
+        lock_give(data_mutex);
+    }
+}
+
+void app_main(void)
+{
+    pv_mutex = lock_prof_create_mutex("pv_mutex");
+    quota_sem = lock_prof_create_counting("quota_sem", 5, 5);
+    data_mutex = lock_prof_create_mutex("data_mutex");
+
+    xTaskCreate(pv_task, "pv_task1", 4096, NULL, 1, NULL);
+    xTaskCreate(pv_task, "pv_task2", 4096, NULL, 1, NULL);
+    xTaskCreate(quota_task, "quota_task", 4096, NULL, 1, NULL);
+    xTaskCreate(quota_refill_task, "quota_refill", 4096, NULL, 1, NULL);
+    xTaskCreate(low_task, "low_task", 4096, NULL, 2, NULL);
+    xTaskCreate(high_task, "high_task", 4096, NULL, 6, NULL);
+
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(5000));
+        ESP_LOGI(TAG, "-------- lock report --------");
+        lock_prof_report();
+    }
+}
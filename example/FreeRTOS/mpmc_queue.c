@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+static const char *TAG = "example";
+
+/*
+多生产者多消费者的有界队列：
+queue.c里的xQueue每次读写都要进临界区，多个生产者同时写的时候都排在这把锁上，
+双核的芯片上两个核的生产者也只能一个一个来。
+这里每个槽位带一个序号，生产者和消费者各自用CAS抢一个位置，抢到以后各写各的槽位：
+1. 槽位序号==pos，说明这个槽位空着，可以写入第pos个数据，写完把序号改成pos+1
+2. 槽位序号==pos+1，说明第pos个数据写好了，可以读，读完把序号改成pos+长度，留给下一圈
+3. 批量读写一次CAS抢连续的多个位置，分摊CAS的开销
+只有队列空/满的时候才用信号量等待，没人等的时候读写不会碰到FreeRTOS的锁。
+但是esp32c3(RV32IMC)没有原子指令，CAS和atomic_fetch_add由esp-idf的libatomic关中断来模拟，
+开销和xQueue的临界区是一个量级，单核时就是关中断；
+多个生产者不用排队抢同一把锁的好处只有在双核的Xtensa芯片(esp32、esp32s3)上才明显。
+注意：抢到位置还没写完的生产者被打断时，读到这个位置的消费者会认为队列是空的，直到它写完
+*/
+
+#define MPMC_CACHE_LINE 32
+
+typedef struct
+{
+    // 生产者抢的位置
+    atomic_uint enqueue_pos __attribute__((aligned(MPMC_CACHE_LINE)));
+    atomic_int producers_waiting; // 队列满了在等的生产者数量
+    // 消费者抢的位置
+    atomic_uint dequeue_pos __attribute__((aligned(MPMC_CACHE_LINE)));
+    atomic_int consumers_waiting; // 队列空了在等的消费者数量
+    // 创建后不再改变
+    uint32_t mask __attribute__((aligned(MPMC_CACHE_LINE)));
+    uint32_t item_size;
+    atomic_uint *seq;
+    uint8_t *storage;
+    SemaphoreHandle_t not_empty;
+    SemaphoreHandle_t not_full;
+} mpmc_queue_t;
+
+typedef mpmc_queue_t *MpmcQueueHandle_t;
+
+/*和xQueueCreate一样，长度会向上取到2的幂，失败返回NULL*/
+MpmcQueueHandle_t mpmc_queue_create(uint32_t length, uint32_t item_size)
+{
+    uint32_t size = 2;
+    while (size < length)
+        size <<= 1;
+
+    mpmc_queue_t *q = heap_caps_aligned_alloc(MPMC_CACHE_LINE, sizeof(mpmc_queue_t), MALLOC_CAP_DEFAULT);
+    if (!q)
+        return NULL;
+    memset(q, 0, sizeof(*q));
+    q->seq = malloc(size * sizeof(atomic_uint));
+    q->storage = malloc(size * item_size);
+    q->not_empty = xSemaphoreCreateBinary();
+    q->not_full = xSemaphoreCreateBinary();
+    if (!q->seq || !q->storage || !q->not_empty || !q->not_full)
+    {
+        free(q->seq);
+        free(q->storage);
+        if (q->not_empty)
+            vSemaphoreDelete(q->not_empty);
+        if (q->not_full)
+            vSemaphoreDelete(q->not_full);
+        heap_caps_free(q);
+        return NULL;
+    }
+    // 第i个槽位一开始留给第i个数据
+    for (uint32_t i = 0; i < size; i++)
+        atomic_init(&q->seq[i], i);
+    q->mask = size - 1;
+    q->item_size = item_size;
+    return q;
+}
+
+void mpmc_queue_delete(MpmcQueueHandle_t q)
+{
+    vSemaphoreDelete(q->not_empty);
+    vSemaphoreDelete(q->not_full);
+    free(q->seq);
+    free(q->storage);
+    heap_caps_free(q);
+}
+
+/*
+抢[pos, pos+n)这段位置，返回抢到几个，0表示队列满了(或者空了)。
+push时槽位序号要等于位置，pop时要等于位置+1
+*/
+static uint32_t mpmc_claim(mpmc_queue_t *q, atomic_uint *pos_ptr, uint32_t count, uint32_t offset, uint32_t *claimed_pos)
+{
+    uint32_t pos = atomic_load_explicit(pos_ptr, memory_order_relaxed);
+    while (1)
+    {
+        uint32_t n = 0;
+        while (n < count)
+        {
+            uint32_t seq = atomic_load_explicit(&q->seq[(pos + n) & q->mask], memory_order_acquire);
+            if (seq != pos + n + offset)
+                break;
+            n++;
+        }
+        if (n == 0)
+        {
+            // 序号落后说明满了(或者空了)，超前说明被别人抢先了，重新读位置
+            uint32_t seq = atomic_load_explicit(&q->seq[pos & q->mask], memory_order_acquire);
+            if ((int32_t)(seq - (pos + offset)) < 0)
+                return 0;
+            pos = atomic_load_explicit(pos_ptr, memory_order_relaxed);
+            continue;
+        }
+        // 失败时pos会被更新成最新的位置
+        if (atomic_compare_exchange_weak_explicit(pos_ptr, &pos, pos + n, memory_order_relaxed, memory_order_relaxed))
+        {
+            *claimed_pos = pos;
+            return n;
+        }
+    }
+}
+
+static uint32_t mpmc_try_push(mpmc_queue_t *q, const void *items, uint32_t count)
+{
+    uint32_t pos;
+    uint32_t n = mpmc_claim(q, &q->enqueue_pos, count, 0, &pos);
+    const uint8_t *src = items;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        uint32_t index = (pos + i) & q->mask;
+        memcpy(q->storage + index * q->item_size, src + i * q->item_size, q->item_size);
+        // release保证消费者看到新的序号时数据已经写好了
+        atomic_store_explicit(&q->seq[index], pos + i + 1, memory_order_release);
+    }
+    return n;
+}
+
+static uint32_t mpmc_try_pop(mpmc_queue_t *q, void *items, uint32_t count)
+{
+    uint32_t pos;
+    uint32_t n = mpmc_claim(q, &q->dequeue_pos, count, 1, &pos);
+    uint8_t *dst = items;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        uint32_t index = (pos + i) & q->mask;
+        memcpy(dst + i * q->item_size, q->storage + index * q->item_size, q->item_size);
+        // 留给下一圈的生产者
+        atomic_store_explicit(&q->seq[index], pos + i + q->mask + 1, memory_order_release);
+    }
+    return n;
+}
+
+/*
+有人在等才给信号量，写序号和读等待数量之间要有一个完整的内存屏障，
+和等待方"先登记再检查一次"配合，才不会丢掉唤醒
+*/
+static void mpmc_wake(atomic_int *waiting, SemaphoreHandle_t sem)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiting, memory_order_relaxed) > 0)
+        xSemaphoreGive(sem);
+}
+
+/*
+等待直到至少读写了一个数据或超时。信号量是二值的，
+好几个任务在等的时候只会醒一个，醒来的任务成功以后会再叫醒下一个
+*/
+static uint32_t mpmc_wait(mpmc_queue_t *q, void *items, uint32_t count, TickType_t ticks_to_wait, bool push)
+{
+    atomic_int *waiting = push ? &q->producers_waiting : &q->consumers_waiting;
+    SemaphoreHandle_t sem = push ? q->not_full : q->not_empty;
+    TickType_t start = xTaskGetTickCount();
+    uint32_t n = 0;
+
+    atomic_fetch_add_explicit(waiting, 1, memory_order_relaxed);
+    while (1)
+    {
+        atomic_thread_fence(memory_order_seq_cst);
+        n = push ? mpmc_try_push(q, items, count) : mpmc_try_pop(q, items, count);
+        if (n)
+            break;
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (ticks_to_wait != portMAX_DELAY && elapsed >= ticks_to_wait)
+            break;
+        xSemaphoreTake(sem, ticks_to_wait == portMAX_DELAY ? portMAX_DELAY : ticks_to_wait - elapsed);
+    }
+    atomic_fetch_sub_explicit(waiting, 1, memory_order_relaxed);
+    return n;
+}
+
+UBaseType_t mpmc_queue_messages_waiting(MpmcQueueHandle_t q)
+{
+    uint32_t head = atomic_load(&q->enqueue_pos);
+    uint32_t tail = atomic_load(&q->dequeue_pos);
+    // 两个位置不是同时读的，可能短暂地算出负数
+    return (int32_t)(head - tail) > 0 ? head - tail : 0;
+}
+
+/*
+批量写入，队列满时最多等ticks_to_wait，返回实际写入了几个(可能少于count)，
+同一批数据在队列里是连续的，不会和其他生产者的数据交错
+*/
+uint32_t mpmc_queue_send_batch(MpmcQueueHandle_t q, const void *items, uint32_t count, TickType_t ticks_to_wait)
+{
+    uint32_t n = mpmc_try_push(q, items, count);
+    if (n == 0 && ticks_to_wait)
+        n = mpmc_wait(q, (void *)items, count, ticks_to_wait, true);
+    if (n == 0)
+        return 0;
+    mpmc_wake(&q->consumers_waiting, q->not_empty);
+    // 队列还有空位，接着叫醒其他在等的生产者
+    if (mpmc_queue_messages_waiting(q) <= q->mask)
+        mpmc_wake(&q->producers_waiting, q->not_full);
+    return n;
+}
+
+/*批量读取，队列空时最多等ticks_to_wait，读到至少一个就返回，返回实际读了几个*/
+uint32_t mpmc_queue_receive_batch(MpmcQueueHandle_t q, void *items, uint32_t max_count, TickType_t ticks_to_wait)
+{
+    uint32_t n = mpmc_try_pop(q, items, max_count);
+    if (n == 0 && ticks_to_wait)
+        n = mpmc_wait(q, items, max_count, ticks_to_wait, false);
+    if (n == 0)
+        return 0;
+    mpmc_wake(&q->producers_waiting, q->not_full);
+    // 队列里还有数据，接着叫醒其他在等的消费者
+    if (mpmc_queue_messages_waiting(q) > 0)
+        mpmc_wake(&q->consumers_waiting, q->not_empty);
+    return n;
+}
+
+/*和xQueueSend一样*/
+BaseType_t mpmc_queue_send(MpmcQueueHandle_t q, const void *item, TickType_t ticks_to_wait)
+{
+    return mpmc_queue_send_batch(q, item, 1, ticks_to_wait) ? pdPASS : errQUEUE_FULL;
+}
+
+/*和xQueueReceive一样*/
+BaseType_t mpmc_queue_receive(MpmcQueueHandle_t q, void *item, TickType_t ticks_to_wait)
+{
+    return mpmc_queue_receive_batch(q, item, 1, ticks_to_wait) ? pdTRUE : pdFALSE;
+}
+
+/******************************压力测试和对比******************************/
+
+#define BENCH_ITEMS 60000     // 每一轮一共传多少个数据
+#define BENCH_QUEUE_LEN 64
+#define BENCH_MAX_TASKS 4     // 生产者、消费者最多几个
+
+// 数据的高8位是生产者编号，低24位是这个生产者的序号
+#define ITEM(producer, seq) (((uint32_t)(producer) << 24) | (seq))
+
+static QueueHandle_t queue;
+static MpmcQueueHandle_t mpmc;
+static bool use_mpmc;
+static uint32_t batch;          // 每次读写几个
+static int producer_count;
+static int consumer_count;
+
+static EventGroupHandle_t start_event;
+static SemaphoreHandle_t done_sem;
+static atomic_uint received_total;
+// 每个生产者的数据收到了几个、序号的和，用来检查有没有丢失或者重复
+static atomic_uint received_count[BENCH_MAX_TASKS];
+static atomic_uint received_sum[BENCH_MAX_TASKS];
+static atomic_uint order_errors;
+
+static uint32_t bench_send(const uint32_t *items, uint32_t count)
+{
+    if (use_mpmc)
+        return mpmc_queue_send_batch(mpmc, items, count, portMAX_DELAY);
+    for (uint32_t i = 0; i < count; i++)
+        xQueueSend(queue, &items[i], portMAX_DELAY);
+    return count;
+}
+
+static uint32_t bench_receive(uint32_t *items, uint32_t max_count, TickType_t ticks_to_wait)
+{
+    if (use_mpmc)
+        return mpmc_queue_receive_batch(mpmc, items, max_count, ticks_to_wait);
+    if (xQueueReceive(queue, &items[0], ticks_to_wait) != pdTRUE)
+        return 0;
+    uint32_t n = 1;
+    while (n < max_count && xQueueReceive(queue, &items[n], 0) == pdTRUE)
+        n++;
+    return n;
+}
+
+static void producer_task(void *pvParam)
+{
+    int id = (intptr_t)pvParam;
+    uint32_t per_producer = BENCH_ITEMS / producer_count;
+    uint32_t items[8];
+
+    xEventGroupWaitBits(start_event, BIT0, pdFALSE, pdFALSE, portMAX_DELAY);
+    for (uint32_t seq = 0; seq < per_producer;)
+    {
+        uint32_t n = 0;
+        while (n < batch && seq + n < per_producer)
+        {
+            items[n] = ITEM(id, seq + n);
+            n++;
+        }
+        // 可能只写进去一部分，剩下的下一轮再写
+        seq += bench_send(items, n);
+    }
+    xSemaphoreGive(done_sem);
+    vTaskDelete(NULL);
+}
+
+static void consumer_task(void *pvParam)
+{
+    uint32_t items[8];
+    // 同一个生产者的数据，每个消费者看到的序号一定是递增的
+    int32_t last_seq[BENCH_MAX_TASKS];
+    for (int i = 0; i < BENCH_MAX_TASKS; i++)
+        last_seq[i] = -1;
+    uint32_t total = BENCH_ITEMS / producer_count * producer_count;
+
+    xEventGroupWaitBits(start_event, BIT0, pdFALSE, pdFALSE, portMAX_DELAY);
+    while (atomic_load(&received_total) < total)
+    {
+        uint32_t n = bench_receive(items, batch, pdMS_TO_TICKS(10));
+        for (uint32_t i = 0; i < n; i++)
+        {
+            int producer = items[i] >> 24;
+            int32_t seq = items[i] & 0xFFFFFF;
+            if (seq <= last_seq[producer])
+                atomic_fetch_add(&order_errors, 1);
+            last_seq[producer] = seq;
+            atomic_fetch_add(&received_count[producer], 1);
+            atomic_fetch_add(&received_sum[producer], seq);
+        }
+        atomic_fetch_add(&received_total, n);
+    }
+    xSemaphoreGive(done_sem);
+    vTaskDelete(NULL);
+}
+
+static void bench_run(void)
+{
+    uint32_t per_producer = BENCH_ITEMS / producer_count;
+    atomic_store(&received_total, 0);
+    atomic_store(&order_errors, 0);
+    for (int i = 0; i < BENCH_MAX_TASKS; i++)
+    {
+        atomic_store(&received_count[i], 0);
+        atomic_store(&received_sum[i], 0);
+    }
+    xEventGroupClearBits(start_event, BIT0);
+
+    // 双核的芯片上生产者、消费者轮流放到两个核上
+    int core = 0;
+    for (int i = 0; i < producer_count; i++)
+        xTaskCreatePinnedToCore(producer_task, "producer", 2048, (void *)(intptr_t)i, 2, NULL, core++ % portNUM_PROCESSORS);
+    for (int i = 0; i < consumer_count; i++)
+        xTaskCreatePinnedToCore(consumer_task, "consumer", 2048, NULL, 2, NULL, core++ % portNUM_PROCESSORS);
+
+    int64_t start = esp_timer_get_time();
+    xEventGroupSetBits(start_event, BIT0);
+    for (int i = 0; i < producer_count + consumer_count; i++)
+        xSemaphoreTake(done_sem, portMAX_DELAY);
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    // 每个生产者的数据都要收到，而且不多不少
+    uint32_t lost = 0;
+    uint32_t expect_sum = per_producer * (per_producer - 1) / 2;
+    for (int i = 0; i < producer_count; i++)
+    {
+        if (atomic_load(&received_count[i]) != per_producer || atomic_load(&received_sum[i]) != expect_sum)
+            lost++;
+    }
+
+    ESP_LOGI(TAG, "%-6s P%d C%d batch %" PRIu32 " %8.0f items/s  order errors %" PRIu32 "  bad producers %" PRIu32,
+             use_mpmc ? "mpmc" : "xQueue", producer_count, consumer_count, batch,
+             per_producer * producer_count * 1e6 / elapsed, atomic_load(&order_errors), lost);
+}
+
+void app_main(void)
+{
+    queue = xQueueCreate(BENCH_QUEUE_LEN, sizeof(uint32_t));
+    mpmc = mpmc_queue_create(BENCH_QUEUE_LEN, sizeof(uint32_t));
+    start_event = xEventGroupCreate();
+    done_sem = xSemaphoreCreateCounting(BENCH_MAX_TASKS * 2, 0);
+
+    // 生产者、消费者的数量各取1、2、4，xQueue只测单个读写，mpmc再测一次8个一批
+    static const int counts[] = {1, 2, 4};
+    for (int p = 0; p < 3; p++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            producer_count = counts[p];
+            consumer_count = counts[c];
+
+            use_mpmc = false;
+            batch = 1;
+            bench_run();
+            use_mpmc = true;
+            bench_run();
+            batch = 8;
+            bench_run();
+        }
+    }
+}
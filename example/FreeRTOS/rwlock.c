@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+static const char *TAG = "example";
+
+/*
+读写锁和顺序锁的例子：
+sem.c里每次访问pv都要拿同一个互斥量，读和读之间也要排队。
+配置、校准表、最新的传感器数据这些东西很多任务都在读，很少有人写，可以换成：
+1. 读写锁：可以同时有很多个读者，写的时候独占。有写者在等的时候新来的读者也要等，写者不会饿死，
+   但是一直有人写的话读者会饿死，只适合读多写少
+2. 顺序锁：写者写之前和写之后各把序号加1，读者读之前和读之后各看一次序号，
+   序号是奇数或者两次不一样就说明读的时候有人在写，重新读一遍。
+   读者完全不写共享的变量，也不会阻塞，中断里也可以读，适合几十个字节以内的小结构体
+*/
+
+/******************************读写锁******************************/
+
+typedef struct
+{
+    // 状态都在自旋锁里改，只有几条指令，读者之间不会阻塞
+    portMUX_TYPE lock;
+    int readers;            // 正在读的读者数量
+    bool writer;            // 有写者拿着锁
+    int readers_waiting;
+    int writers_waiting;
+    SemaphoreHandle_t read_sem;   // 读者在这里等，一次只叫醒一个，拿到锁的读者再叫醒下一个
+    SemaphoreHandle_t write_sem;  // 写者在这里等
+} rwlock_t;
+
+esp_err_t rwlock_init(rwlock_t *rw)
+{
+    memset(rw, 0, sizeof(*rw));
+    portMUX_INITIALIZE(&rw->lock);
+    rw->read_sem = xSemaphoreCreateBinary();
+    rw->write_sem = xSemaphoreCreateBinary();
+    if (!rw->read_sem || !rw->write_sem)
+    {
+        if (rw->read_sem)
+            vSemaphoreDelete(rw->read_sem);
+        if (rw->write_sem)
+            vSemaphoreDelete(rw->write_sem);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void rwlock_deinit(rwlock_t *rw)
+{
+    vSemaphoreDelete(rw->read_sem);
+    vSemaphoreDelete(rw->write_sem);
+}
+
+// 醒来的任务都要自己再检查一次状态，所以多叫醒了也没关系
+static void rwlock_wake(SemaphoreHandle_t sem, bool wake)
+{
+    if (wake)
+        xSemaphoreGive(sem);
+}
+
+static TickType_t rwlock_remaining(TickType_t start, TickType_t ticks_to_wait)
+{
+    if (ticks_to_wait == portMAX_DELAY)
+        return portMAX_DELAY;
+    TickType_t elapsed = xTaskGetTickCount() - start;
+    return elapsed >= ticks_to_wait ? 0 : ticks_to_wait - elapsed;
+}
+
+/*拿读锁，没有写者拿着或者在等就马上返回*/
+BaseType_t rwlock_read_lock(rwlock_t *rw, TickType_t ticks_to_wait)
+{
+    taskENTER_CRITICAL(&rw->lock);
+    if (!rw->writer && rw->writers_waiting == 0)
+    {
+        rw->readers++;
+        taskEXIT_CRITICAL(&rw->lock);
+        return pdTRUE;
+    }
+    if (ticks_to_wait == 0)
+    {
+        taskEXIT_CRITICAL(&rw->lock);
+        return pdFALSE;
+    }
+    rw->readers_waiting++;
+    taskEXIT_CRITICAL(&rw->lock);
+
+    TickType_t start = xTaskGetTickCount();
+    while (1)
+    {
+        BaseType_t woken = xSemaphoreTake(rw->read_sem, rwlock_remaining(start, ticks_to_wait));
+        taskENTER_CRITICAL(&rw->lock);
+        if (!rw->writer && rw->writers_waiting == 0)
+        {
+            rw->readers_waiting--;
+            rw->readers++;
+            // 后面还有读者在等，接着叫醒下一个
+            bool wake = rw->readers_waiting > 0;
+            taskEXIT_CRITICAL(&rw->lock);
+            rwlock_wake(rw->read_sem, wake);
+            return pdTRUE;
+        }
+        if (woken != pdTRUE)
+        {
+            rw->readers_waiting--;
+            taskEXIT_CRITICAL(&rw->lock);
+            return pdFALSE;
+        }
+        taskEXIT_CRITICAL(&rw->lock);
+    }
+}
+
+void rwlock_read_unlock(rwlock_t *rw)
+{
+    taskENTER_CRITICAL(&rw->lock);
+    rw->readers--;
+    bool wake_writer = rw->readers == 0 && rw->writers_waiting > 0;
+    taskEXIT_CRITICAL(&rw->lock);
+    // 最后一个读者走了，叫醒在等的写者
+    rwlock_wake(rw->write_sem, wake_writer);
+}
+
+/*拿写锁，要等所有读者都走了*/
+BaseType_t rwlock_write_lock(rwlock_t *rw, TickType_t ticks_to_wait)
+{
+    taskENTER_CRITICAL(&rw->lock);
+    if (!rw->writer && rw->readers == 0)
+    {
+        rw->writer = true;
+        taskEXIT_CRITICAL(&rw->lock);
+        return pdTRUE;
+    }
+    if (ticks_to_wait == 0)
+    {
+        taskEXIT_CRITICAL(&rw->lock);
+        return pdFALSE;
+    }
+    // 登记以后新来的读者就不能再进来了
+    rw->writers_waiting++;
+    taskEXIT_CRITICAL(&rw->lock);
+
+    TickType_t start = xTaskGetTickCount();
+    while (1)
+    {
+        BaseType_t woken = xSemaphoreTake(rw->write_sem, rwlock_remaining(start, ticks_to_wait));
+        taskENTER_CRITICAL(&rw->lock);
+        if (!rw->writer && rw->readers == 0)
+        {
+            rw->writers_waiting--;
+            rw->writer = true;
+            taskEXIT_CRITICAL(&rw->lock);
+            return pdTRUE;
+        }
+        if (woken != pdTRUE)
+        {
+            // 超时放弃，如果是最后一个在等的写者，被它挡住的读者可以进来了
+            rw->writers_waiting--;
+            bool wake = rw->writers_waiting == 0 && !rw->writer && rw->readers_waiting > 0;
+            taskEXIT_CRITICAL(&rw->lock);
+            rwlock_wake(rw->read_sem, wake);
+            return pdFALSE;
+        }
+        taskEXIT_CRITICAL(&rw->lock);
+    }
+}
+
+void rwlock_write_unlock(rwlock_t *rw)
+{
+    taskENTER_CRITICAL(&rw->lock);
+    rw->writer = false;
+    // 优先交给下一个写者，没有写者在等再放读者进来
+    bool wake_writer = rw->writers_waiting > 0;
+    bool wake_reader = !wake_writer && rw->readers_waiting > 0;
+    taskEXIT_CRITICAL(&rw->lock);
+    rwlock_wake(rw->write_sem, wake_writer);
+    rwlock_wake(rw->read_sem, wake_reader);
+}
+
+/******************************顺序锁******************************/
+
+typedef struct
+{
+    atomic_uint seq;    // 奇数表示正在写
+    portMUX_TYPE lock;  // 写者之间互斥，同时关中断，同一个核上的中断不会读到一半写的数据
+} seqlock_t;
+
+#define SEQLOCK_INIT {.seq = 0, .lock = portMUX_INITIALIZER_UNLOCKED}
+
+static inline void IRAM_ATTR seqlock_write_begin(seqlock_t *sl)
+{
+    atomic_fetch_add_explicit(&sl->seq, 1, memory_order_relaxed);
+    // 序号变成奇数以后才能写数据
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void IRAM_ATTR seqlock_write_end(seqlock_t *sl)
+{
+    // 数据写完以后序号才能变回偶数
+    atomic_fetch_add_explicit(&sl->seq, 1, memory_order_release);
+}
+
+/*把src的len个字节写到共享的data里，写的时候关中断，所以数据要小*/
+void seqlock_write(seqlock_t *sl, void *data, const void *src, size_t len)
+{
+    taskENTER_CRITICAL(&sl->lock);
+    seqlock_write_begin(sl);
+    memcpy(data, src, len);
+    seqlock_write_end(sl);
+    taskEXIT_CRITICAL(&sl->lock);
+}
+
+void IRAM_ATTR seqlock_write_from_isr(seqlock_t *sl, void *data, const void *src, size_t len)
+{
+    taskENTER_CRITICAL_ISR(&sl->lock);
+    seqlock_write_begin(sl);
+    memcpy(data, src, len);
+    seqlock_write_end(sl);
+    taskEXIT_CRITICAL_ISR(&sl->lock);
+}
+
+/*把共享的data读到dst里，读到一半有人写就重新读，任务和中断里都可以用*/
+void IRAM_ATTR seqlock_read(seqlock_t *sl, void *dst, const void *data, size_t len)
+{
+    uint32_t begin, end;
+    do
+    {
+        begin = atomic_load_explicit(&sl->seq, memory_order_acquire);
+        if (begin & 1)
+            continue;
+        memcpy(dst, data, len);
+        // 数据读完以后再看序号
+        atomic_thread_fence(memory_order_acquire);
+        end = atomic_load_explicit(&sl->seq, memory_order_relaxed);
+        if (begin == end)
+            break;
+    } while (1);
+}
+
+/******************************和互斥量对比******************************/
+
+#define BENCH_MS 500           // 每一轮读多久
+#define BENCH_WRITE_MS 10      // 写者多久写一次
+#define BENCH_MAX_READERS 8
+
+// 校准表，写者每次把所有值都写成同一个数，读到不一样的值说明读到了写了一半的数据
+typedef struct
+{
+    uint32_t values[8];
+} calibration_t;
+
+typedef enum
+{
+    MODE_MUTEX,
+    MODE_RWLOCK,
+    MODE_SEQLOCK,
+} bench_mode_t;
+
+static const char *mode_names[] = {"mutex", "rwlock", "seqlock"};
+
+static calibration_t shared;
+static SemaphoreHandle_t mutex;
+static rwlock_t rwlock;
+static seqlock_t seqlock = SEQLOCK_INIT;
+
+static bench_mode_t mode;
+static volatile bool running;
+static atomic_uint total_reads;
+static atomic_uint torn_reads;
+static SemaphoreHandle_t done_sem;
+
+static void read_shared(calibration_t *out)
+{
+    switch (mode)
+    {
+    case MODE_MUTEX:
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        *out = shared;
+        xSemaphoreGive(mutex);
+        break;
+    case MODE_RWLOCK:
+        rwlock_read_lock(&rwlock, portMAX_DELAY);
+        *out = shared;
+        rwlock_read_unlock(&rwlock);
+        break;
+    case MODE_SEQLOCK:
+        seqlock_read(&seqlock, out, &shared, sizeof(shared));
+        break;
+    }
+}
+
+static void write_shared(const calibration_t *in)
+{
+    switch (mode)
+    {
+    case MODE_MUTEX:
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        shared = *in;
+        xSemaphoreGive(mutex);
+        break;
+    case MODE_RWLOCK:
+        rwlock_write_lock(&rwlock, portMAX_DELAY);
+        shared = *in;
+        rwlock_write_unlock(&rwlock);
+        break;
+    case MODE_SEQLOCK:
+        seqlock_write(&seqlock, &shared, in, sizeof(shared));
+        break;
+    }
+}
+
+static void reader_task(void *param)
+{
+    calibration_t local;
+    uint32_t reads = 0, torn = 0;
+    while (running)
+    {
+        read_shared(&local);
+        for (int i = 1; i < 8; i++)
+        {
+            if (local.values[i] != local.values[0])
+            {
+                torn++;
+                break;
+            }
+        }
+        reads++;
+    }
+    atomic_fetch_add(&total_reads, reads);
+    atomic_fetch_add(&torn_reads, torn);
+    xSemaphoreGive(done_sem);
+    vTaskDelete(NULL);
+}
+
+static void writer_task(void *param)
+{
+    calibration_t local;
+    uint32_t version = 0;
+    while (running)
+    {
+        version++;
+        for (int i = 0; i < 8; i++)
+            local.values[i] = version;
+        write_shared(&local);
+        vTaskDelay(pdMS_TO_TICKS(BENCH_WRITE_MS));
+    }
+    xSemaphoreGive(done_sem);
+    vTaskDelete(NULL);
+}
+
+static void bench_run(bench_mode_t m, int readers)
+{
+    mode = m;
+    running = true;
+    atomic_store(&total_reads, 0);
+    atomic_store(&torn_reads, 0);
+
+    // 读者轮流放到各个核上，优先级比app_main低，时间片轮转
+    for (int i = 0; i < readers; i++)
+        xTaskCreatePinnedToCore(reader_task, "reader", 2048, NULL, 1, NULL, i % portNUM_PROCESSORS);
+    // 写者优先级高一点，保证能按时写
+    xTaskCreate(writer_task, "writer", 2048, NULL, 2, NULL);
+
+    vTaskDelay(pdMS_TO_TICKS(BENCH_MS));
+    running = false;
+    for (int i = 0; i < readers + 1; i++)
+        xSemaphoreTake(done_sem, portMAX_DELAY);
+
+    ESP_LOGI(TAG, "%-8s %d readers: %8.0f reads/s  torn %" PRIu32,
+             mode_names[m], readers, atomic_load(&total_reads) * 1000.0 / BENCH_MS, atomic_load(&torn_reads));
+}
+
+void app_main(void)
+{
+    mutex = xSemaphoreCreateMutex();
+    rwlock_init(&rwlock);
+    done_sem = xSemaphoreCreateCounting(BENCH_MAX_READERS + 1, 0);
+    // 读者跑完之前app_main不能被饿死
+    vTaskPrioritySet(NULL, 5);
+
+    for (int readers = 1; readers <= BENCH_MAX_READERS; readers *= 2)
+    {
+        bench_run(MODE_MUTEX, readers);
+        bench_run(MODE_RWLOCK, readers);
+        bench_run(MODE_SEQLOCK, readers);
+    }
+}
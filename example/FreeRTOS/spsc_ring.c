@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "driver/gptimer.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+static const char *TAG = "example";
+
+/*
+单生产者单消费者的无锁环形队列：
+xQueueSendFromISR每次都要进临界区、拷贝数据、检查等待的任务，
+中断->任务、任务->任务只有一个写一个读的场景，可以用下面这个环形队列代替：
+1. 写只改head，读只改tail，不需要加锁，也不用关中断
+2. head和tail放在不同的cache line，双核的芯片上不会互相刷掉缓存(esp32c3单核没有这个问题，只多占几个字节)
+3. 只有队列空了消费者才通过任务通知睡眠，生产者发现有人在等才去唤醒
+接口和xQueueSend/xQueueReceive一样。注意消费者任务的任务通知不能再用作别的用途，
+同一个队列只能有一个生产者(一个任务或者一个中断)和一个消费者任务
+*/
+
+#define SPSC_CACHE_LINE 32
+
+typedef struct
+{
+    // 生产者写，消费者读
+    atomic_uint head __attribute__((aligned(SPSC_CACHE_LINE)));
+    _Atomic(TaskHandle_t) producer_waiting; // 队列满了在等的生产者任务
+    // 消费者写，生产者读
+    atomic_uint tail __attribute__((aligned(SPSC_CACHE_LINE)));
+    _Atomic(TaskHandle_t) consumer_waiting; // 队列空了在等的消费者任务
+    // 创建后不再改变
+    uint32_t mask __attribute__((aligned(SPSC_CACHE_LINE)));
+    uint32_t item_size;
+    uint8_t *storage;
+} spsc_ring_t;
+
+typedef spsc_ring_t *SpscRingHandle_t;
+
+/*和xQueueCreate一样，长度会向上取到2的幂，失败返回NULL*/
+SpscRingHandle_t spsc_ring_create(uint32_t length, uint32_t item_size)
+{
+    uint32_t size = 1;
+    while (size < length)
+        size <<= 1;
+
+    spsc_ring_t *ring = heap_caps_aligned_alloc(SPSC_CACHE_LINE, sizeof(spsc_ring_t), MALLOC_CAP_DEFAULT);
+    if (!ring)
+        return NULL;
+    memset(ring, 0, sizeof(*ring));
+    ring->storage = malloc(size * item_size);
+    if (!ring->storage)
+    {
+        heap_caps_free(ring);
+        return NULL;
+    }
+    ring->mask = size - 1;
+    ring->item_size = item_size;
+    return ring;
+}
+
+void spsc_ring_delete(SpscRingHandle_t ring)
+{
+    free(ring->storage);
+    heap_caps_free(ring);
+}
+
+/*
+把等待的任务唤醒。写head(或tail)和读等待标志之间要有一个完整的内存屏障，
+和等待方"先设标志再检查一次"配合，才不会丢掉唤醒
+*/
+static inline void IRAM_ATTR spsc_wake(_Atomic(TaskHandle_t) *waiting, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    TaskHandle_t task = atomic_load_explicit(waiting, memory_order_relaxed);
+    if (task == NULL)
+        return;
+    if (pxHigherPriorityTaskWoken)
+        vTaskNotifyGiveFromISR(task, pxHigherPriorityTaskWoken);
+    else
+        xTaskNotifyGive(task);
+}
+
+static inline bool IRAM_ATTR spsc_try_push(spsc_ring_t *ring, const void *item)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail > ring->mask)
+        return false;
+    memcpy(ring->storage + (head & ring->mask) * ring->item_size, item, ring->item_size);
+    // release保证消费者看到新的head时数据已经写好了
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+static inline bool spsc_try_pop(spsc_ring_t *ring, void *item)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail)
+        return false;
+    memcpy(item, ring->storage + (tail & ring->mask) * ring->item_size, ring->item_size);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+/*
+等待直到try_op成功或超时：先登记自己在等，再试一次，
+还是不行才睡眠，对方在操作完以后看到登记就会通知我们
+*/
+static BaseType_t spsc_wait(spsc_ring_t *ring, void *item, TickType_t ticks_to_wait, bool push)
+{
+    _Atomic(TaskHandle_t) *self = push ? &ring->producer_waiting : &ring->consumer_waiting;
+    TickType_t start = xTaskGetTickCount();
+    BaseType_t ok = pdFALSE;
+
+    atomic_store_explicit(self, xTaskGetCurrentTaskHandle(), memory_order_relaxed);
+    while (1)
+    {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (push ? spsc_try_push(ring, item) : spsc_try_pop(ring, item))
+        {
+            ok = pdTRUE;
+            break;
+        }
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (ticks_to_wait != portMAX_DELAY && elapsed >= ticks_to_wait)
+            break;
+        ulTaskNotifyTake(pdTRUE, ticks_to_wait == portMAX_DELAY ? portMAX_DELAY : ticks_to_wait - elapsed);
+    }
+    atomic_store_explicit(self, NULL, memory_order_relaxed);
+    return ok;
+}
+
+/*和xQueueSend一样，队列满时最多等ticks_to_wait*/
+BaseType_t spsc_ring_send(SpscRingHandle_t ring, const void *item, TickType_t ticks_to_wait)
+{
+    if (!spsc_try_push(ring, item))
+    {
+        if (ticks_to_wait == 0 || spsc_wait(ring, (void *)item, ticks_to_wait, true) != pdTRUE)
+            return errQUEUE_FULL;
+    }
+    spsc_wake(&ring->consumer_waiting, NULL);
+    return pdPASS;
+}
+
+/*和xQueueSendFromISR一样，不会阻塞，满了返回errQUEUE_FULL*/
+BaseType_t IRAM_ATTR spsc_ring_send_from_isr(SpscRingHandle_t ring, const void *item, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    BaseType_t woken = pdFALSE;
+    if (!spsc_try_push(ring, item))
+        return errQUEUE_FULL;
+    spsc_wake(&ring->consumer_waiting, &woken);
+    if (pxHigherPriorityTaskWoken)
+        *pxHigherPriorityTaskWoken |= woken;
+    return pdPASS;
+}
+
+/*和xQueueReceive一样，队列空时最多等ticks_to_wait*/
+BaseType_t spsc_ring_receive(SpscRingHandle_t ring, void *item, TickType_t ticks_to_wait)
+{
+    if (!spsc_try_pop(ring, item))
+    {
+        if (ticks_to_wait == 0 || spsc_wait(ring, item, ticks_to_wait, false) != pdTRUE)
+            return pdFALSE;
+    }
+    spsc_wake(&ring->producer_waiting, NULL);
+    return pdTRUE;
+}
+
+UBaseType_t spsc_ring_messages_waiting(SpscRingHandle_t ring)
+{
+    return atomic_load(&ring->head) - atomic_load(&ring->tail);
+}
+
+/******************************和xQueue对比******************************/
+
+#define BENCH_ITEMS 100000   // 任务->任务传多少个数据
+#define BENCH_QUEUE_LEN 64
+#define BENCH_ISR_HZ 10000   // 中断->任务时定时器中断的频率
+#define BENCH_ISR_MS 2000
+
+static QueueHandle_t queue;
+static SpscRingHandle_t ring;
+static volatile bool use_ring;
+
+// 中断里的统计
+static volatile uint32_t isr_cycles;
+static volatile uint32_t isr_count;
+static volatile uint32_t isr_full;
+
+static void producer_task(void *pvParam)
+{
+    for (uint32_t i = 0; i < BENCH_ITEMS; i++)
+    {
+        if (use_ring)
+            spsc_ring_send(ring, &i, portMAX_DELAY);
+        else
+            xQueueSend(queue, &i, portMAX_DELAY);
+    }
+    vTaskDelete(NULL);
+}
+
+static void bench_task_to_task(void)
+{
+    uint32_t data, errors = 0;
+    int64_t start = esp_timer_get_time();
+    xTaskCreate(producer_task, "producer", 2048, NULL, uxTaskPriorityGet(NULL), NULL);
+    for (uint32_t i = 0; i < BENCH_ITEMS; i++)
+    {
+        if (use_ring)
+            spsc_ring_receive(ring, &data, portMAX_DELAY);
+        else
+            xQueueReceive(queue, &data, portMAX_DELAY);
+        if (data != i)
+            errors++;
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "%-6s task->task %8.0f items/s  errors %" PRIu32,
+             use_ring ? "ring" : "xQueue", BENCH_ITEMS * 1e6 / elapsed, errors);
+}
+
+// 定时器中断里把当前时间发给任务
+static bool IRAM_ATTR bench_timer_cb(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *user_data)
+{
+    BaseType_t high_task_awoken = pdFALSE;
+    int64_t now = esp_timer_get_time();
+
+    uint32_t t0 = esp_cpu_get_cycle_count();
+    BaseType_t ok = use_ring ? spsc_ring_send_from_isr(ring, &now, &high_task_awoken)
+                             : xQueueSendFromISR(queue, &now, &high_task_awoken);
+    isr_cycles += esp_cpu_get_cycle_count() - t0;
+    isr_count++;
+    if (ok != pdPASS)
+        isr_full++;
+
+    return high_task_awoken == pdTRUE;
+}
+
+static void bench_isr_to_task(gptimer_handle_t gptimer)
+{
+    int64_t stamp;
+    uint32_t received = 0, max_us = 0;
+    uint64_t total_us = 0;
+    isr_cycles = 0;
+    isr_count = 0;
+    isr_full = 0;
+
+    gptimer_start(gptimer);
+    int64_t end = esp_timer_get_time() + BENCH_ISR_MS * 1000LL;
+    while (esp_timer_get_time() < end)
+    {
+        BaseType_t ok = use_ring ? spsc_ring_receive(ring, &stamp, pdMS_TO_TICKS(100))
+                                 : xQueueReceive(queue, &stamp, pdMS_TO_TICKS(100));
+        if (ok != pdTRUE)
+            continue;
+        uint32_t us = esp_timer_get_time() - stamp;
+        received++;
+        total_us += us;
+        if (us > max_us)
+            max_us = us;
+    }
+    gptimer_stop(gptimer);
+    // 把停止前发出来的剩下的取完
+    while (use_ring ? spsc_ring_receive(ring, &stamp, 0) : xQueueReceive(queue, &stamp, 0))
+        ;
+
+    ESP_LOGI(TAG, "%-6s isr->task  send %" PRIu32 " cycles  latency avg %" PRIu32 "us max %" PRIu32 "us  received %" PRIu32 " full %" PRIu32,
+             use_ring ? "ring" : "xQueue",
+             isr_count ? isr_cycles / isr_count : 0,
+             received ? (uint32_t)(total_us / received) : 0, max_us, received, isr_full);
+}
+
+void app_main(void)
+{
+    // 任务->任务，队列里是uint32_t
+    queue = xQueueCreate(BENCH_QUEUE_LEN, sizeof(uint32_t));
+    ring = spsc_ring_create(BENCH_QUEUE_LEN, sizeof(uint32_t));
+    use_ring = false;
+    bench_task_to_task();
+    use_ring = true;
+    bench_task_to_task();
+    vQueueDelete(queue);
+    spsc_ring_delete(ring);
+
+    // 中断->任务，队列里是时间戳，和TIM_hardware.c一样的定时器配置
+    queue = xQueueCreate(BENCH_QUEUE_LEN, sizeof(int64_t));
+    ring = spsc_ring_create(BENCH_QUEUE_LEN, sizeof(int64_t));
+
+    gptimer_handle_t gptimer = NULL;
+    gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = 1000000, // 1MHz, 1 tick=1us
+    };
+    gptimer_new_timer(&timer_config, &gptimer);
+    gptimer_event_callbacks_t cbs = {
+        .on_alarm = bench_timer_cb,
+    };
+    gptimer_register_event_callbacks(gptimer, &cbs, NULL);
+    gptimer_enable(gptimer);
+    gptimer_alarm_config_t alarm_config = {
+        .reload_count = 0,
+        .alarm_count = 1000000 / BENCH_ISR_HZ,
+        .flags.auto_reload_on_alarm = true,
+    };
+    gptimer_set_alarm_action(gptimer, &alarm_config);
+
+    use_ring = false;
+    bench_isr_to_task(gptimer);
+    use_ring = true;
+    bench_isr_to_task(gptimer);
+}
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+
+static const char *TAG = "example";
+
+/*
+任务栈审计的例子：
+task_CPU.c里的栈大小都是试出来的(2048、4096、1024*5)，太小了直接core dump，
+所以大家都往大了给，二十来个任务加起来能多占好几十KB的SRAM。
+这里用stack_audit_task_create代替xTaskCreatePinnedToCore，记下每个任务申请的栈大小，
+定时读uxTaskGetStackHighWaterMark(esp-idf里单位是字节)，得到每个任务用过的最大栈，
+最后按"用过的最大栈+余量"给出建议的大小。
+高水位线只能反映跑过的代码路径，要在各种功能都跑过一遍以后再看结果。
+注意：登记过的任务如果不是通过stack_audit_task_delete删除的(直接调vTaskDelete、
+app_main返回后main任务被系统删除等)，定时器会继续读已经释放的TCB，
+这种任务删除前要先调用stack_audit_unregister
+*/
+
+#define STACK_AUDIT_MAX_TASKS 24
+#define STACK_AUDIT_PERIOD_MS 1000
+#define STACK_AUDIT_MARGIN_PERCENT 25  // 建议值在用过的最大栈上加多少余量
+#define STACK_AUDIT_MARGIN_MIN 512     // 余量最少多少字节，ESP_LOG、中断嵌套都要用栈
+#define STACK_AUDIT_ALIGN 256          // 建议值向上取整
+#define STACK_AUDIT_WARN_FREE 256      // 剩余栈少于这个数就打印警告
+
+typedef struct
+{
+    TaskHandle_t handle;
+    char name[16];
+    uint32_t stack_size;  // 申请的栈大小
+    uint32_t min_free;    // 见过的最小剩余栈
+    bool alive;           // 删除以后不能再读它的高水位线
+    bool warned;
+    TaskFunction_t fn;    // stack_audit_task_create创建的任务真正的入口
+    void *param;
+} stack_audit_entry_t;
+
+static stack_audit_entry_t entries[STACK_AUDIT_MAX_TASKS];
+static int entry_count;
+static portMUX_TYPE audit_mux = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t audit_timer;
+
+// 读一次高水位线，要在audit_mux里调用，保证任务这时候还没被删掉
+static void stack_audit_sample_locked(stack_audit_entry_t *e)
+{
+    uint32_t free_bytes = uxTaskGetStackHighWaterMark(e->handle);
+    if (free_bytes < e->min_free)
+        e->min_free = free_bytes;
+}
+
+static void stack_audit_timer_cb(void *arg)
+{
+    for (int i = 0; i < entry_count; i++)
+    {
+        stack_audit_entry_t *e = &entries[i];
+        bool warn = false;
+        // 每次只锁一个任务，读高水位线要扫一遍栈，不要关中断太久
+        taskENTER_CRITICAL(&audit_mux);
+        if (e->alive)
+        {
+            stack_audit_sample_locked(e);
+            warn = !e->warned && e->min_free < STACK_AUDIT_WARN_FREE;
+            if (warn)
+                e->warned = true;
+        }
+        taskEXIT_CRITICAL(&audit_mux);
+        if (warn)
+            ESP_LOGW(TAG, "task %s only %" PRIu32 " bytes of stack left", e->name, e->min_free);
+    }
+}
+
+/*开始定时采样，已经创建的任务也可以用stack_audit_register登记进来*/
+esp_err_t stack_audit_start(void)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = stack_audit_timer_cb,
+        .name = "stack_audit"};
+    esp_err_t err = esp_timer_create(&timer_args, &audit_timer);
+    if (err != ESP_OK)
+        return err;
+    return esp_timer_start_periodic(audit_timer, STACK_AUDIT_PERIOD_MS * 1000);
+}
+
+// 在表里占一个位置，alive为false时采样会跳过
+static stack_audit_entry_t *stack_audit_alloc(const char *name, uint32_t stack_size)
+{
+    stack_audit_entry_t *e = NULL;
+    taskENTER_CRITICAL(&audit_mux);
+    if (entry_count < STACK_AUDIT_MAX_TASKS)
+    {
+        e = &entries[entry_count];
+        memset(e, 0, sizeof(*e));
+        snprintf(e->name, sizeof(e->name), "%s", name);
+        e->stack_size = stack_size;
+        e->min_free = stack_size;
+        entry_count++;
+    }
+    taskEXIT_CRITICAL(&audit_mux);
+    return e;
+}
+
+/*登记一个不是用stack_audit_task_create创建的任务，比如main任务，stack_size要和创建时一样*/
+esp_err_t stack_audit_register(TaskHandle_t handle, const char *name, uint32_t stack_size)
+{
+    stack_audit_entry_t *e = stack_audit_alloc(name, stack_size);
+    if (!e)
+        return ESP_ERR_NO_MEM;
+    taskENTER_CRITICAL(&audit_mux);
+    e->handle = handle;
+    e->alive = true;
+    taskEXIT_CRITICAL(&audit_mux);
+    return ESP_OK;
+}
+
+/*
+最后采样一次，以后不再读这个任务，报告里还保留它的结果。
+任务要被别的方式删除时(比如app_main返回)先调用这个，handle为NULL表示自己
+*/
+void stack_audit_unregister(TaskHandle_t handle)
+{
+    if (handle == NULL)
+        handle = xTaskGetCurrentTaskHandle();
+    taskENTER_CRITICAL(&audit_mux);
+    for (int i = 0; i < entry_count; i++)
+    {
+        if (entries[i].alive && entries[i].handle == handle)
+        {
+            stack_audit_sample_locked(&entries[i]);
+            entries[i].alive = false;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&audit_mux);
+}
+
+/*
+代替vTaskDelete，删除前最后采样一次，以后不再读这个任务。
+登记过的任务都要用这个删除，handle为NULL表示删除自己
+*/
+void stack_audit_task_delete(TaskHandle_t handle)
+{
+    if (handle == NULL)
+        handle = xTaskGetCurrentTaskHandle();
+    stack_audit_unregister(handle);
+    vTaskDelete(handle);
+}
+
+/*
+任务自己登记好句柄再进入真正的入口，
+这样任务一创建出来马上删除自己的话，也不会在删除以后才被登记
+*/
+static void stack_audit_trampoline(void *param)
+{
+    stack_audit_entry_t *e = param;
+    taskENTER_CRITICAL(&audit_mux);
+    e->handle = xTaskGetCurrentTaskHandle();
+    e->alive = true;
+    taskEXIT_CRITICAL(&audit_mux);
+    e->fn(e->param);
+    // FreeRTOS的任务函数不能返回
+    stack_audit_task_delete(NULL);
+}
+
+/*参数和xTaskCreatePinnedToCore一样，审计表满了就不登记，直接创建*/
+BaseType_t stack_audit_task_create(TaskFunction_t fn, const char *name, uint32_t stack_size,
+                                   void *param, UBaseType_t priority, TaskHandle_t *created, BaseType_t core_id)
+{
+    stack_audit_entry_t *e = stack_audit_alloc(name, stack_size);
+    if (!e)
+    {
+        ESP_LOGW(TAG, "audit table full, %s not tracked", name);
+        return xTaskCreatePinnedToCore(fn, name, stack_size, param, priority, created, core_id);
+    }
+    e->fn = fn;
+    e->param = param;
+    BaseType_t ret = xTaskCreatePinnedToCore(stack_audit_trampoline, name, stack_size, e, priority, created, core_id);
+    // 没创建成功，这个位置报告的时候跳过
+    if (ret != pdPASS)
+        e->stack_size = 0;
+    return ret;
+}
+
+// 用过的最大栈加上余量，向上取整
+static uint32_t stack_audit_recommend(uint32_t used)
+{
+    uint32_t margin = used * STACK_AUDIT_MARGIN_PERCENT / 100;
+    if (margin < STACK_AUDIT_MARGIN_MIN)
+        margin = STACK_AUDIT_MARGIN_MIN;
+    return (used + margin + STACK_AUDIT_ALIGN - 1) / STACK_AUDIT_ALIGN * STACK_AUDIT_ALIGN;
+}
+
+/*采样一次，打印每个任务的栈使用情况和建议值*/
+void stack_audit_report(void)
+{
+    stack_audit_timer_cb(NULL);
+
+    int32_t total_saving = 0;
+    ESP_LOGI(TAG, "%-16s %6s %6s %6s %9s %6s", "task", "stack", "peak", "free", "recommend", "save");
+    for (int i = 0; i < entry_count; i++)
+    {
+        stack_audit_entry_t *e = &entries[i];
+        if (e->stack_size == 0)
+            continue;
+        uint32_t used = e->stack_size - e->min_free;
+        uint32_t recommend = stack_audit_recommend(used);
+        int32_t saving = (int32_t)e->stack_size - (int32_t)recommend;
+        total_saving += saving;
+        ESP_LOGI(TAG, "%-16s %6" PRIu32 " %6" PRIu32 " %6" PRIu32 " %9" PRIu32 " %6" PRIi32 "%s",
+                 e->name, e->stack_size, used, e->min_free, recommend, saving, e->alive ? "" : " (deleted)");
+    }
+    // 负数说明有任务的栈给小了
+    ESP_LOGI(TAG, "total: %" PRIi32 " bytes can be saved", total_saving);
+}
+
+/******************************例子******************************/
+
+// 和task_CPU.c一样，循环打印日志
+static void log_task(void *param)
+{
+    int count = 0;
+    while (1)
+    {
+        ESP_LOGI(TAG, "log task %d", count++);
+        vTaskDelay(1000 / portTICK_PERIOD_MS);
+    }
+}
+
+// printf格式化浮点数比较费栈
+static void float_task(void *param)
+{
+    char buf[64];
+    float value = 0;
+    while (1)
+    {
+        snprintf(buf, sizeof(buf), "value %.3f", value);
+        value += 0.1f;
+        vTaskDelay(500 / portTICK_PERIOD_MS);
+    }
+}
+
+// 递归，每一层都在栈上放一块数据
+static uint32_t recurse(int depth)
+{
+    volatile uint8_t buf[64];
+    buf[0] = depth;
+    if (depth == 0)
+        return buf[0];
+    return recurse(depth - 1) + buf[0];
+}
+
+static void recursive_task(void *param)
+{
+    while (1)
+    {
+        recurse(10);
+        vTaskDelay(500 / portTICK_PERIOD_MS);
+    }
+}
+
+// 干完活就删除自己，删除前会记下最后的高水位线
+static void oneshot_task(void *param)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "oneshot %s", "done");
+    ESP_LOGI(TAG, "%s", buf);
+    stack_audit_task_delete(NULL);
+}
+
+void app_main(void)
+{
+    // main任务的栈大小在menuconfig里配置
+    stack_audit_register(xTaskGetCurrentTaskHandle(), "main", CONFIG_ESP_MAIN_TASK_STACK_SIZE);
+    stack_audit_start();
+
+    // 和其他例子一样，栈大小都是随手给的
+    stack_audit_task_create(log_task, "log_task", 2048, NULL, 1, NULL, tskNO_AFFINITY);
+    stack_audit_task_create(float_task, "float_task", 4096, NULL, 1, NULL, tskNO_AFFINITY);
+    stack_audit_task_create(recursive_task, "recursive_task", 1024 * 5, NULL, 1, NULL, tskNO_AFFINITY);
+    stack_audit_task_create(oneshot_task, "oneshot_task", 4096, NULL, 1, NULL, tskNO_AFFINITY);
+
+    // 让每个任务都跑一会儿再看结果
+    vTaskDelay(5000 / portTICK_PERIOD_MS);
+    stack_audit_report();
+
+    // app_main返回后main任务会被直接vTaskDelete，要先注销，否则定时器会读到已经释放的TCB
+    stack_audit_unregister(NULL);
+}
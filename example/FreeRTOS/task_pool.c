@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+static const char *TAG = "example";
+
+/*
+任务池的例子：
+task_CPU.c和task_NOCPU.c里每件事都单独创建一个任务，每个任务都要分配2048~5120字节的栈，
+只干几微秒的活的话，创建、删除任务的时间比干活还长。
+这里预先创建固定几个工作任务(每个核一个或多个)，要干的活打包成"函数+参数"提交给任务池：
+1. 每个工作任务有自己的双端队列，自己从队尾取，新提交的活也优先放在自己的队列里
+2. 自己的队列空了就去别的工作任务的队头偷，忙的任务积压的活会被闲的任务分走
+3. 所有队列都空了才睡眠，提交的时候再用任务通知叫醒
+活里面不要长时间阻塞，会占住一个工作任务
+*/
+
+#define POOL_MAX_WORKERS 8
+#define POOL_DEQUE_LEN 64   // 每个工作任务的队列长度，要是2的幂
+#define POOL_CTX_SIZE 16    // pool_submit_ctx最多拷贝多少字节的参数
+
+typedef void (*pool_fn_t)(void *arg);
+
+typedef struct
+{
+    pool_fn_t fn;
+    void *arg;
+    // pool_submit_ctx的参数直接拷贝在这里，相当于闭包捕获的变量
+    uint8_t ctx[POOL_CTX_SIZE] __attribute__((aligned(4)));
+    bool has_ctx;
+} pool_job_t;
+
+typedef struct task_pool task_pool_t;
+
+typedef struct
+{
+    // 队列很短，操作只是拷贝几十个字节，用自旋锁就够了
+    portMUX_TYPE lock;
+    uint32_t top;     // 别人从这一端偷
+    uint32_t bottom;  // 自己从这一端放和取
+    pool_job_t jobs[POOL_DEQUE_LEN];
+
+    TaskHandle_t task;
+    atomic_bool sleeping;
+    task_pool_t *pool;
+    int index;
+
+    uint32_t executed; // 执行了多少个活
+    uint32_t stolen;   // 其中多少个是偷来的
+} pool_worker_t;
+
+struct task_pool
+{
+    int worker_count;
+    atomic_uint next;               // 外部提交时轮流放到各个工作任务
+    atomic_uint pending;            // 提交了还没执行完的活
+    _Atomic(TaskHandle_t) waiter;   // 在pool_wait里等的任务
+    atomic_int alive;               // 还在运行的工作任务
+    volatile bool stop;
+    // 每个工作任务带一个队列，不算小，按实际的个数申请
+    pool_worker_t workers[];
+};
+
+/******************************双端队列******************************/
+
+static bool deque_push(pool_worker_t *w, const pool_job_t *job)
+{
+    bool ok = false;
+    taskENTER_CRITICAL(&w->lock);
+    if (w->bottom - w->top < POOL_DEQUE_LEN)
+    {
+        w->jobs[w->bottom & (POOL_DEQUE_LEN - 1)] = *job;
+        w->bottom++;
+        ok = true;
+    }
+    taskEXIT_CRITICAL(&w->lock);
+    return ok;
+}
+
+// 自己取最新放进去的，数据还在缓存里
+static bool deque_pop(pool_worker_t *w, pool_job_t *job)
+{
+    bool ok = false;
+    taskENTER_CRITICAL(&w->lock);
+    if (w->bottom != w->top)
+    {
+        w->bottom--;
+        *job = w->jobs[w->bottom & (POOL_DEQUE_LEN - 1)];
+        ok = true;
+    }
+    taskEXIT_CRITICAL(&w->lock);
+    return ok;
+}
+
+// 别人偷最早放进去的，和队列主人抢的是两头
+static bool deque_steal(pool_worker_t *w, pool_job_t *job)
+{
+    bool ok = false;
+    taskENTER_CRITICAL(&w->lock);
+    if (w->bottom != w->top)
+    {
+        *job = w->jobs[w->top & (POOL_DEQUE_LEN - 1)];
+        w->top++;
+        ok = true;
+    }
+    taskEXIT_CRITICAL(&w->lock);
+    return ok;
+}
+
+/******************************任务池******************************/
+
+// 当前任务是不是池里的工作任务，工作任务最多几个，直接遍历
+static pool_worker_t *pool_current_worker(task_pool_t *pool)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        if (pool->workers[i].task == self)
+            return &pool->workers[i];
+    }
+    return NULL;
+}
+
+static bool pool_take(task_pool_t *pool, pool_worker_t *self, pool_job_t *job)
+{
+    if (deque_pop(self, job))
+        return true;
+    // 从下一个开始偷，免得大家都去偷第0个
+    for (int i = 1; i < pool->worker_count; i++)
+    {
+        pool_worker_t *victim = &pool->workers[(self->index + i) % pool->worker_count];
+        if (deque_steal(victim, job))
+        {
+            self->stolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void pool_run(task_pool_t *pool, pool_worker_t *self, pool_job_t *job)
+{
+    job->fn(job->has_ctx ? job->ctx : job->arg);
+    self->executed++;
+    if (atomic_fetch_sub(&pool->pending, 1) == 1)
+    {
+        TaskHandle_t waiter = atomic_load(&pool->waiter);
+        if (waiter)
+            xTaskNotifyGive(waiter);
+    }
+}
+
+static void pool_worker_task(void *param)
+{
+    pool_worker_t *self = param;
+    task_pool_t *pool = self->pool;
+    pool_job_t job;
+
+    while (!pool->stop)
+    {
+        if (pool_take(pool, self, &job))
+        {
+            pool_run(pool, self, &job);
+            continue;
+        }
+        // 先标记要睡了再检查一次，和提交方"先放进队列再看有没有人睡"配合，不会丢掉唤醒
+        atomic_store(&self->sleeping, true);
+        if (pool_take(pool, self, &job))
+        {
+            atomic_store(&self->sleeping, false);
+            pool_run(pool, self, &job);
+            continue;
+        }
+        if (!pool->stop)
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        atomic_store(&self->sleeping, false);
+    }
+    atomic_fetch_sub(&pool->alive, 1);
+    vTaskDelete(NULL);
+}
+
+/*
+叫醒一个工作任务：活放进了谁的队列就先叫谁，它在忙的话就叫一个睡着的来偷，
+大家都在忙就不用叫了，它们干完手上的活自己会来取
+*/
+static void pool_wake(task_pool_t *pool, pool_worker_t *target)
+{
+    if (atomic_load(&target->sleeping))
+    {
+        xTaskNotifyGive(target->task);
+        return;
+    }
+    for (int i = 1; i < pool->worker_count; i++)
+    {
+        pool_worker_t *w = &pool->workers[(target->index + i) % pool->worker_count];
+        if (atomic_load(&w->sleeping))
+        {
+            xTaskNotifyGive(w->task);
+            return;
+        }
+    }
+}
+
+static esp_err_t pool_submit_job(task_pool_t *pool, const pool_job_t *job)
+{
+    atomic_fetch_add(&pool->pending, 1);
+    // 工作任务里提交的放进自己的队列，外面提交的轮流放
+    pool_worker_t *self = pool_current_worker(pool);
+    int start = self ? self->index : (int)(atomic_fetch_add(&pool->next, 1) % pool->worker_count);
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        pool_worker_t *w = &pool->workers[(start + i) % pool->worker_count];
+        if (deque_push(w, job))
+        {
+            pool_wake(pool, w);
+            return ESP_OK;
+        }
+    }
+    // 所有队列都满了
+    atomic_fetch_sub(&pool->pending, 1);
+    return ESP_ERR_NO_MEM;
+}
+
+/*
+创建任务池，每个核workers_per_core个工作任务，
+esp32c3只有一个核，一个工作任务阻塞的时候，其他工作任务可以把它队列里的活偷走
+*/
+task_pool_t *pool_create(int workers_per_core, uint32_t stack_size, UBaseType_t priority)
+{
+    int count = workers_per_core * portNUM_PROCESSORS;
+    if (count <= 0 || count > POOL_MAX_WORKERS)
+        return NULL;
+    task_pool_t *pool = calloc(1, sizeof(task_pool_t) + count * sizeof(pool_worker_t));
+    if (!pool)
+        return NULL;
+    pool->worker_count = count;
+    // 工作任务创建出来马上就会运行，所有的队列和锁要先初始化好
+    for (int i = 0; i < count; i++)
+    {
+        pool_worker_t *w = &pool->workers[i];
+        portMUX_INITIALIZE(&w->lock);
+        w->pool = pool;
+        w->index = i;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "pool%d", i);
+        atomic_fetch_add(&pool->alive, 1);
+        if (xTaskCreatePinnedToCore(pool_worker_task, name, stack_size, &pool->workers[i],
+                                    priority, &pool->workers[i].task, i % portNUM_PROCESSORS) != pdPASS)
+        {
+            ESP_LOGE(TAG, "create worker %d failed", i);
+            atomic_fetch_sub(&pool->alive, 1);
+            pool->worker_count = i;
+            break;
+        }
+    }
+    if (pool->worker_count == 0)
+    {
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/*提交一个活，fn(arg)会在某个工作任务里执行，arg要保证执行的时候还有效*/
+esp_err_t pool_submit(task_pool_t *pool, pool_fn_t fn, void *arg)
+{
+    pool_job_t job = {
+        .fn = fn,
+        .arg = arg,
+        .has_ctx = false};
+    return pool_submit_job(pool, &job);
+}
+
+/*提交一个活，把ctx拷贝一份随活一起保存，执行时fn拿到的是拷贝的指针，提交后ctx就可以释放了*/
+esp_err_t pool_submit_ctx(task_pool_t *pool, pool_fn_t fn, const void *ctx, size_t len)
+{
+    if (len > POOL_CTX_SIZE)
+        return ESP_ERR_INVALID_SIZE;
+    pool_job_t job = {
+        .fn = fn,
+        .has_ctx = true};
+    memcpy(job.ctx, ctx, len);
+    return pool_submit_job(pool, &job);
+}
+
+/*
+等到所有提交的活都执行完，同一时间只能有一个任务在等，
+不能在工作任务里调用。会用到调用者的任务通知
+*/
+esp_err_t pool_wait(task_pool_t *pool, TickType_t ticks_to_wait)
+{
+    TickType_t start = xTaskGetTickCount();
+    esp_err_t err = ESP_OK;
+    atomic_store(&pool->waiter, xTaskGetCurrentTaskHandle());
+    while (atomic_load(&pool->pending) != 0)
+    {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (ticks_to_wait != portMAX_DELAY && elapsed >= ticks_to_wait)
+        {
+            err = ESP_ERR_TIMEOUT;
+            break;
+        }
+        ulTaskNotifyTake(pdTRUE, ticks_to_wait == portMAX_DELAY ? portMAX_DELAY : ticks_to_wait - elapsed);
+    }
+    atomic_store(&pool->waiter, NULL);
+    return err;
+}
+
+/*停掉所有工作任务再释放，队列里没执行的活会被丢掉*/
+void pool_delete(task_pool_t *pool)
+{
+    pool->stop = true;
+    for (int i = 0; i < pool->worker_count; i++)
+        xTaskNotifyGive(pool->workers[i].task);
+    while (atomic_load(&pool->alive) > 0)
+        vTaskDelay(1);
+    free(pool);
+}
+
+/*打印每个工作任务执行了多少个活，然后清零*/
+void pool_stats_dump(task_pool_t *pool)
+{
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        pool_worker_t *w = &pool->workers[i];
+        ESP_LOGI(TAG, "  worker %d (core %d): executed %6" PRIu32 " stolen %6" PRIu32,
+                 i, i % portNUM_PROCESSORS, w->executed, w->stolen);
+        w->executed = 0;
+        w->stolen = 0;
+    }
+}
+
+/******************************例子******************************/
+
+#define BENCH_JOBS 10000     // 外部提交多少个活
+#define BENCH_JOB_US 20      // 每个活干多久
+#define BENCH_TREE_DEPTH 12  // 活里再提交活，二叉树的深度
+#define BENCH_TASK_JOBS 200  // 对比：每个活创建一个任务，创建多少个
+
+static task_pool_t *pool;
+static SemaphoreHandle_t done_sem;
+static atomic_int tree_dropped; // 队列满了没提交进去的活，包括它下面整棵子树
+
+static void busy_us(uint32_t us)
+{
+    int64_t end = esp_timer_get_time() + us;
+    while (esp_timer_get_time() < end)
+        ;
+}
+
+static void small_job(void *arg)
+{
+    busy_us(BENCH_JOB_US);
+}
+
+// 活里面继续提交两个子活，都放在自己的队列里，靠别的工作任务来偷
+static void tree_job(void *arg)
+{
+    int depth = *(int *)arg;
+    busy_us(BENCH_JOB_US);
+    if (depth <= 1)
+        return;
+    depth--;
+    // depth在栈上，用pool_submit_ctx拷贝一份
+    for (int i = 0; i < 2; i++)
+    {
+        if (pool_submit_ctx(pool, tree_job, &depth, sizeof(depth)) != ESP_OK)
+            atomic_fetch_add(&tree_dropped, (1 << depth) - 1);
+    }
+}
+
+static void task_per_job(void *param)
+{
+    busy_us(BENCH_JOB_US);
+    xSemaphoreGive(done_sem);
+    vTaskDelete(NULL);
+}
+
+void app_main(void)
+{
+    size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    // 每个核两个工作任务，优先级比app_main高
+    pool = pool_create(2, 3072, uxTaskPriorityGet(NULL) + 1);
+    ESP_LOGI(TAG, "pool with %d workers uses %zu bytes of heap",
+             pool->worker_count, heap_before - heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+
+    // 外面提交大量小活
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_JOBS; i++)
+    {
+        // 队列满了就等一下
+        while (pool_submit(pool, small_job, NULL) != ESP_OK)
+            vTaskDelay(1);
+    }
+    pool_wait(pool, portMAX_DELAY);
+    int64_t elapsed = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "submit from app_main: %d jobs %8.0f jobs/s", BENCH_JOBS, BENCH_JOBS * 1e6 / elapsed);
+    pool_stats_dump(pool);
+
+    // 活里面再提交活，所有的活最初都在一个工作任务的队列里，看其他工作任务偷走了多少
+    int depth = BENCH_TREE_DEPTH;
+    atomic_store(&tree_dropped, 0);
+    start = esp_timer_get_time();
+    if (pool_submit_ctx(pool, tree_job, &depth, sizeof(depth)) != ESP_OK)
+        atomic_store(&tree_dropped, (1 << BENCH_TREE_DEPTH) - 1);
+    pool_wait(pool, portMAX_DELAY);
+    elapsed = esp_timer_get_time() - start;
+    // 队列满了会丢掉整棵子树，只算真正执行了的
+    int dropped = atomic_load(&tree_dropped);
+    int tree_jobs = (1 << BENCH_TREE_DEPTH) - 1 - dropped;
+    ESP_LOGI(TAG, "fan-out inside workers: %d jobs (%d dropped, deque full) %8.0f jobs/s",
+             tree_jobs, dropped, tree_jobs * 1e6 / elapsed);
+    pool_stats_dump(pool);
+
+    // 对比：每个活创建一个任务
+    done_sem = xSemaphoreCreateCounting(BENCH_TASK_JOBS, 0);
+    start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_TASK_JOBS; i++)
+    {
+        while (xTaskCreate(task_per_job, "job", 2048, NULL, uxTaskPriorityGet(NULL) + 1, NULL) != pdPASS)
+            vTaskDelay(1);
+    }
+    for (int i = 0; i < BENCH_TASK_JOBS; i++)
+        xSemaphoreTake(done_sem, portMAX_DELAY);
+    elapsed = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "xTaskCreate per job: %d jobs %8.0f jobs/s", BENCH_TASK_JOBS, BENCH_TASK_JOBS * 1e6 / elapsed);
+
+    pool_delete(pool);
+}
@@ -0,0 +1,433 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+
+static const char *TAG = "example";
+
+/*
+任务CPU占用和调度延时的例子：
+task_CPU.c把任务绑定到不同的核，但是看不到每个核有多忙，也看不到任务就绪以后等了多久才运行。
+1. 定时用uxTaskGetSystemState读每个任务的运行时间，和上一次的差值就是这段时间的CPU占用，
+   空闲任务的占用反过来就是每个核的负载
+2. 用prof_notify/prof_notify_take代替xTaskNotifyGive/ulTaskNotifyTake，
+   记下通知的时间和任务真正开始运行的时间，差值就是唤醒延时，按任务统计分布
+3. 通知和唤醒事件记在一个环形缓冲区里，出问题的时候可以把最近的事件打印出来
+有了这些数据再去调任务的优先级和绑定的核
+*/
+
+#if !CONFIG_FREERTOS_USE_TRACE_FACILITY || !CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+#error "需要在menuconfig里打开FREERTOS_USE_TRACE_FACILITY和FREERTOS_GENERATE_RUN_TIME_STATS"
+#endif
+
+#define PROF_MAX_TASKS 32      // uxTaskGetSystemState最多读多少个任务
+#define PROF_MAX_LATENCY 8     // 最多统计几个任务的唤醒延时
+#define PROF_TRACE_LEN 128     // 事件缓冲区的长度
+#define PROF_NOTIFY_DEPTH 8    // 每个任务最多记几次还没被取走的通知的时间，2的幂
+
+/******************************延时直方图******************************/
+
+/*
+和http_server_bench.c里的直方图一样，说明见那里
+唤醒延时不会超过几秒，21*16个桶覆盖到2s，超过的算在最后一个桶里
+*/
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (21 * HIST_SUB_COUNT)
+
+typedef struct
+{
+    uint32_t buckets[HIST_BUCKETS];
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+} latency_hist_t;
+
+static int hist_index(uint32_t us)
+{
+    if (us < HIST_SUB_COUNT)
+        return us;
+    // 最高位决定区间，后面的4位决定区间内的桶
+    int msb = 31 - __builtin_clz(us);
+    int sub = (us >> (msb - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1);
+    int index = (msb - HIST_SUB_BITS + 1) * HIST_SUB_COUNT + sub;
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+// 返回桶的下界，作为这个桶的代表值
+static uint32_t hist_value(int index)
+{
+    if (index < HIST_SUB_COUNT)
+        return index;
+    int msb = index / HIST_SUB_COUNT + HIST_SUB_BITS - 1;
+    int sub = index % HIST_SUB_COUNT;
+    return (1u << msb) | ((uint32_t)sub << (msb - HIST_SUB_BITS));
+}
+
+static void hist_record(latency_hist_t *h, uint32_t us)
+{
+    h->buckets[hist_index(us)]++;
+    h->count++;
+    h->sum += us;
+    if (us > h->max)
+        h->max = us;
+}
+
+// 分位数，比如p99传入990
+static uint32_t hist_percentile(const latency_hist_t *h, uint32_t permille)
+{
+    uint64_t target = ((uint64_t)h->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= target && seen > 0)
+            return hist_value(i);
+    }
+    return 0;
+}
+
+/******************************唤醒延时和事件记录******************************/
+
+typedef enum
+{
+    PROF_EV_NOTIFY, // 发出通知
+    PROF_EV_RUN,    // 被通知的任务开始运行
+} prof_event_type_t;
+
+typedef struct
+{
+    uint32_t time_us;   // esp_timer的低32位
+    uint32_t latency_us;
+    uint8_t type;
+    uint8_t slot;
+    uint8_t core;
+    bool from_isr;
+} prof_event_t;
+
+typedef struct
+{
+    TaskHandle_t handle;
+    char name[16];
+    /*
+    每次通知的时间按顺序放进环形缓冲区，given是一共通知了几次，taken是被取走了几次
+    通知是先记时间再xTaskNotifyGive，任务可能在两者之间被前一次通知唤醒，
+    所以不能只记一个时间戳然后在唤醒时清零，否则这一次通知的时间会被清掉
+    */
+    int64_t notify_us[PROF_NOTIFY_DEPTH];
+    uint32_t given;
+    uint32_t taken;
+    latency_hist_t hist;
+} prof_slot_t;
+
+static prof_slot_t slots[PROF_MAX_LATENCY];
+static int slot_count;
+static prof_event_t trace[PROF_TRACE_LEN];
+static uint32_t trace_head;     // 一共记了多少个事件
+static portMUX_TYPE prof_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static prof_slot_t *IRAM_ATTR prof_find(TaskHandle_t task)
+{
+    for (int i = 0; i < slot_count; i++)
+    {
+        if (slots[i].handle == task)
+            return &slots[i];
+    }
+    return NULL;
+}
+
+// 要在prof_mux里调用
+static void IRAM_ATTR prof_trace_add_locked(prof_event_type_t type, prof_slot_t *slot, int64_t now, uint32_t latency_us, bool from_isr)
+{
+    prof_event_t *ev = &trace[trace_head % PROF_TRACE_LEN];
+    ev->time_us = (uint32_t)now;
+    ev->latency_us = latency_us;
+    ev->type = type;
+    ev->slot = slot - slots;
+    ev->core = xPortGetCoreID();
+    ev->from_isr = from_isr;
+    trace_head++;
+}
+
+/*登记要统计唤醒延时的任务，要在开始用prof_notify之前登记*/
+esp_err_t prof_latency_register(TaskHandle_t task, const char *name)
+{
+    if (slot_count >= PROF_MAX_LATENCY)
+        return ESP_ERR_NO_MEM;
+    prof_slot_t *slot = &slots[slot_count];
+    memset(slot, 0, sizeof(*slot));
+    slot->handle = task;
+    snprintf(slot->name, sizeof(slot->name), "%s", name);
+    slot_count++;
+    return ESP_OK;
+}
+
+/*代替xTaskNotifyGive，记下通知的时间*/
+BaseType_t prof_notify(TaskHandle_t task)
+{
+    prof_slot_t *slot = prof_find(task);
+    if (slot)
+    {
+        int64_t now = esp_timer_get_time();
+        taskENTER_CRITICAL(&prof_mux);
+        slot->notify_us[slot->given % PROF_NOTIFY_DEPTH] = now;
+        slot->given++;
+        prof_trace_add_locked(PROF_EV_NOTIFY, slot, now, 0, false);
+        taskEXIT_CRITICAL(&prof_mux);
+    }
+    return xTaskNotifyGive(task);
+}
+
+/*代替vTaskNotifyGiveFromISR*/
+void IRAM_ATTR prof_notify_from_isr(TaskHandle_t task, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    prof_slot_t *slot = prof_find(task);
+    if (slot)
+    {
+        int64_t now = esp_timer_get_time();
+        taskENTER_CRITICAL_ISR(&prof_mux);
+        slot->notify_us[slot->given % PROF_NOTIFY_DEPTH] = now;
+        slot->given++;
+        prof_trace_add_locked(PROF_EV_NOTIFY, slot, now, 0, true);
+        taskEXIT_CRITICAL_ISR(&prof_mux);
+    }
+    vTaskNotifyGiveFromISR(task, pxHigherPriorityTaskWoken);
+}
+
+/*代替ulTaskNotifyTake，返回以后记下从通知到现在的时间*/
+uint32_t prof_notify_take(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    uint32_t value = ulTaskNotifyTake(clear_on_exit, ticks_to_wait);
+    if (value == 0)
+        return 0;
+    int64_t now = esp_timer_get_time();
+    prof_slot_t *slot = prof_find(xTaskGetCurrentTaskHandle());
+    if (slot)
+    {
+        taskENTER_CRITICAL(&prof_mux);
+        uint32_t pending = slot->given - slot->taken;
+        if (pending)
+        {
+            // 缓冲区满了以后旧的时间被覆盖，从还留着的最早那次算起
+            if (pending > PROF_NOTIFY_DEPTH)
+                slot->taken = slot->given - PROF_NOTIFY_DEPTH;
+            // 一次唤醒取走了几次通知，延时从其中最早的那次算起
+            uint32_t latency = now - slot->notify_us[slot->taken % PROF_NOTIFY_DEPTH];
+            hist_record(&slot->hist, latency);
+            prof_trace_add_locked(PROF_EV_RUN, slot, now, latency, false);
+            // clear_on_exit时value是取走的通知数，否则只取走一次
+            // 已经记了时间但还没xTaskNotifyGive的通知不在value里，留给下一次唤醒
+            uint32_t consumed = clear_on_exit ? value : 1;
+            slot->taken += consumed < slot->given - slot->taken ? consumed : slot->given - slot->taken;
+        }
+        taskEXIT_CRITICAL(&prof_mux);
+    }
+    return value;
+}
+
+/*按时间顺序打印最近的事件*/
+void prof_trace_dump(void)
+{
+    static prof_event_t copy[PROF_TRACE_LEN];
+    taskENTER_CRITICAL(&prof_mux);
+    uint32_t head = trace_head;
+    memcpy(copy, trace, sizeof(copy));
+    taskEXIT_CRITICAL(&prof_mux);
+
+    uint32_t count = head < PROF_TRACE_LEN ? head : PROF_TRACE_LEN;
+    ESP_LOGI(TAG, "last %" PRIu32 " events:", count);
+    for (uint32_t i = head - count; i != head; i++)
+    {
+        prof_event_t *ev = &copy[i % PROF_TRACE_LEN];
+        if (ev->type == PROF_EV_NOTIFY)
+            ESP_LOGI(TAG, "  %10" PRIu32 " core %d notify %s%s", ev->time_us, ev->core, slots[ev->slot].name, ev->from_isr ? " (isr)" : "");
+        else
+            ESP_LOGI(TAG, "  %10" PRIu32 " core %d run    %s after %" PRIu32 "us", ev->time_us, ev->core, slots[ev->slot].name, ev->latency_us);
+    }
+}
+
+/******************************CPU占用******************************/
+
+typedef struct
+{
+    TaskHandle_t handle;
+    uint32_t runtime;
+} prof_prev_t;
+
+static TaskStatus_t status[PROF_MAX_TASKS];
+static prof_prev_t prev[PROF_MAX_TASKS];
+static int prev_count;
+static uint32_t prev_total;
+
+static uint32_t prof_prev_runtime(TaskHandle_t handle)
+{
+    for (int i = 0; i < prev_count; i++)
+    {
+        if (prev[i].handle == handle)
+            return prev[i].runtime;
+    }
+    // 新创建的任务
+    return 0;
+}
+
+/*
+打印上一次调用到现在每个核的负载、每个任务的CPU占用(占一个核的百分比)，
+以及每个登记过的任务的唤醒延时，打印完清零
+*/
+void prof_report(void)
+{
+    uint32_t total;
+    int count = uxTaskGetSystemState(status, PROF_MAX_TASKS, &total);
+    if (count == 0)
+    {
+        ESP_LOGW(TAG, "more than %d tasks", PROF_MAX_TASKS);
+        return;
+    }
+    uint32_t elapsed = total - prev_total;
+    if (elapsed == 0)
+        return;
+
+    // 先算出每个任务的差值，放在ulRunTimeCounter里，按占用从大到小排序
+    static uint32_t runtime[PROF_MAX_TASKS];
+    for (int i = 0; i < count; i++)
+    {
+        runtime[i] = status[i].ulRunTimeCounter;
+        status[i].ulRunTimeCounter = runtime[i] - prof_prev_runtime(status[i].xHandle);
+    }
+    // 全部算完再更新，上面查找的时候还要用上一次的
+    for (int i = 0; i < count; i++)
+    {
+        prev[i].handle = status[i].xHandle;
+        prev[i].runtime = runtime[i];
+    }
+    prev_count = count;
+    prev_total = total;
+    for (int i = 1; i < count; i++)
+    {
+        TaskStatus_t tmp = status[i];
+        int j = i - 1;
+        while (j >= 0 && status[j].ulRunTimeCounter < tmp.ulRunTimeCounter)
+        {
+            status[j + 1] = status[j];
+            j--;
+        }
+        status[j + 1] = tmp;
+    }
+
+    // 空闲任务跑了多久，核就闲了多久
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        TaskHandle_t idle = xTaskGetIdleTaskHandleForCPU(core);
+        for (int i = 0; i < count; i++)
+        {
+            if (status[i].xHandle == idle)
+                ESP_LOGI(TAG, "core %d busy %5.1f%%", core, 100.0f - status[i].ulRunTimeCounter * 100.0f / elapsed);
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (status[i].ulRunTimeCounter == 0)
+            break;
+        ESP_LOGI(TAG, "  %-16s prio %2u %5.1f%%", status[i].pcTaskName,
+                 (unsigned)status[i].uxCurrentPriority, status[i].ulRunTimeCounter * 100.0f / elapsed);
+    }
+
+    for (int i = 0; i < slot_count; i++)
+    {
+        static latency_hist_t hist;
+        taskENTER_CRITICAL(&prof_mux);
+        hist = slots[i].hist;
+        memset(&slots[i].hist, 0, sizeof(slots[i].hist));
+        taskEXIT_CRITICAL(&prof_mux);
+        if (hist.count == 0)
+            continue;
+        ESP_LOGI(TAG, "  %-16s wakeup latency avg %" PRIu32 "us p50 %" PRIu32 "us p99 %" PRIu32 "us max %" PRIu32 "us (%" PRIu32 ")",
+                 slots[i].name, (uint32_t)(hist.sum / hist.count), hist_percentile(&hist, 500),
+                 hist_percentile(&hist, 990), hist.max, hist.count);
+    }
+}
+
+static void prof_task(void *param)
+{
+    uint32_t period_ms = (uintptr_t)param;
+    TickType_t last_wake = xTaskGetTickCount();
+    prof_report(); // 第一次打印的是开机以来的数据
+    while (1)
+    {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(period_ms));
+        ESP_LOGI(TAG, "-------- last %" PRIu32 "ms --------", period_ms);
+        prof_report();
+    }
+}
+
+/*每period_ms打印一次报告，报告任务的优先级要比被统计的任务高，不然负载高的时候打印不出来*/
+esp_err_t prof_start(uint32_t period_ms, UBaseType_t priority)
+{
+    if (xTaskCreate(prof_task, "profiler", 4096, (void *)(uintptr_t)period_ms, priority, NULL) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
+
+/******************************例子******************************/
+
+static TaskHandle_t high_task;
+static TaskHandle_t low_task;
+
+// 占用CPU的任务：忙20ms，睡10ms
+static void busy_task(void *param)
+{
+    while (1)
+    {
+        int64_t end = esp_timer_get_time() + 20000;
+        while (esp_timer_get_time() < end)
+            ;
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+// 被通知的任务，做一点点事
+static void worker_task(void *param)
+{
+    while (1)
+    {
+        prof_notify_take(pdTRUE, portMAX_DELAY);
+        int64_t end = esp_timer_get_time() + 200;
+        while (esp_timer_get_time() < end)
+            ;
+    }
+}
+
+// 每5ms同时通知两个优先级不同的任务
+static void notify_timer_cb(void *arg)
+{
+    prof_notify(high_task);
+    prof_notify(low_task);
+}
+
+void app_main(void)
+{
+    // busy_task的优先级在两个worker之间，低优先级的worker要等它睡了才能运行
+    xTaskCreatePinnedToCore(busy_task, "busy", 2048, NULL, 5, NULL, 0);
+    xTaskCreatePinnedToCore(worker_task, "worker_high", 2048, NULL, 8, &high_task, 0);
+    xTaskCreatePinnedToCore(worker_task, "worker_low", 2048, NULL, 3, &low_task, 0);
+    prof_latency_register(high_task, "worker_high");
+    prof_latency_register(low_task, "worker_low");
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = notify_timer_cb,
+        .name = "notify"};
+    esp_timer_handle_t timer;
+    esp_timer_create(&timer_args, &timer);
+    esp_timer_start_periodic(timer, 5000);
+
+    prof_start(2000, 10);
+
+    vTaskDelay(pdMS_TO_TICKS(7000));
+    prof_trace_dump();
+}
@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "esp_system.h"
+#include "esp_random.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+static const char *TAG = "example";
+
+/*
+分层时间轮的例子：
+TIM_freertos.c每个定时器一个xTimerCreate，TIM_esp.c每个定时器一个esp_timer_create，
+每个定时器都是一个单独的对象，按到期时间插在有序链表里，启动、停止还要经过定时器任务的命令队列。
+每个连接、每个设备一个超时的话，定时器有成千上万个，插入有序链表越来越慢，内存也不少。
+这里用一个esp_timer按固定的tick驱动一个分层时间轮：
+1. 第0层256个槽，每个槽一个tick；第1~3层各64个槽，每个槽是下一层转一圈的时间，
+   tick为1ms时最长可以定18个多小时
+2. 启动、停止、重启都只是在槽的链表里插入、删除一个节点，O(1)，直接在调用的任务里做，不用发命令
+3. 第0层转完一圈时把上一层的一个槽重新分到下面各层(级联)
+4. 每个tick把到期的槽整个摘下来，再一个个调用回调，回调在esp_timer任务里执行，不能阻塞
+5. tw_timer_t由调用者分配，可以嵌在连接的结构体里，不用单独malloc
+*/
+
+#define TW_LEVEL0_BITS 8
+#define TW_LEVEL_BITS 6
+#define TW_LEVELS 4 // 第0层加上3个上层
+#define TW_LEVEL0_SIZE (1 << TW_LEVEL0_BITS)
+#define TW_LEVEL_SIZE (1 << TW_LEVEL_BITS)
+#define TW_MAX_TICKS ((1UL << (TW_LEVEL0_BITS + (TW_LEVELS - 1) * TW_LEVEL_BITS)) - 1)
+
+typedef struct tw_timer tw_timer_t;
+typedef void (*tw_callback_t)(tw_timer_t *timer, void *arg);
+
+struct tw_timer
+{
+    tw_timer_t *next;
+    tw_timer_t **pprev; // 指向前一个节点的next(或者槽的表头)，删除时不用找前一个节点，NULL表示没有启动
+    uint32_t expires;   // 到期的tick
+    uint32_t period;    // 周期，单位tick，0表示单次
+    tw_callback_t cb;
+    void *arg;
+};
+
+typedef struct
+{
+    portMUX_TYPE lock;
+    uint32_t now;     // 下一个要处理的tick
+    uint32_t tick_us;
+    int64_t start_us;
+    tw_timer_t *level0[TW_LEVEL0_SIZE];
+    tw_timer_t *levels[TW_LEVELS - 1][TW_LEVEL_SIZE];
+    esp_timer_handle_t timer;
+    // 统计
+    uint32_t pending;
+    uint32_t fired;
+    uint32_t max_batch; // 一个tick最多到期了多少个
+    uint32_t cascaded;
+} timer_wheel_t;
+
+static void tw_link(tw_timer_t **head, tw_timer_t *t)
+{
+    t->next = *head;
+    if (t->next)
+        t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+}
+
+static void tw_unlink(tw_timer_t *t)
+{
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+// 按离现在还有多少tick放到对应的层，要在lock里调用
+static void tw_add_locked(timer_wheel_t *tw, tw_timer_t *t)
+{
+    uint32_t expires = t->expires;
+    uint32_t delta = expires - tw->now;
+    tw_timer_t **head;
+    if ((int32_t)delta < 0)
+    {
+        // 已经过期了(比如回调里重启、处理慢了)，下一个tick马上处理
+        head = &tw->level0[tw->now & (TW_LEVEL0_SIZE - 1)];
+    }
+    else if (delta < TW_LEVEL0_SIZE)
+    {
+        head = &tw->level0[expires & (TW_LEVEL0_SIZE - 1)];
+    }
+    else
+    {
+        if (delta > TW_MAX_TICKS)
+        {
+            // 超出范围的先放在最高层最远的槽，转到时会重新级联
+            expires = tw->now + TW_MAX_TICKS;
+            delta = TW_MAX_TICKS;
+        }
+        int level = 1;
+        while (delta >= (1UL << (TW_LEVEL0_BITS + level * TW_LEVEL_BITS)))
+            level++;
+        uint32_t index = (expires >> (TW_LEVEL0_BITS + (level - 1) * TW_LEVEL_BITS)) & (TW_LEVEL_SIZE - 1);
+        head = &tw->levels[level - 1][index];
+    }
+    tw_link(head, t);
+}
+
+/*初始化定时器，cb在时间轮的tick里调用*/
+void tw_timer_init(tw_timer_t *t, tw_callback_t cb, void *arg)
+{
+    memset(t, 0, sizeof(*t));
+    t->cb = cb;
+    t->arg = arg;
+}
+
+static uint32_t tw_ms_to_ticks(timer_wheel_t *tw, uint32_t ms)
+{
+    uint32_t ticks = ((uint64_t)ms * 1000 + tw->tick_us - 1) / tw->tick_us;
+    return ticks ? ticks : 1;
+}
+
+/*
+启动定时器，timeout_ms后到期，period_ms不为0的话之后每period_ms到期一次。
+已经启动的定时器会重新开始计时，可以在回调里调用
+*/
+void tw_start(timer_wheel_t *tw, tw_timer_t *t, uint32_t timeout_ms, uint32_t period_ms)
+{
+    uint32_t ticks = tw_ms_to_ticks(tw, timeout_ms);
+    uint32_t period = period_ms ? tw_ms_to_ticks(tw, period_ms) : 0;
+    taskENTER_CRITICAL(&tw->lock);
+    if (t->pprev)
+        tw_unlink(t);
+    else
+        tw->pending++;
+    // now是下一个要处理的tick，现在已经过了它前面那个tick的一部分，所以不用再减1，最多晚一个tick
+    t->expires = tw->now + ticks;
+    t->period = period;
+    tw_add_locked(tw, t);
+    taskEXIT_CRITICAL(&tw->lock);
+}
+
+/*停止定时器，返回停止前是不是在运行。回调已经开始执行的话不会等它返回*/
+bool tw_stop(timer_wheel_t *tw, tw_timer_t *t)
+{
+    bool was_pending = false;
+    taskENTER_CRITICAL(&tw->lock);
+    if (t->pprev)
+    {
+        tw_unlink(t);
+        tw->pending--;
+        was_pending = true;
+    }
+    taskEXIT_CRITICAL(&tw->lock);
+    return was_pending;
+}
+
+bool tw_is_pending(timer_wheel_t *tw, tw_timer_t *t)
+{
+    taskENTER_CRITICAL(&tw->lock);
+    bool pending = t->pprev != NULL;
+    taskEXIT_CRITICAL(&tw->lock);
+    return pending;
+}
+
+/*
+把一个槽整个摘到本地的链表上再一个个取出来，每次只锁一个节点，不会因为槽里定时器多就关中断太久。
+摘下来的节点pprev还是有效的，别的任务这时候停止它也没问题
+*/
+static tw_timer_t *tw_detach_locked(tw_timer_t **slot, tw_timer_t **list)
+{
+    *list = *slot;
+    *slot = NULL;
+    if (*list)
+        (*list)->pprev = list;
+    return *list;
+}
+
+// 把上层的一个槽重新分到下面各层，返回槽的序号，为0说明这一层也转完一圈了
+static uint32_t tw_cascade(timer_wheel_t *tw, int level)
+{
+    uint32_t index = (tw->now >> (TW_LEVEL0_BITS + (level - 1) * TW_LEVEL_BITS)) & (TW_LEVEL_SIZE - 1);
+    tw_timer_t *list;
+    taskENTER_CRITICAL(&tw->lock);
+    tw_detach_locked(&tw->levels[level - 1][index], &list);
+    while (list)
+    {
+        tw_timer_t *t = list;
+        tw_unlink(t);
+        tw_add_locked(tw, t);
+        tw->cascaded++;
+        // 放开一下让中断和别的核有机会进来
+        taskEXIT_CRITICAL(&tw->lock);
+        taskENTER_CRITICAL(&tw->lock);
+    }
+    taskEXIT_CRITICAL(&tw->lock);
+    return index;
+}
+
+// 处理一个tick：需要的话先级联，再把这个tick到期的定时器一起回调
+static void tw_run_tick(timer_wheel_t *tw)
+{
+    uint32_t index = tw->now & (TW_LEVEL0_SIZE - 1);
+    if (index == 0)
+    {
+        for (int level = 1; level < TW_LEVELS; level++)
+        {
+            if (tw_cascade(tw, level) != 0)
+                break;
+        }
+    }
+
+    tw_timer_t *list;
+    uint32_t batch = 0;
+    taskENTER_CRITICAL(&tw->lock);
+    tw_detach_locked(&tw->level0[index], &list);
+    tw->now++;
+    while (list)
+    {
+        tw_timer_t *t = list;
+        tw_unlink(t);
+        if (t->period)
+        {
+            // 按上一次到期的时间算下一次，回调处理慢了也不会累积误差
+            t->expires += t->period;
+            tw_add_locked(tw, t);
+        }
+        else
+        {
+            tw->pending--;
+        }
+        taskEXIT_CRITICAL(&tw->lock);
+        t->cb(t, t->arg);
+        batch++;
+        taskENTER_CRITICAL(&tw->lock);
+    }
+    tw->fired += batch;
+    if (batch > tw->max_batch)
+        tw->max_batch = batch;
+    taskEXIT_CRITICAL(&tw->lock);
+}
+
+// esp_timer的回调，按实际经过的时间补上漏掉的tick
+static void tw_tick_cb(void *arg)
+{
+    timer_wheel_t *tw = arg;
+    uint32_t current = (esp_timer_get_time() - tw->start_us) / tw->tick_us;
+    while ((int32_t)(current - tw->now) >= 0)
+        tw_run_tick(tw);
+}
+
+/*初始化时间轮，用一个周期tick_ms的esp_timer驱动*/
+esp_err_t tw_init(timer_wheel_t *tw, uint32_t tick_ms)
+{
+    if (tick_ms == 0)
+        return ESP_ERR_INVALID_ARG;
+    memset(tw, 0, sizeof(*tw));
+    portMUX_INITIALIZE(&tw->lock);
+    tw->tick_us = tick_ms * 1000;
+    tw->start_us = esp_timer_get_time();
+    tw->now = 1;
+    const esp_timer_create_args_t timer_args = {
+        .callback = tw_tick_cb,
+        .arg = tw,
+        .dispatch_method = ESP_TIMER_TASK,
+        // 漏掉的tick在回调里按时间补，不用esp_timer补调
+        .skip_unhandled_events = true,
+        .name = "timer_wheel"};
+    esp_err_t err = esp_timer_create(&timer_args, &tw->timer);
+    if (err != ESP_OK)
+        return err;
+    err = esp_timer_start_periodic(tw->timer, tw->tick_us);
+    if (err != ESP_OK)
+        esp_timer_delete(tw->timer);
+    return err;
+}
+
+/*停止驱动的esp_timer，还在运行的定时器不会再到期，由调用者自己释放*/
+void tw_deinit(timer_wheel_t *tw)
+{
+    esp_timer_stop(tw->timer);
+    esp_timer_delete(tw->timer);
+}
+
+void tw_stats_dump(timer_wheel_t *tw)
+{
+    ESP_LOGI(TAG, "wheel: pending %" PRIu32 " fired %" PRIu32 " max batch %" PRIu32 " cascaded %" PRIu32,
+             tw->pending, tw->fired, tw->max_batch, tw->cascaded);
+}
+
+/******************************例子******************************/
+
+#define DEMO_TIMERS 1000
+#define DEMO_SECONDS 5
+
+static timer_wheel_t wheel;
+
+typedef struct
+{
+    tw_timer_t timer;
+    int64_t due_us;
+    uint32_t period_ms;
+} demo_timer_t;
+
+static int64_t max_late_us;
+static uint32_t demo_fired;
+
+// 到期时间和应该到期的时间比，看晚了多少
+static void demo_cb(tw_timer_t *timer, void *arg)
+{
+    demo_timer_t *d = arg;
+    int64_t late = esp_timer_get_time() - d->due_us;
+    if (late > max_late_us)
+        max_late_us = late;
+    d->due_us += d->period_ms * 1000;
+    demo_fired++;
+}
+
+static void dummy_cb(tw_timer_t *timer, void *arg)
+{
+}
+
+static void dummy_freertos_cb(TimerHandle_t timer)
+{
+}
+
+// 超时都在1~60s之间，测试过程中不会到期
+static uint32_t random_timeout_ms(void)
+{
+    return 1000 + esp_random() % 59000;
+}
+
+// 启动、重启、停止各一遍，返回每秒多少次操作
+static void bench_wheel(int n)
+{
+    size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    tw_timer_t *timers = calloc(n, sizeof(tw_timer_t));
+    if (!timers)
+    {
+        ESP_LOGW(TAG, "wheel %d timers: no memory", n);
+        return;
+    }
+    size_t heap_used = heap_before - heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    for (int i = 0; i < n; i++)
+        tw_timer_init(&timers[i], dummy_cb, NULL);
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < n; i++)
+        tw_start(&wheel, &timers[i], random_timeout_ms(), 0);
+    for (int i = 0; i < n; i++)
+        tw_start(&wheel, &timers[i], random_timeout_ms(), 0);
+    for (int i = 0; i < n; i++)
+        tw_stop(&wheel, &timers[i]);
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    ESP_LOGI(TAG, "wheel    %5d timers: %8.0f ops/s, %3zu bytes/timer",
+             n, n * 3 * 1e6 / elapsed, heap_used / n);
+    free(timers);
+}
+
+// 命令要经过定时器任务的队列，队列满了就等定时器任务处理
+static void bench_freertos(int n)
+{
+    size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    TimerHandle_t *timers = calloc(n, sizeof(TimerHandle_t));
+    if (!timers)
+    {
+        ESP_LOGW(TAG, "xTimer   %d timers: no memory", n);
+        return;
+    }
+    size_t handles = heap_before - heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    int created = 0;
+    while (created < n)
+    {
+        timers[created] = xTimerCreate("bench", 1000, pdFALSE, NULL, dummy_freertos_cb);
+        if (!timers[created])
+            break;
+        created++;
+    }
+    if (created < n)
+        ESP_LOGW(TAG, "xTimer   %d timers: only %d created", n, created);
+    if (created == 0)
+    {
+        free(timers);
+        return;
+    }
+    // 句柄数组不算在定时器里
+    size_t heap_used = heap_before - heap_caps_get_free_size(MALLOC_CAP_DEFAULT) - handles;
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < created; i++)
+        xTimerChangePeriod(timers[i], pdMS_TO_TICKS(random_timeout_ms()), portMAX_DELAY);
+    for (int i = 0; i < created; i++)
+        xTimerChangePeriod(timers[i], pdMS_TO_TICKS(random_timeout_ms()), portMAX_DELAY);
+    for (int i = 0; i < created; i++)
+        xTimerStop(timers[i], portMAX_DELAY);
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    ESP_LOGI(TAG, "xTimer   %5d timers: %8.0f ops/s, %3zu bytes/timer",
+             created, created * 3 * 1e6 / elapsed, heap_used / created);
+    for (int i = 0; i < created; i++)
+        xTimerDelete(timers[i], portMAX_DELAY);
+    free(timers);
+    // 删除也是命令，等定时器任务释放完内存
+    vTaskDelay(pdMS_TO_TICKS(100));
+}
+
+void app_main(void)
+{
+    ESP_ERROR_CHECK(tw_init(&wheel, 1));
+
+    // 1000个周期不同的定时器一起跑，看到期的准不准
+    demo_timer_t *demo = calloc(DEMO_TIMERS, sizeof(demo_timer_t));
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < DEMO_TIMERS; i++)
+    {
+        demo[i].period_ms = 10 + esp_random() % 991;
+        demo[i].due_us = now + demo[i].period_ms * 1000;
+        tw_timer_init(&demo[i].timer, demo_cb, &demo[i]);
+        tw_start(&wheel, &demo[i].timer, demo[i].period_ms, demo[i].period_ms);
+    }
+    vTaskDelay(pdMS_TO_TICKS(DEMO_SECONDS * 1000));
+    for (int i = 0; i < DEMO_TIMERS; i++)
+        tw_stop(&wheel, &demo[i].timer);
+    ESP_LOGI(TAG, "%d timers fired %" PRIu32 " times in %ds, max late %" PRIi64 "us",
+             DEMO_TIMERS, demo_fired, DEMO_SECONDS, max_late_us);
+    tw_stats_dump(&wheel);
+    // 等可能正在执行的回调返回再释放
+    vTaskDelay(pdMS_TO_TICKS(10));
+    free(demo);
+
+    // 和xTimerCreate比启动、重启、停止的速度和每个定时器占的内存，内存不够时xTimer能建多少算多少
+    const int counts[] = {10, 1000, 10000};
+    for (int i = 0; i < (int)(sizeof(counts) / sizeof(counts[0])); i++)
+    {
+        bench_wheel(counts[i]);
+        bench_freertos(counts[i]);
+    }
+}
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+static const char *TAG = "example";
+
+/*
+令牌桶限流的例子：
+count_sem.c用xSemaphoreCreateCounting(5, 5)当配额，另外开一个任务每6s补一个。
+每个限流器都要一个补充的任务太浪费，这里改成取令牌的时候按经过的时间算出补了多少：
+1. 桶里最多capacity个令牌，每period_ms补tokens_per_period个，补满为止，中间是连续补的
+2. 一次可以取多个令牌，比如按字节数限制网络发送、flash写入的速度
+3. 不等待的版本拿不到马上返回；等待的版本先把令牌预约下来(桶里的令牌可以变成负数)，
+   再睡到令牌补够的时间，后来的人要排在后面，所以总的速度是准的。
+   超时时间内补不够的话直接返回超时，不用白等
+*/
+
+typedef struct
+{
+    portMUX_TYPE lock;
+    // 令牌数都乘了period_us，补充的时候不用做除法，也不会丢掉零头
+    int64_t level;          // 当前的令牌，被预约了可以是负数
+    int64_t capacity;
+    uint32_t tokens_per_period;
+    uint32_t period_us;
+    int64_t last_us;        // 上一次补充的时间
+} token_bucket_t;
+
+/*初始化，桶一开始是满的*/
+esp_err_t tb_init(token_bucket_t *tb, uint32_t capacity, uint32_t tokens_per_period, uint32_t period_ms)
+{
+    if (capacity == 0 || tokens_per_period == 0 || period_ms == 0)
+        return ESP_ERR_INVALID_ARG;
+    memset(tb, 0, sizeof(*tb));
+    portMUX_INITIALIZE(&tb->lock);
+    tb->tokens_per_period = tokens_per_period;
+    tb->period_us = period_ms * 1000;
+    tb->capacity = (int64_t)capacity * tb->period_us;
+    tb->level = tb->capacity;
+    tb->last_us = esp_timer_get_time();
+    return ESP_OK;
+}
+
+// 按经过的时间补充令牌，要在lock里调用
+static void tb_refill_locked(token_bucket_t *tb, int64_t now)
+{
+    tb->level += (now - tb->last_us) * tb->tokens_per_period;
+    if (tb->level > tb->capacity)
+        tb->level = tb->capacity;
+    tb->last_us = now;
+}
+
+// 还差多少才够，换算成要等多少微秒
+static int64_t tb_wait_us_locked(token_bucket_t *tb, int64_t need)
+{
+    if (tb->level >= need)
+        return 0;
+    return (need - tb->level + tb->tokens_per_period - 1) / tb->tokens_per_period;
+}
+
+/*不等待，n个令牌都拿到了返回true，一个都不会拿走*/
+bool tb_try_acquire(token_bucket_t *tb, uint32_t n)
+{
+    int64_t need = (int64_t)n * tb->period_us;
+    bool ok = false;
+    taskENTER_CRITICAL(&tb->lock);
+    tb_refill_locked(tb, esp_timer_get_time());
+    if (tb->level >= need)
+    {
+        tb->level -= need;
+        ok = true;
+    }
+    taskEXIT_CRITICAL(&tb->lock);
+    return ok;
+}
+
+/*
+取n个令牌，最多等ticks_to_wait，等不到返回ESP_ERR_TIMEOUT，
+n比桶的容量还大的话永远拿不到，返回ESP_ERR_INVALID_ARG
+*/
+esp_err_t tb_acquire(token_bucket_t *tb, uint32_t n, TickType_t ticks_to_wait)
+{
+    int64_t need = (int64_t)n * tb->period_us;
+    if (need > tb->capacity)
+        return ESP_ERR_INVALID_ARG;
+
+    taskENTER_CRITICAL(&tb->lock);
+    tb_refill_locked(tb, esp_timer_get_time());
+    int64_t wait_us = tb_wait_us_locked(tb, need);
+    bool ok = ticks_to_wait == portMAX_DELAY || wait_us <= (int64_t)ticks_to_wait * portTICK_PERIOD_MS * 1000;
+    // 超时之前补得够才预约，补不够就不要占着
+    if (ok)
+        tb->level -= need;
+    taskEXIT_CRITICAL(&tb->lock);
+
+    if (!ok)
+        return ESP_ERR_TIMEOUT;
+    if (wait_us > 0)
+    {
+        // 向上取整到tick，最多多睡一个tick，不影响总的速度
+        int64_t tick_us = portTICK_PERIOD_MS * 1000;
+        vTaskDelay((wait_us + tick_us - 1) / tick_us);
+    }
+    return ESP_OK;
+}
+
+/*现在桶里有几个令牌，负数表示已经被预约到以后了*/
+int32_t tb_available(token_bucket_t *tb)
+{
+    taskENTER_CRITICAL(&tb->lock);
+    tb_refill_locked(tb, esp_timer_get_time());
+    int64_t level = tb->level;
+    taskEXIT_CRITICAL(&tb->lock);
+    // 向下取整，-0.5个算-1个
+    return level >= 0 ? level / tb->period_us : -((-level + tb->period_us - 1) / tb->period_us);
+}
+
+/*还要多久才能拿到n个令牌，单位微秒*/
+int64_t tb_time_until(token_bucket_t *tb, uint32_t n)
+{
+    taskENTER_CRITICAL(&tb->lock);
+    tb_refill_locked(tb, esp_timer_get_time());
+    int64_t wait_us = tb_wait_us_locked(tb, (int64_t)n * tb->period_us);
+    taskEXIT_CRITICAL(&tb->lock);
+    return wait_us;
+}
+
+/******************************例子******************************/
+
+#define BENCH_RATE 1000       // 每秒多少个令牌
+#define BENCH_BURST 100       // 桶的容量
+#define BENCH_SECONDS 10
+#define BENCH_TASKS 4
+
+static token_bucket_t quota;
+static token_bucket_t bench_bucket;
+static atomic_uint granted;
+static atomic_uint rejected;
+static volatile bool running;
+static SemaphoreHandle_t done_sem;
+
+// 和count_sem.c一样，1s要一个配额，没有配额了直接放弃
+static void quota_task(void *pvParam)
+{
+    while (1)
+    {
+        ESP_LOGI(TAG, "剩余%" PRIi32, tb_available(&quota));
+        if (tb_try_acquire(&quota, 1))
+            ESP_LOGI(TAG, "已分配");
+        else
+            ESP_LOGI(TAG, "无法分配，%" PRIi64 "ms后有配额", tb_time_until(&quota, 1) / 1000);
+        vTaskDelay(pdMS_TO_TICKS(1000));
+    }
+}
+
+/*
+突发的请求：一次连着发几个请求，每个请求要1~32个令牌，
+一半的请求愿意一直等，另一半最多等50ms，然后歇一会儿
+*/
+static void burst_task(void *pvParam)
+{
+    while (running)
+    {
+        int burst = 1 + esp_random() % 8;
+        for (int i = 0; i < burst && running; i++)
+        {
+            uint32_t n = 1 + esp_random() % 32;
+            TickType_t wait = (esp_random() & 1) ? portMAX_DELAY : pdMS_TO_TICKS(50);
+            if (tb_acquire(&bench_bucket, n, wait) == ESP_OK)
+                atomic_fetch_add(&granted, n);
+            else
+                atomic_fetch_add(&rejected, n);
+        }
+        vTaskDelay(pdMS_TO_TICKS(esp_random() % 200));
+    }
+    xSemaphoreGive(done_sem);
+    vTaskDelete(NULL);
+}
+
+void app_main(void)
+{
+    // 容量5，每6s补一个，和count_sem.c一样
+    tb_init(&quota, 5, 1, 6000);
+    xTaskCreate(quota_task, "quota_task", 4096, NULL, 1, NULL);
+
+    // 几个任务一起突发地取令牌，看实际的速度准不准
+    tb_init(&bench_bucket, BENCH_BURST, BENCH_RATE, 1000);
+    done_sem = xSemaphoreCreateCounting(BENCH_TASKS, 0);
+    running = true;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_TASKS; i++)
+        xTaskCreate(burst_task, "burst_task", 2048, NULL, 2, NULL);
+    vTaskDelay(pdMS_TO_TICKS(BENCH_SECONDS * 1000));
+    running = false;
+    for (int i = 0; i < BENCH_TASKS; i++)
+        xSemaphoreTake(done_sem, portMAX_DELAY);
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    // 一开始桶是满的，减掉这部分才是补充的速度
+    uint32_t total = atomic_load(&granted);
+    double rate = (total - BENCH_BURST) * 1e6 / elapsed;
+    ESP_LOGI(TAG, "granted %" PRIu32 " rejected %" PRIu32 " in %" PRIi64 "ms, rate %.1f/s (limit %d/s, error %.2f%%)",
+             total, atomic_load(&rejected), elapsed / 1000, rate, BENCH_RATE, (rate - BENCH_RATE) * 100 / BENCH_RATE);
+}
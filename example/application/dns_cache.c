@@ -0,0 +1,570 @@
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+#include "lwip/netdb.h"
+#include "lwip/dns.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+/*这里配置wifi的ssid与密码*/
+#define wifi_ssid "test_wifi"
+#define wifi_passwd "12345678910"
+
+/*
+DNS服务器，NULL表示用DHCP拿到的DNS服务器(dns_getserver)，
+也可以写成"192.168.43.1"之类的固定地址
+*/
+#define DNS_CACHE_SERVER NULL
+#define DNS_CACHE_PORT 53
+
+#define DNS_CACHE_SIZE 8           // 最多缓存几个域名
+#define DNS_CACHE_TTL_MIN 30       // TTL下限，单位s，防止TTL太短时频繁查询
+#define DNS_CACHE_TTL_MAX 3600     // TTL上限，单位s
+#define DNS_CACHE_STALE_MAX 600    // 过期后还能继续使用多久，期间在后台刷新
+#define DNS_CACHE_PREFETCH_PCT 10  // 剩余TTL不足10%且最近用过的条目提前刷新
+#define DNS_CACHE_QUERY_TIMEOUT 2  // 单次查询超时，单位s
+#define DNS_CACHE_RETRY_MIN 2      // 查询失败后至少隔多久再查，单位s，每失败一次翻倍
+#define DNS_CACHE_RETRY_MAX 60     // 失败重试间隔的上限，单位s
+
+static const char *TAG = "example";
+
+/*
+这里两个函数是连接wifi的
+*/
+void sta_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    // wifi事件组中连接wifi和连接wifi失败两个事件
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
+    {
+        // 连接wifi
+        esp_wifi_connect();
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        ESP_LOGW(TAG, "connected failed! retrying...");
+        esp_wifi_connect();
+    }
+
+    // ip事件组中获取到ip
+    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+    {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        ESP_LOGI("TEST_ESP32", "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+    }
+}
+
+void wifi_init_sta(void)
+{
+    /*初始化"网卡"，前面已经完成了所以这里不需要*/
+    // esp_netif_init();
+    // esp_event_loop_create_default();
+    esp_netif_create_default_wifi_sta();
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    esp_wifi_init(&cfg);
+
+    // 为WIFI事件组中所有事件注册回调函数
+    esp_event_handler_instance_register(WIFI_EVENT,
+                                        ESP_EVENT_ANY_ID,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+    // 为IP事件组中获取IP注册回调函数，注意这两个是不同的事件组
+    esp_event_handler_instance_register(IP_EVENT,
+                                        IP_EVENT_STA_GOT_IP,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+
+    // 配置sta连接的ap的ssid和passwd，并启动wifi
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = wifi_ssid,
+            .password = wifi_passwd,
+        },
+    };
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_start();
+
+    ESP_LOGI(TAG, "wifi_init_sta finished.");
+}
+
+/*
+DNS缓存：
+getaddrinfo每次都要等DNS服务器回复，而且拿不到记录的TTL。
+这里自己发DNS查询报文，按记录里的TTL缓存结果，
+过期后的一段时间内继续返回旧地址，同时在后台任务里刷新，
+所以除了第一次以外，查询都是直接从缓存里拿，不会阻塞
+*/
+
+typedef struct
+{
+    char host[64];
+    struct in_addr addr;
+    int64_t expire_us;      // TTL到期时间
+    uint32_t ttl_s;         // 这条记录的TTL
+    bool valid;             // 是否有可用的地址
+    bool used;              // 上次刷新后有没有被查询过，用来决定要不要预取
+    bool refresh_pending;   // 需要后台刷新
+    bool querying;          // 正在查询，别的任务不要再把它交给后台
+    uint8_t fail_count;     // 连续失败的次数，决定下一次重试的间隔
+    int64_t retry_us;       // 失败后这个时间之前不再查询(负缓存)
+    int64_t last_used_us;   // 最近一次查询的时间，缓存满了之后替换最久没用的
+} dns_cache_entry_t;
+
+static dns_cache_entry_t dns_cache[DNS_CACHE_SIZE];
+static SemaphoreHandle_t dns_cache_lock;
+static TaskHandle_t dns_refresh_task_handle;
+
+/******************************DNS报文******************************/
+
+/* 把www.baidu.com编码成 3www5baidu3com0 的格式，返回写入长度 */
+static int dns_encode_name(uint8_t *buf, size_t size, const char *host)
+{
+    size_t pos = 0;
+    while (*host)
+    {
+        const char *dot = strchr(host, '.');
+        size_t len = dot ? (size_t)(dot - host) : strlen(host);
+        if (len == 0 || len > 63 || pos + len + 2 > size)
+            return -1;
+        buf[pos++] = len;
+        memcpy(buf + pos, host, len);
+        pos += len;
+        host += len;
+        if (*host == '.')
+            host++;
+    }
+    buf[pos++] = 0;
+    return pos;
+}
+
+/* 跳过报文中的一个域名，可能是压缩指针(最高两位为11) */
+static int dns_skip_name(const uint8_t *buf, int len, int pos)
+{
+    while (pos < len)
+    {
+        uint8_t l = buf[pos];
+        if (l == 0)
+            return pos + 1;
+        if ((l & 0xC0) == 0xC0)
+            return pos + 2;
+        pos += l + 1;
+    }
+    return -1;
+}
+
+static uint16_t rd16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* 获取DNS服务器的地址 */
+static int dns_server_addr(struct sockaddr_in *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(DNS_CACHE_PORT);
+    const char *server = DNS_CACHE_SERVER;
+    if (server != NULL)
+        return inet_pton(AF_INET, server, &addr->sin_addr) == 1 ? 0 : -1;
+
+    const ip_addr_t *dns = dns_getserver(0);
+    if (dns == NULL || ip_addr_isany(dns))
+        return -1;
+    addr->sin_addr.s_addr = ip4_addr_get_u32(ip_2_ip4(dns));
+    return 0;
+}
+
+/*
+阻塞查询一个域名的A记录，成功返回0，并给出地址和TTL
+*/
+static int dns_query(const char *host, struct in_addr *out, uint32_t *ttl)
+{
+    uint8_t buf[512];
+    struct sockaddr_in server;
+    if (dns_server_addr(&server) != 0)
+        return -1;
+
+    /* 12字节的头部：id、flags(0x0100 期望递归)、问题数1 */
+    uint16_t id = esp_random() & 0xFFFF;
+    memset(buf, 0, 12);
+    buf[0] = id >> 8;
+    buf[1] = id & 0xFF;
+    buf[2] = 0x01;
+    buf[5] = 1;
+    int len = dns_encode_name(buf + 12, sizeof(buf) - 16, host);
+    if (len < 0)
+        return -1;
+    len += 12;
+    // 查询类型A(1)，类IN(1)
+    buf[len++] = 0;
+    buf[len++] = 1;
+    buf[len++] = 0;
+    buf[len++] = 1;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0)
+        return -1;
+    struct timeval timeout = {.tv_sec = DNS_CACHE_QUERY_TIMEOUT, .tv_usec = 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    int r = -1;
+    if (sendto(sock, buf, len, 0, (struct sockaddr *)&server, sizeof(server)) == len)
+    {
+        // 忽略id不匹配的报文(上一次超时的迟到回复)
+        do
+        {
+            r = recv(sock, buf, sizeof(buf), 0);
+        } while (r >= 12 && rd16(buf) != id);
+    }
+    close(sock);
+    if (r < 12)
+        return -1;
+
+    // rcode不为0表示出错，比如3是域名不存在
+    if ((buf[3] & 0x0F) != 0)
+        return -1;
+    int qd = rd16(buf + 4);
+    int an = rd16(buf + 6);
+
+    int pos = 12;
+    for (int i = 0; i < qd && pos >= 0; i++)
+    {
+        pos = dns_skip_name(buf, r, pos);
+        pos = pos < 0 ? -1 : pos + 4;
+    }
+    /* 回答里可能先是CNAME再是A记录，取第一条A记录 */
+    for (int i = 0; i < an && pos >= 0; i++)
+    {
+        pos = dns_skip_name(buf, r, pos);
+        if (pos < 0 || pos + 10 > r)
+            return -1;
+        uint16_t type = rd16(buf + pos);
+        uint32_t rr_ttl = rd32(buf + pos + 4);
+        uint16_t rdlen = rd16(buf + pos + 8);
+        pos += 10;
+        if (pos + rdlen > r)
+            return -1;
+        if (type == 1 && rdlen == 4)
+        {
+            memcpy(&out->s_addr, buf + pos, 4);
+            *ttl = rr_ttl;
+            return 0;
+        }
+        pos += rdlen;
+    }
+    return -1;
+}
+
+/******************************缓存******************************/
+
+static uint32_t dns_clamp_ttl(uint32_t ttl)
+{
+    if (ttl < DNS_CACHE_TTL_MIN)
+        return DNS_CACHE_TTL_MIN;
+    if (ttl > DNS_CACHE_TTL_MAX)
+        return DNS_CACHE_TTL_MAX;
+    return ttl;
+}
+
+/* 找到域名对应的条目，需要持有锁 */
+static dns_cache_entry_t *dns_cache_find(const char *host)
+{
+    for (int i = 0; i < DNS_CACHE_SIZE; i++)
+    {
+        if (dns_cache[i].host[0] && strcmp(dns_cache[i].host, host) == 0)
+            return &dns_cache[i];
+    }
+    return NULL;
+}
+
+/* 新增一个条目，缓存满了替换最久没用的，需要持有锁 */
+static dns_cache_entry_t *dns_cache_add(const char *host)
+{
+    dns_cache_entry_t *e = &dns_cache[0];
+    for (int i = 0; i < DNS_CACHE_SIZE; i++)
+    {
+        if (dns_cache[i].host[0] == '\0')
+        {
+            e = &dns_cache[i];
+            break;
+        }
+        if (dns_cache[i].last_used_us < e->last_used_us)
+            e = &dns_cache[i];
+    }
+    memset(e, 0, sizeof(*e));
+    strlcpy(e->host, host, sizeof(e->host));
+    return e;
+}
+
+/* 把查询结果写回缓存，需要持有锁 */
+static void dns_cache_store(dns_cache_entry_t *e, const struct in_addr *addr, uint32_t ttl)
+{
+    e->addr = *addr;
+    e->ttl_s = dns_clamp_ttl(ttl);
+    e->expire_us = esp_timer_get_time() + (int64_t)e->ttl_s * 1000000;
+    e->valid = true;
+    e->used = false;
+    e->fail_count = 0;
+    e->retry_us = 0;
+}
+
+/* 查询失败，按失败次数退避，需要持有锁 */
+static void dns_cache_fail(dns_cache_entry_t *e)
+{
+    if (e->fail_count < 8)
+        e->fail_count++;
+    uint32_t retry_s = DNS_CACHE_RETRY_MIN << (e->fail_count - 1);
+    if (retry_s > DNS_CACHE_RETRY_MAX)
+        retry_s = DNS_CACHE_RETRY_MAX;
+    e->retry_us = esp_timer_get_time() + (int64_t)retry_s * 1000000;
+    // 刷新失败就继续用旧地址，下次用到时再刷新
+    e->used = false;
+}
+
+/* 现在能不能交给后台刷新：不在查询中，也不在失败退避期间，需要持有锁 */
+static bool dns_cache_can_refresh(dns_cache_entry_t *e, int64_t now)
+{
+    return !e->refresh_pending && !e->querying && now >= e->retry_us;
+}
+
+/*
+从已有的条目里取地址，过期了就交给后台刷新，需要持有锁。
+返回true表示拿到了地址，*notify为true时要通知后台任务
+*/
+static bool dns_cache_get_locked(dns_cache_entry_t *e, int64_t now, struct in_addr *out, bool *notify)
+{
+    bool hit = false;
+    e->last_used_us = now;
+    if (e->valid && now < e->expire_us + DNS_CACHE_STALE_MAX * 1000000LL)
+    {
+        *out = e->addr;
+        e->used = true;
+        hit = true;
+    }
+    if (now >= e->expire_us && dns_cache_can_refresh(e, now))
+    {
+        e->refresh_pending = true;
+        *notify = true;
+    }
+    return hit;
+}
+
+/*
+后台刷新任务：
+处理被标记为需要刷新的条目，另外每秒检查一次，
+把快要过期并且最近被用过的条目提前刷新，这样常用的域名基本不会过期
+*/
+static void dns_refresh_task(void *pvParam)
+{
+    char host[64];
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+
+        while (1)
+        {
+            // 每次取出一个要刷新的域名，查询时不持有锁
+            host[0] = '\0';
+            int64_t now = esp_timer_get_time();
+            xSemaphoreTake(dns_cache_lock, portMAX_DELAY);
+            for (int i = 0; i < DNS_CACHE_SIZE; i++)
+            {
+                dns_cache_entry_t *e = &dns_cache[i];
+                if (e->host[0] == '\0')
+                    continue;
+                int64_t prefetch_us = (int64_t)e->ttl_s * 10000 * DNS_CACHE_PREFETCH_PCT;
+                if (e->valid && e->used && now >= e->expire_us - prefetch_us && dns_cache_can_refresh(e, now))
+                    e->refresh_pending = true;
+                if (e->refresh_pending)
+                {
+                    e->refresh_pending = false;
+                    e->querying = true;
+                    strcpy(host, e->host);
+                    break;
+                }
+            }
+            xSemaphoreGive(dns_cache_lock);
+            if (host[0] == '\0')
+                break;
+
+            struct in_addr addr;
+            uint32_t ttl;
+            int err = dns_query(host, &addr, &ttl);
+
+            xSemaphoreTake(dns_cache_lock, portMAX_DELAY);
+            dns_cache_entry_t *e = dns_cache_find(host);
+            if (e != NULL)
+            {
+                e->querying = false;
+                if (err == 0)
+                    dns_cache_store(e, &addr, ttl);
+                else
+                    dns_cache_fail(e);
+            }
+            xSemaphoreGive(dns_cache_lock);
+            if (err != 0)
+                ESP_LOGW(TAG, "refresh %s failed", host);
+        }
+    }
+}
+
+/* 初始化缓存和后台刷新任务 */
+void dns_cache_init(void)
+{
+    dns_cache_lock = xSemaphoreCreateMutex();
+    xTaskCreate(dns_refresh_task, "dns_refresh", 3072, NULL, 3, &dns_refresh_task_handle);
+}
+
+/*
+截断了存进去的话strcmp永远对不上，每次都会挤掉一个有效的条目，
+后台刷新查的也是截断后的错误域名，所以直接拒绝
+*/
+static bool dns_cache_host_ok(const char *host)
+{
+    if (strlen(host) < sizeof(dns_cache[0].host))
+        return true;
+    ESP_LOGE(TAG, "host too long: %s", host);
+    return false;
+}
+
+/*
+不阻塞的查询：
+ESP_OK             -- 拿到地址(可能是刚过期的旧地址，此时已经在后台刷新)
+ESP_ERR_NOT_FOUND  -- 缓存中没有，已经交给后台查询，稍后再来取；
+                      上次查询失败的话在退避时间内不会再查
+ESP_ERR_INVALID_ARG -- 域名太长，缓存里放不下
+*/
+esp_err_t dns_cache_lookup(const char *host, struct in_addr *out)
+{
+    if (!dns_cache_host_ok(host))
+        return ESP_ERR_INVALID_ARG;
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    bool notify = false;
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(dns_cache_lock, portMAX_DELAY);
+    dns_cache_entry_t *e = dns_cache_find(host);
+    if (e == NULL)
+        e = dns_cache_add(host);
+    if (dns_cache_get_locked(e, now, out, &notify))
+        ret = ESP_OK;
+    xSemaphoreGive(dns_cache_lock);
+
+    if (notify)
+        xTaskNotifyGive(dns_refresh_task_handle);
+    return ret;
+}
+
+/*
+阻塞的查询，缓存中有就直接返回，否则在当前任务里查询并写入缓存，不再交给后台，
+一般只有第一次用到某个域名时才会真的去查询。
+上次查询失败的话在退避时间内直接返回ESP_FAIL，域名太长返回ESP_ERR_INVALID_ARG
+*/
+esp_err_t dns_cache_resolve(const char *host, struct in_addr *out)
+{
+    if (!dns_cache_host_ok(host))
+        return ESP_ERR_INVALID_ARG;
+    bool notify = false;
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(dns_cache_lock, portMAX_DELAY);
+    dns_cache_entry_t *e = dns_cache_find(host);
+    if (e != NULL && dns_cache_get_locked(e, now, out, &notify))
+    {
+        xSemaphoreGive(dns_cache_lock);
+        if (notify)
+            xTaskNotifyGive(dns_refresh_task_handle);
+        return ESP_OK;
+    }
+    if (e != NULL && now < e->retry_us)
+    {
+        xSemaphoreGive(dns_cache_lock);
+        return ESP_FAIL;
+    }
+    if (e == NULL)
+        e = dns_cache_add(host);
+    // 已经排队等后台刷新的话这里查了就不用再查
+    e->refresh_pending = false;
+    e->querying = true;
+    e->last_used_us = now;
+    xSemaphoreGive(dns_cache_lock);
+
+    uint32_t ttl;
+    struct in_addr addr;
+    int err = dns_query(host, &addr, &ttl);
+
+    xSemaphoreTake(dns_cache_lock, portMAX_DELAY);
+    // 查询期间可能被替换掉了，重新找
+    e = dns_cache_find(host);
+    if (e == NULL)
+        e = dns_cache_add(host);
+    e->querying = false;
+    if (err == 0)
+        dns_cache_store(e, &addr, ttl);
+    else
+        dns_cache_fail(e);
+    xSemaphoreGive(dns_cache_lock);
+
+    if (err != 0)
+        return ESP_FAIL;
+    *out = addr;
+    return ESP_OK;
+}
+
+void app_main(void)
+{
+    nvs_flash_init();
+    esp_netif_init();
+    esp_event_loop_create_default();
+
+    /*先连接wifi*/
+    wifi_init_sta();
+    vTaskDelay(3000 / portTICK_PERIOD_MS);
+
+    dns_cache_init();
+
+    /*第一次需要真的去查询*/
+    struct in_addr addr;
+    int64_t start = esp_timer_get_time();
+    if (dns_cache_resolve("www.baidu.com", &addr) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "DNS lookup failed");
+        return;
+    }
+    ESP_LOGI(TAG, "first lookup %s took %lld us", inet_ntoa(addr), esp_timer_get_time() - start);
+
+    /*之后直接从缓存中拿，过期后也会先返回旧地址，再在后台刷新*/
+    start = esp_timer_get_time();
+    for (int i = 0; i < 1000; i++)
+        dns_cache_lookup("www.baidu.com", &addr);
+    ESP_LOGI(TAG, "cached lookup average %.2f us (1000 lookups)", (esp_timer_get_time() - start) / 1000.0);
+
+    /*拿到的地址可以直接用来建立连接，和TCP-Client例子中一样*/
+    struct sockaddr_in dest_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(80),
+        .sin_addr = addr,
+    };
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (connect(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) == 0)
+        ESP_LOGI(TAG, "connected");
+    close(sock);
+}
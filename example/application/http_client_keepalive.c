@@ -0,0 +1,533 @@
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+#include "lwip/netdb.h"
+#include "lwip/dns.h"
+#include "esp_timer.h"
+#include "esp_http_server.h"
+#include "sdkconfig.h"
+
+/*这里配置wifi的ssid与密码*/
+#define wifi_ssid "test_wifi"
+#define wifi_passwd "12345678910"
+
+/*配置访问的域名、端口和目录*/
+#define WEB_SERVER "www.baidu.com"
+#define WEB_PORT "80"
+#define WEB_PATH "/"
+
+/*
+测速用板子上自己起的http server，走lwip的回环，结果不受外网延时和对方服务器的影响，
+BENCH_CHUNKED_PATH的响应是chunked编码的，顺便把chunked的解析也跑一遍
+*/
+#define BENCH_HOST "127.0.0.1"
+#define BENCH_PORT 8080
+#define BENCH_PATH "/"
+#define BENCH_CHUNKED_PATH "/chunked"
+#define BENCH_BODY_LEN 1024
+#define BENCH_REQUESTS 50
+
+static const char *TAG = "example";
+
+/*
+这里两个函数是连接wifi的
+*/
+void sta_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    // wifi事件组中连接wifi和连接wifi失败两个事件
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
+    {
+        // 连接wifi
+        esp_wifi_connect();
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        ESP_LOGW(TAG, "connected failed! retrying...");
+        esp_wifi_connect();
+    }
+
+    // ip事件组中获取到ip
+    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+    {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        ESP_LOGI("TEST_ESP32", "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+    }
+}
+
+void wifi_init_sta(void)
+{
+    /*初始化"网卡"，前面已经完成了所以这里不需要*/
+    // esp_netif_init();
+    // esp_event_loop_create_default();
+    esp_netif_create_default_wifi_sta();
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    esp_wifi_init(&cfg);
+
+    // 为WIFI事件组中所有事件注册回调函数
+    esp_event_handler_instance_register(WIFI_EVENT,
+                                        ESP_EVENT_ANY_ID,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+    // 为IP事件组中获取IP注册回调函数，注意这两个是不同的事件组
+    esp_event_handler_instance_register(IP_EVENT,
+                                        IP_EVENT_STA_GOT_IP,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+
+    // 配置sta连接的ap的ssid和passwd，并启动wifi
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = wifi_ssid,
+            .password = wifi_passwd,
+        },
+    };
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_start();
+
+    ESP_LOGI(TAG, "wifi_init_sta finished.");
+}
+
+/*
+HTTP/1.1长连接客户端：
+原来的http_get每次都要DNS、建立TCP连接、发请求再关掉，
+这里每个host保留一条连接，下一次请求直接复用，只有连接被对方关掉时才重新建立，
+同时支持chunked编码，body按块交给回调函数处理，不再一个字节一个字节地putchar
+*/
+
+#define HTTP_CONN_MAX 2        // 最多同时保留几个host的连接
+#define HTTP_CONN_BUF_SIZE 2048 // 每条连接的接收缓冲区，也是回调一次最多拿到的数据量
+
+/* 接收body的回调函数，返回非0会中止这次请求 */
+typedef int (*http_body_cb_t)(const char *data, size_t len, void *arg);
+
+typedef struct
+{
+    char host[64];
+    char port[8];
+    int sock; // -1表示没有连接
+    // 接收缓冲区，[start, end)是还没处理的数据
+    char buf[HTTP_CONN_BUF_SIZE];
+    size_t start;
+    size_t end;
+} http_conn_t;
+
+// sock要初始化成-1，否则复用的逻辑会把fd 0关掉
+static http_conn_t conns[HTTP_CONN_MAX] = {[0 ... HTTP_CONN_MAX - 1] = {.sock = -1}};
+// 轮流替换连接
+static int conn_victim = 0;
+
+static void http_conn_close(http_conn_t *c)
+{
+    if (c->sock >= 0)
+        close(c->sock);
+    c->sock = -1;
+    c->start = c->end = 0;
+}
+
+/* 关闭所有保留的连接 */
+void http_client_close_all(void)
+{
+    for (int i = 0; i < HTTP_CONN_MAX; i++)
+        http_conn_close(&conns[i]);
+}
+
+static int http_conn_open(http_conn_t *c)
+{
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res;
+
+    int err = getaddrinfo(c->host, c->port, &hints, &res);
+    if (err != 0 || res == NULL)
+    {
+        ESP_LOGE(TAG, "DNS lookup failed err=%d res=%p", err, res);
+        return -1;
+    }
+
+    c->sock = socket(res->ai_family, res->ai_socktype, 0);
+    if (c->sock < 0)
+    {
+        freeaddrinfo(res);
+        return -1;
+    }
+    if (connect(c->sock, res->ai_addr, res->ai_addrlen) != 0)
+    {
+        ESP_LOGE(TAG, "... socket connect failed errno=%d", errno);
+        freeaddrinfo(res);
+        http_conn_close(c);
+        return -1;
+    }
+    freeaddrinfo(res);
+
+    // 接收超时，防止服务器不回复时一直阻塞
+    struct timeval receiving_timeout = {.tv_sec = 5, .tv_usec = 0};
+    setsockopt(c->sock, SOL_SOCKET, SO_RCVTIMEO, &receiving_timeout, sizeof(receiving_timeout));
+    c->start = c->end = 0;
+    return 0;
+}
+
+/* 找到这个host已有的连接，没有就占用一个空闲的或者替换掉一个，host或port太长返回NULL */
+static http_conn_t *http_conn_get(const char *host, const char *port)
+{
+    // 截断了就会连到别的地址上去，直接报错
+    if (strlen(host) >= sizeof(conns[0].host) || strlen(port) >= sizeof(conns[0].port))
+    {
+        ESP_LOGE(TAG, "host or port too long: %s:%s", host, port);
+        return NULL;
+    }
+    http_conn_t *c = NULL;
+    for (int i = 0; i < HTTP_CONN_MAX; i++)
+    {
+        if (conns[i].sock >= 0 && strcmp(conns[i].host, host) == 0 && strcmp(conns[i].port, port) == 0)
+            return &conns[i];
+        if (c == NULL && conns[i].sock < 0)
+            c = &conns[i];
+    }
+    if (c == NULL)
+    {
+        c = &conns[conn_victim];
+        conn_victim = (conn_victim + 1) % HTTP_CONN_MAX;
+        http_conn_close(c);
+    }
+    strlcpy(c->host, host, sizeof(c->host));
+    strlcpy(c->port, port, sizeof(c->port));
+    return c;
+}
+
+/* write可能只写了一部分，循环写完，失败返回-1 */
+static int http_conn_write_all(http_conn_t *c, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        int w = write(c->sock, data, len);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+        data += w;
+        len -= w;
+    }
+    return 0;
+}
+
+/* 缓冲区空了就从socket再读一次，返回读到的字节数，<=0表示连接断开或者超时 */
+static int http_conn_fill(http_conn_t *c)
+{
+    if (c->start == c->end)
+        c->start = c->end = 0;
+    if (c->end == sizeof(c->buf))
+    {
+        // 把没处理的数据挪到前面，腾出空间
+        memmove(c->buf, c->buf + c->start, c->end - c->start);
+        c->end -= c->start;
+        c->start = 0;
+        if (c->end == sizeof(c->buf))
+            return -1;
+    }
+    int r = recv(c->sock, c->buf + c->end, sizeof(c->buf) - c->end, 0);
+    if (r > 0)
+        c->end += r;
+    return r;
+}
+
+/* 读一行(去掉\r\n)，行太长或者连接断开返回-1 */
+static int http_conn_read_line(http_conn_t *c, char *line, size_t size)
+{
+    while (1)
+    {
+        char *nl = memchr(c->buf + c->start, '\n', c->end - c->start);
+        if (nl != NULL)
+        {
+            size_t len = nl - (c->buf + c->start);
+            if (len > 0 && nl[-1] == '\r')
+                len--;
+            if (len >= size)
+                return -1;
+            memcpy(line, c->buf + c->start, len);
+            line[len] = '\0';
+            c->start = nl - c->buf + 1;
+            return len;
+        }
+        if (http_conn_fill(c) <= 0)
+            return -1;
+    }
+}
+
+/* 把接下来的len字节body交给回调，len为-1时一直读到连接关闭 */
+static int http_conn_read_body(http_conn_t *c, long len, http_body_cb_t cb, void *arg)
+{
+    while (len != 0)
+    {
+        if (c->start == c->end)
+        {
+            int r = http_conn_fill(c);
+            if (r <= 0)
+                return len < 0 ? 0 : -1;
+        }
+        size_t n = c->end - c->start;
+        if (len > 0 && n > (size_t)len)
+            n = len;
+        if (cb && cb(c->buf + c->start, n, arg) != 0)
+            return -1;
+        c->start += n;
+        if (len > 0)
+            len -= n;
+    }
+    return 0;
+}
+
+/* chunked编码：每块前面是十六进制的长度，长度为0的块表示结束 */
+static int http_conn_read_chunked(http_conn_t *c, http_body_cb_t cb, void *arg)
+{
+    char line[64];
+    while (1)
+    {
+        if (http_conn_read_line(c, line, sizeof(line)) < 0)
+            return -1;
+        // 长度后面可能跟着;扩展，其他字符说明数据已经乱了，不能当成结束块
+        char *end;
+        long chunk = strtol(line, &end, 16);
+        if (end == line || chunk < 0 || (*end != '\0' && *end != ';' && *end != ' '))
+            return -1;
+        if (chunk == 0)
+            break;
+        if (http_conn_read_body(c, chunk, cb, arg) != 0)
+            return -1;
+        // 每块数据后面还有一个\r\n
+        if (http_conn_read_line(c, line, sizeof(line)) != 0)
+            return -1;
+    }
+    // 跳过trailer，直到空行
+    int len;
+    while ((len = http_conn_read_line(c, line, sizeof(line))) > 0)
+        ;
+    return len == 0 ? 0 : -1;
+}
+
+/* 头部的值里是否包含某个关键字，不区分大小写 */
+static bool http_hdr_has(const char *value, const char *token)
+{
+    size_t n = strlen(token);
+    for (; *value; value++)
+    {
+        if (strncasecmp(value, token, n) == 0)
+            return true;
+    }
+    return false;
+}
+
+/*
+发送GET请求并读取响应，成功返回http状态码，失败返回-1
+*/
+int http_client_get(const char *host, const char *port, const char *path, http_body_cb_t cb, void *arg)
+{
+    char req[256];
+    int req_len = snprintf(req, sizeof(req),
+                           "GET %s HTTP/1.1\r\n"
+                           "Host: %s:%s\r\n"
+                           "User-Agent: esp-idf/1.0 esp32\r\n"
+                           "\r\n",
+                           path, host, port);
+    if (req_len >= sizeof(req))
+        return -1;
+
+    http_conn_t *c = http_conn_get(host, port);
+    if (c == NULL)
+        return -1;
+    char line[256];
+
+    /*
+    复用的连接可能已经被服务器关掉了，此时发送或者读状态行会失败，
+    这种情况重新建立一次连接再试
+    */
+    for (int attempt = 0;; attempt++)
+    {
+        bool reused = c->sock >= 0;
+        if (!reused && http_conn_open(c) != 0)
+            return -1;
+        if (http_conn_write_all(c, req, req_len) == 0 &&
+            http_conn_read_line(c, line, sizeof(line)) > 0)
+            break;
+        http_conn_close(c);
+        if (!reused || attempt > 0)
+            return -1;
+    }
+
+    int status = 0;
+    int minor = 1;
+    long content_len = -1;
+    bool chunked = false;
+    bool keep_alive = true;
+    int len;
+    while (1)
+    {
+        // 状态行，比如 HTTP/1.1 200 OK
+        if (sscanf(line, "HTTP/1.%d %d", &minor, &status) != 2)
+        {
+            http_conn_close(c);
+            return -1;
+        }
+
+        // 解析需要的几个头部
+        content_len = -1;
+        chunked = false;
+        keep_alive = (minor >= 1);
+        while ((len = http_conn_read_line(c, line, sizeof(line))) > 0)
+        {
+            if (strncasecmp(line, "Content-Length:", 15) == 0)
+                content_len = strtol(line + 15, NULL, 10);
+            else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && http_hdr_has(line + 18, "chunked"))
+                chunked = true;
+            else if (strncasecmp(line, "Connection:", 11) == 0)
+                keep_alive = !http_hdr_has(line + 11, "close");
+        }
+        if (len < 0)
+        {
+            http_conn_close(c);
+            return -1;
+        }
+        // 1xx是中间响应，没有body，后面紧跟着真正的响应
+        if (status >= 200)
+            break;
+        if (http_conn_read_line(c, line, sizeof(line)) <= 0)
+        {
+            http_conn_close(c);
+            return -1;
+        }
+    }
+
+    int err;
+    if (status == 204 || status == 304)
+        err = 0; // 这两种响应一定没有body，不能按读到连接关闭处理
+    else if (chunked)
+        err = http_conn_read_chunked(c, cb, arg);
+    else if (content_len >= 0)
+        err = http_conn_read_body(c, content_len, cb, arg);
+    else
+    {
+        // 既没有长度也不是chunked，只能读到连接关闭为止
+        err = http_conn_read_body(c, -1, cb, arg);
+        keep_alive = false;
+    }
+
+    if (err != 0 || !keep_alive)
+        http_conn_close(c);
+    return err != 0 ? -1 : status;
+}
+
+/* 示例回调：只统计body长度，需要的话在这里解析数据 */
+static int count_body_cb(const char *data, size_t len, void *arg)
+{
+    *(size_t *)arg += len;
+    return 0;
+}
+
+/******************************本地测速******************************/
+
+static char bench_body[BENCH_BODY_LEN];
+
+static esp_err_t bench_get_handler(httpd_req_t *req)
+{
+    httpd_resp_send(req, bench_body, sizeof(bench_body));
+    return ESP_OK;
+}
+
+// 分4块发，响应头里是Transfer-Encoding: chunked
+static esp_err_t bench_chunked_handler(httpd_req_t *req)
+{
+    for (int i = 0; i < 4; i++)
+        httpd_resp_send_chunk(req, bench_body + i * sizeof(bench_body) / 4, sizeof(bench_body) / 4);
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+static httpd_handle_t bench_server_start(void)
+{
+    httpd_uri_t uri_get = {
+        .uri = BENCH_PATH,
+        .method = HTTP_GET,
+        .handler = bench_get_handler,
+        .user_ctx = NULL};
+    httpd_uri_t uri_chunked = {
+        .uri = BENCH_CHUNKED_PATH,
+        .method = HTTP_GET,
+        .handler = bench_chunked_handler,
+        .user_ctx = NULL};
+
+    memset(bench_body, 'a', sizeof(bench_body));
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = BENCH_PORT;
+    // 重新连接的测试会留下很多没关完的连接，满了就关掉最久没用的
+    config.lru_purge_enable = true;
+    httpd_handle_t server = NULL;
+    if (httpd_start(&server, &config) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error starting server!");
+        return NULL;
+    }
+    httpd_register_uri_handler(server, &uri_get);
+    httpd_register_uri_handler(server, &uri_chunked);
+    return server;
+}
+
+/* 同一个地址连续请求若干次，分别测试复用连接和每次重新连接的速度，body长度不对也算失败 */
+static void http_bench(const char *path, bool reuse, int count)
+{
+    char port[8];
+    snprintf(port, sizeof(port), "%d", BENCH_PORT);
+    int64_t start = esp_timer_get_time();
+    int ok = 0;
+    for (int i = 0; i < count; i++)
+    {
+        size_t body_len = 0;
+        if (http_client_get(BENCH_HOST, port, path, count_body_cb, &body_len) == 200 && body_len == BENCH_BODY_LEN)
+            ok++;
+        if (!reuse)
+            http_client_close_all();
+    }
+    int64_t elapsed_us = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "%-9s %s: %d/%d ok, %.1f req/s", path, reuse ? "keep-alive" : "reconnect",
+             ok, count, ok * 1e6 / elapsed_us);
+    http_client_close_all();
+}
+
+void app_main(void)
+{
+    nvs_flash_init();
+    esp_netif_init();
+    esp_event_loop_create_default();
+
+    /*先连接wifi*/
+    wifi_init_sta();
+    vTaskDelay(3000 / portTICK_PERIOD_MS);
+
+    /*获取一次数据，body通过回调函数按块拿到*/
+    size_t body_len = 0;
+    int status = http_client_get(WEB_SERVER, WEB_PORT, WEB_PATH, count_body_cb, &body_len);
+    ESP_LOGI(TAG, "status=%d body=%u bytes", status, (unsigned)body_len);
+
+    /*在本地server上对比复用连接和不复用连接的速度*/
+    if (bench_server_start() != NULL)
+    {
+        http_bench(BENCH_PATH, true, BENCH_REQUESTS);
+        http_bench(BENCH_PATH, false, BENCH_REQUESTS);
+        http_bench(BENCH_CHUNKED_PATH, true, BENCH_REQUESTS);
+        http_bench(BENCH_CHUNKED_PATH, false, BENCH_REQUESTS);
+    }
+    http_client_close_all();
+}
@@ -0,0 +1,518 @@
+#include <string.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+#include "lwip/netdb.h"
+#include "lwip/dns.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+/*这里配置wifi的ssid与密码*/
+#define wifi_ssid "test_wifi"
+#define wifi_passwd "12345678910"
+
+#define FETCH_MAX_CONCURRENCY 4  // 最多同时进行几个请求，受LWIP_MAX_SOCKETS限制
+#define FETCH_RESP_MAX 4096      // 每个响应(头部+body)最多缓存多少字节，超过的部分丢掉
+#define FETCH_TIMEOUT_MS 10000   // 单个请求的超时时间
+
+/*
+测速用板子上自己起的延时server，走lwip的回环，每个请求固定等BENCH_DELAY_MS再回复，
+模拟服务器处理慢、网络延时大的情况，对比一个一个请求和并行请求的总耗时
+*/
+#define BENCH_PORT 8081
+#define BENCH_DELAY_MS 200
+#define BENCH_REQUESTS 8
+
+static const char *TAG = "example";
+
+/*
+这里两个函数是连接wifi的
+*/
+void sta_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    // wifi事件组中连接wifi和连接wifi失败两个事件
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
+    {
+        // 连接wifi
+        esp_wifi_connect();
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        ESP_LOGW(TAG, "connected failed! retrying...");
+        esp_wifi_connect();
+    }
+
+    // ip事件组中获取到ip
+    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+    {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        ESP_LOGI("TEST_ESP32", "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+    }
+}
+
+void wifi_init_sta(void)
+{
+    /*初始化"网卡"，前面已经完成了所以这里不需要*/
+    // esp_netif_init();
+    // esp_event_loop_create_default();
+    esp_netif_create_default_wifi_sta();
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    esp_wifi_init(&cfg);
+
+    // 为WIFI事件组中所有事件注册回调函数
+    esp_event_handler_instance_register(WIFI_EVENT,
+                                        ESP_EVENT_ANY_ID,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+    // 为IP事件组中获取IP注册回调函数，注意这两个是不同的事件组
+    esp_event_handler_instance_register(IP_EVENT,
+                                        IP_EVENT_STA_GOT_IP,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+
+    // 配置sta连接的ap的ssid和passwd，并启动wifi
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = wifi_ssid,
+            .password = wifi_passwd,
+        },
+    };
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_start();
+
+    ESP_LOGI(TAG, "wifi_init_sta finished.");
+}
+
+/*
+并行获取多个http资源：
+开机时经常要拉好几个资源(配置、证书、时间表)，用阻塞的http_get只能一个一个地等。
+这里用非阻塞socket加select，同时进行最多FETCH_MAX_CONCURRENCY个请求，
+哪个先完成就先通过回调交出去，总耗时接近最慢的那一个，而不是所有请求之和
+*/
+
+/* 一个请求完成(或者失败)时的结果 */
+typedef struct
+{
+    int index;        // 在url数组中的下标
+    int status;       // http状态码，失败为-1
+    const char *body; // body，请求失败时为NULL
+    size_t body_len;
+    bool truncated;   // 响应超过FETCH_RESP_MAX被截断了
+} fetch_result_t;
+
+typedef void (*fetch_done_cb_t)(const fetch_result_t *result, void *arg);
+
+typedef enum
+{
+    SLOT_IDLE,
+    SLOT_CONNECTING,
+    SLOT_SENDING,
+    SLOT_RECEIVING,
+} fetch_slot_state_t;
+
+typedef struct
+{
+    fetch_slot_state_t state;
+    int index;
+    int sock;
+    int64_t deadline_us;
+    char req[256];
+    size_t req_len;
+    size_t req_sent;
+    char *buf; // 接收到的完整响应，头部+body
+    size_t len;
+    bool truncated;
+} fetch_slot_t;
+
+/* 把 http://host[:port]/path 拆开，只支持http */
+static int fetch_parse_url(const char *url, char *host, size_t host_size, char *port, const char **path)
+{
+    if (strncmp(url, "http://", 7) != 0)
+        return -1;
+    url += 7;
+    const char *slash = strchr(url, '/');
+    *path = slash ? slash : "/";
+    size_t hostport_len = slash ? (size_t)(slash - url) : strlen(url);
+
+    const char *colon = memchr(url, ':', hostport_len);
+    size_t host_len = colon ? (size_t)(colon - url) : hostport_len;
+    if (host_len == 0 || host_len >= host_size)
+        return -1;
+    memcpy(host, url, host_len);
+    host[host_len] = '\0';
+
+    if (colon)
+    {
+        size_t port_len = hostport_len - host_len - 1;
+        if (port_len == 0 || port_len > 5)
+            return -1;
+        memcpy(port, colon + 1, port_len);
+        port[port_len] = '\0';
+    }
+    else
+    {
+        strcpy(port, "80");
+    }
+    return 0;
+}
+
+/* 解析地址并发起非阻塞的连接，connect会立刻返回，连接结果在select里看 */
+static int fetch_slot_start(fetch_slot_t *s, const char *url)
+{
+    char host[64], port[6];
+    const char *path;
+    if (fetch_parse_url(url, host, sizeof(host), port, &path) != 0)
+        return -1;
+
+    /*
+    用HTTP/1.0并且不保持连接，服务器发完就关闭，读到连接关闭就是完整的响应
+    */
+    s->req_len = snprintf(s->req, sizeof(s->req),
+                          "GET %s HTTP/1.0\r\n"
+                          "Host: %s:%s\r\n"
+                          "User-Agent: esp-idf/1.0 esp32\r\n"
+                          "\r\n",
+                          path, host, port);
+    if (s->req_len >= sizeof(s->req))
+        return -1;
+
+    // 这里的DNS查询是阻塞的，可以换成DNS缓存例子里的dns_cache_lookup
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res;
+    if (getaddrinfo(host, port, &hints, &res) != 0 || res == NULL)
+        return -1;
+
+    s->sock = socket(res->ai_family, res->ai_socktype, 0);
+    if (s->sock < 0)
+    {
+        freeaddrinfo(res);
+        return -1;
+    }
+    // 设置成非阻塞
+    fcntl(s->sock, F_SETFL, fcntl(s->sock, F_GETFL, 0) | O_NONBLOCK);
+    int err = connect(s->sock, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (err != 0 && errno != EINPROGRESS)
+    {
+        close(s->sock);
+        return -1;
+    }
+
+    s->buf = malloc(FETCH_RESP_MAX + 1);
+    if (s->buf == NULL)
+    {
+        close(s->sock);
+        return -1;
+    }
+    s->len = 0;
+    s->req_sent = 0;
+    s->truncated = false;
+    s->deadline_us = esp_timer_get_time() + FETCH_TIMEOUT_MS * 1000LL;
+    s->state = SLOT_CONNECTING;
+    return 0;
+}
+
+/* 请求结束，解析状态行并通过回调交出结果，然后释放这个槽，返回是否拿到了状态码 */
+static bool fetch_slot_finish(fetch_slot_t *s, bool ok, fetch_done_cb_t cb, void *arg)
+{
+    fetch_result_t result = {
+        .index = s->index,
+        .status = -1,
+        .truncated = s->truncated,
+    };
+
+    if (ok)
+    {
+        s->buf[s->len] = '\0';
+        char *body = strstr(s->buf, "\r\n\r\n");
+        int minor;
+        if (body != NULL && sscanf(s->buf, "HTTP/1.%d %d", &minor, &result.status) == 2)
+        {
+            result.body = body + 4;
+            result.body_len = s->len - (result.body - s->buf);
+        }
+        else
+        {
+            result.status = -1;
+        }
+    }
+    cb(&result, arg);
+
+    close(s->sock);
+    free(s->buf);
+    s->buf = NULL;
+    s->state = SLOT_IDLE;
+    return result.status >= 0;
+}
+
+/* 处理一个可读/可写的socket，返回true表示这个请求结束了 */
+static bool fetch_slot_io(fetch_slot_t *s, bool readable, bool writable, bool *ok)
+{
+    *ok = false;
+    if (s->state == SLOT_CONNECTING && writable)
+    {
+        // 非阻塞连接完成后可写，通过SO_ERROR判断是否连接成功
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(s->sock, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0)
+            return true;
+        s->state = SLOT_SENDING;
+    }
+    if (s->state == SLOT_SENDING && writable)
+    {
+        int w = send(s->sock, s->req + s->req_sent, s->req_len - s->req_sent, 0);
+        if (w < 0 && errno != EAGAIN)
+            return true;
+        if (w > 0)
+            s->req_sent += w;
+        if (s->req_sent == s->req_len)
+            s->state = SLOT_RECEIVING;
+        return false;
+    }
+    if (s->state == SLOT_RECEIVING && readable)
+    {
+        char discard[256];
+        size_t room = FETCH_RESP_MAX - s->len;
+        // 缓冲区满了之后继续读，但是丢掉数据，等服务器关闭连接
+        int r = room > 0 ? recv(s->sock, s->buf + s->len, room, 0) : recv(s->sock, discard, sizeof(discard), 0);
+        if (r < 0)
+            return errno != EAGAIN;
+        if (r == 0)
+        {
+            *ok = true;
+            return true;
+        }
+        if (room > 0)
+            s->len += r;
+        else
+            s->truncated = true;
+    }
+    return false;
+}
+
+/*
+并行获取一组url，最多同时进行max_inflight个请求(不超过FETCH_MAX_CONCURRENCY)，
+每个请求结束时调用一次cb，全部结束后返回，返回值是成功(拿到状态码)的数量
+*/
+int http_fetch_all_n(const char *const *urls, int count, int max_inflight, fetch_done_cb_t cb, void *arg)
+{
+    fetch_slot_t slots[FETCH_MAX_CONCURRENCY] = {0};
+    if (max_inflight < 1 || max_inflight > FETCH_MAX_CONCURRENCY)
+        max_inflight = FETCH_MAX_CONCURRENCY;
+    int next = 0;
+    int done = 0;
+    int succeeded = 0;
+
+    while (done < count)
+    {
+        // 有空闲的槽就发起下一个请求
+        for (int i = 0; i < max_inflight && next < count; i++)
+        {
+            if (slots[i].state != SLOT_IDLE)
+                continue;
+            slots[i].index = next;
+            if (fetch_slot_start(&slots[i], urls[next]) != 0)
+            {
+                fetch_result_t result = {.index = next, .status = -1};
+                cb(&result, arg);
+                done++;
+            }
+            next++;
+        }
+
+        fd_set rfds, wfds;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        int maxfd = -1;
+        for (int i = 0; i < FETCH_MAX_CONCURRENCY; i++)
+        {
+            fetch_slot_t *s = &slots[i];
+            if (s->state == SLOT_IDLE)
+                continue;
+            if (s->state == SLOT_RECEIVING)
+                FD_SET(s->sock, &rfds);
+            else
+                FD_SET(s->sock, &wfds);
+            maxfd = MAX(maxfd, s->sock);
+        }
+        if (maxfd < 0)
+            continue;
+
+        // 最多等100ms，用来检查超时
+        struct timeval tv = {.tv_sec = 0, .tv_usec = 100000};
+        if (select(maxfd + 1, &rfds, &wfds, NULL, &tv) < 0)
+        {
+            ESP_LOGE(TAG, "select failed errno=%d", errno);
+            break;
+        }
+
+        int64_t now = esp_timer_get_time();
+        for (int i = 0; i < FETCH_MAX_CONCURRENCY; i++)
+        {
+            fetch_slot_t *s = &slots[i];
+            if (s->state == SLOT_IDLE)
+                continue;
+            bool ok = false;
+            bool finished = fetch_slot_io(s, FD_ISSET(s->sock, &rfds), FD_ISSET(s->sock, &wfds), &ok);
+            if (!finished && now >= s->deadline_us)
+                finished = true;
+            if (finished)
+            {
+                ok = ok && s->len > 0;
+                // 状态行解析不出来也不算成功
+                if (fetch_slot_finish(s, ok, cb, arg))
+                    succeeded++;
+                done++;
+            }
+        }
+    }
+
+    // select出错时释放还没结束的请求
+    for (int i = 0; i < FETCH_MAX_CONCURRENCY; i++)
+    {
+        if (slots[i].state != SLOT_IDLE)
+            fetch_slot_finish(&slots[i], false, cb, arg);
+    }
+    return succeeded;
+}
+
+/* 最多同时进行FETCH_MAX_CONCURRENCY个请求 */
+int http_fetch_all(const char *const *urls, int count, fetch_done_cb_t cb, void *arg)
+{
+    return http_fetch_all_n(urls, count, FETCH_MAX_CONCURRENCY, cb, arg);
+}
+
+/******************************本地延时server******************************/
+
+// 读完请求头，等一会儿再回复，回复完关闭连接(HTTP/1.0)
+static void bench_conn_task(void *pvParam)
+{
+    int sock = (intptr_t)pvParam;
+    char buf[256];
+    size_t len = 0;
+    while (len < sizeof(buf) - 1)
+    {
+        int r = recv(sock, buf + len, sizeof(buf) - 1 - len, 0);
+        if (r <= 0)
+            break;
+        len += r;
+        buf[len] = '\0';
+        if (strstr(buf, "\r\n\r\n"))
+            break;
+    }
+    vTaskDelay(pdMS_TO_TICKS(BENCH_DELAY_MS));
+    const char resp[] = "HTTP/1.0 200 OK\r\nContent-Length: 5\r\n\r\nhello";
+    send(sock, resp, sizeof(resp) - 1, 0);
+    close(sock);
+    vTaskDelete(NULL);
+}
+
+// 每个连接一个任务，这样多个请求的延时是同时在等的
+static void bench_server_task(void *pvParam)
+{
+    int listen_sock = (intptr_t)pvParam;
+    while (1)
+    {
+        int sock = accept(listen_sock, NULL, NULL);
+        if (sock < 0)
+            continue;
+        if (xTaskCreate(bench_conn_task, "bench_conn", 3072, (void *)(intptr_t)sock, 5, NULL) != pdPASS)
+            close(sock);
+    }
+}
+
+static int bench_server_start(void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(BENCH_PORT),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (sock < 0)
+        return -1;
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(sock, BENCH_REQUESTS) != 0)
+    {
+        close(sock);
+        return -1;
+    }
+    xTaskCreate(bench_server_task, "bench_server", 3072, (void *)(intptr_t)sock, 5, NULL);
+    return 0;
+}
+
+static void bench_done(const fetch_result_t *result, void *arg)
+{
+}
+
+/* 同样的BENCH_REQUESTS个请求，一个一个请求和并行请求各跑一次 */
+static void fetch_bench(void)
+{
+    static char urls_buf[BENCH_REQUESTS][48];
+    const char *urls[BENCH_REQUESTS];
+    for (int i = 0; i < BENCH_REQUESTS; i++)
+    {
+        snprintf(urls_buf[i], sizeof(urls_buf[i]), "http://127.0.0.1:%d/r%d", BENCH_PORT, i);
+        urls[i] = urls_buf[i];
+    }
+    const int inflight[] = {1, FETCH_MAX_CONCURRENCY};
+    for (int i = 0; i < 2; i++)
+    {
+        int64_t start = esp_timer_get_time();
+        int ok = http_fetch_all_n(urls, BENCH_REQUESTS, inflight[i], bench_done, NULL);
+        ESP_LOGI(TAG, "%d in flight: %d/%d ok in %lld ms (each request delayed %d ms)",
+                 inflight[i], ok, BENCH_REQUESTS, (esp_timer_get_time() - start) / 1000, BENCH_DELAY_MS);
+    }
+}
+
+/* 示例回调，这里可以解析配置、保存证书等 */
+static void fetch_done(const fetch_result_t *result, void *arg)
+{
+    const char *const *urls = (const char *const *)arg;
+    ESP_LOGI(TAG, "[%d] %s status=%d body=%u%s", result->index, urls[result->index], result->status,
+             (unsigned)result->body_len, result->truncated ? " (truncated)" : "");
+}
+
+void app_main(void)
+{
+    nvs_flash_init();
+    esp_netif_init();
+    esp_event_loop_create_default();
+
+    /*先连接wifi*/
+    wifi_init_sta();
+    vTaskDelay(3000 / portTICK_PERIOD_MS);
+
+    /*开机时要拉取的资源*/
+    static const char *const urls[] = {
+        "http://192.168.43.65:8000/config.json",
+        "http://192.168.43.65:8000/ca.pem",
+        "http://192.168.43.65:8000/schedule.json",
+        "http://192.168.43.65:8000/firmware_version",
+        "http://www.baidu.com/",
+    };
+    int count = sizeof(urls) / sizeof(urls[0]);
+
+    int64_t start = esp_timer_get_time();
+    int ok = http_fetch_all(urls, count, fetch_done, (void *)urls);
+    ESP_LOGI(TAG, "%d/%d fetched in %lld ms", ok, count, (esp_timer_get_time() - start) / 1000);
+
+    /*对比一个一个请求和并行请求，延时固定，不受外网影响*/
+    if (bench_server_start() == 0)
+        fetch_bench();
+}
@@ -0,0 +1,359 @@
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+#include "sdkconfig.h"
+#include "esp_http_server.h"
+
+/*
+http-server压测例子：
+在板子上启动http server，再用若干个任务通过127.0.0.1的长连接(keep-alive)去压它，
+分别统计GET、小POST、大POST的每秒请求数和p50/p99/p999延时。
+走的是lwip的回环，所以不需要连接wifi，改下面的参数重新编译就能对比不同的httpd_config_t
+*/
+
+/*需要对比的httpd_config_t参数*/
+#define BENCH_MAX_OPEN_SOCKETS 7     // 最大同时打开的socket数，受LWIP_MAX_SOCKETS限制
+#define BENCH_STACK_SIZE 4096        // http server任务的栈大小
+#define BENCH_LRU_PURGE_ENABLE true  // socket用满时是否关闭最久没用的连接
+#define BENCH_RECV_WAIT_TIMEOUT 5    // 接收超时，单位s
+
+/*压测参数*/
+#define BENCH_PORT 80
+#define BENCH_CLIENTS 4             // 压测任务数，每个任务一条长连接，不要超过max_open_sockets-3
+#define BENCH_DURATION_MS 5000      // 每个场景压多久
+#define BENCH_SMALL_POST_LEN 64     // 小POST的body大小
+#define BENCH_LARGE_POST_LEN 16384  // 大POST的body大小
+
+static const char *TAG = "example";
+
+/******************************延时直方图******************************/
+
+/*
+log-linear直方图：每个2的幂区间再均分成16份，桶宽是区间下界的1/16，
+分位数返回桶的下界，真实值最多比它大6.25%。
+32*16个桶只占2KB，可以覆盖1us到几十分钟。
+mqtt_bench.c、eventloop_stats.c、task_profiler.c、TIM_scheduler.c里用的是同一份代码，
+例子都是单文件的，所以各自拷了一份，只是桶数不同
+*/
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (32 * HIST_SUB_COUNT)
+
+typedef struct
+{
+    uint32_t buckets[HIST_BUCKETS];
+    uint32_t count;
+    uint32_t errors;
+} latency_hist_t;
+
+static int hist_index(uint32_t us)
+{
+    if (us < HIST_SUB_COUNT)
+        return us;
+    // 最高位决定区间，后面的4位决定区间内的桶
+    int msb = 31 - __builtin_clz(us);
+    int sub = (us >> (msb - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB_COUNT + sub;
+}
+
+// 返回桶的下界，作为这个桶的代表值
+static uint32_t hist_value(int index)
+{
+    if (index < HIST_SUB_COUNT)
+        return index;
+    int msb = index / HIST_SUB_COUNT + HIST_SUB_BITS - 1;
+    int sub = index % HIST_SUB_COUNT;
+    return (1u << msb) | ((uint32_t)sub << (msb - HIST_SUB_BITS));
+}
+
+static void hist_record(latency_hist_t *h, uint32_t us)
+{
+    h->buckets[hist_index(us)]++;
+    h->count++;
+}
+
+static void hist_merge(latency_hist_t *dst, const latency_hist_t *src)
+{
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->errors += src->errors;
+}
+
+// 分位数，比如p99传入990，p999传入999
+static uint32_t hist_percentile(const latency_hist_t *h, uint32_t permille)
+{
+    uint64_t target = ((uint64_t)h->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= target && seen > 0)
+            return hist_value(i);
+    }
+    return 0;
+}
+
+/******************************http server******************************/
+
+esp_err_t get_handler(httpd_req_t *req)
+{
+    const char resp[] = "Get Response";
+    httpd_resp_send(req, resp, strlen(resp));
+    return ESP_OK;
+}
+
+/* 小POST和大POST共用这个handler，body按块读完后丢掉 */
+esp_err_t post_handler(httpd_req_t *req)
+{
+    char content[1024];
+    size_t remaining = req->content_len;
+
+    while (remaining > 0)
+    {
+        int ret = httpd_req_recv(req, content, MIN(remaining, sizeof(content)));
+        if (ret <= 0)
+        {
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+                continue;
+            return ESP_FAIL;
+        }
+        remaining -= ret;
+    }
+
+    const char resp[] = "POST Response";
+    httpd_resp_send(req, resp, strlen(resp));
+    return ESP_OK;
+}
+
+static httpd_handle_t bench_server_start(void)
+{
+    httpd_uri_t uri_get = {
+        .uri = "/",
+        .method = HTTP_GET,
+        .handler = get_handler,
+        .user_ctx = NULL};
+    httpd_uri_t uri_post = {
+        .uri = "/",
+        .method = HTTP_POST,
+        .handler = post_handler,
+        .user_ctx = NULL};
+
+    // 在默认配置的基础上改需要对比的参数
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = BENCH_PORT;
+    config.max_open_sockets = BENCH_MAX_OPEN_SOCKETS;
+    config.stack_size = BENCH_STACK_SIZE;
+    config.lru_purge_enable = BENCH_LRU_PURGE_ENABLE;
+    config.recv_wait_timeout = BENCH_RECV_WAIT_TIMEOUT;
+
+    httpd_handle_t server = NULL;
+    if (httpd_start(&server, &config) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error starting server!");
+        return NULL;
+    }
+    httpd_register_uri_handler(server, &uri_get);
+    httpd_register_uri_handler(server, &uri_post);
+    return server;
+}
+
+/******************************压测客户端******************************/
+
+typedef enum
+{
+    BENCH_GET,
+    BENCH_SMALL_POST,
+    BENCH_LARGE_POST,
+} bench_kind_t;
+
+static const char *bench_kind_name[] = {"GET", "small POST", "large POST"};
+
+typedef struct
+{
+    bench_kind_t kind;
+    int64_t deadline_us;
+    latency_hist_t hist;
+} bench_worker_t;
+
+static bench_worker_t workers[BENCH_CLIENTS];
+// 每个压测任务结束时释放一次
+static SemaphoreHandle_t done_sem;
+// 大POST的body，所有任务共用
+static char post_body[BENCH_LARGE_POST_LEN];
+
+static int bench_connect(void)
+{
+    struct sockaddr_in dest_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(BENCH_PORT),
+    };
+    inet_pton(AF_INET, "127.0.0.1", &dest_addr.sin_addr);
+
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (sock < 0)
+        return -1;
+    // 请求都很小，关掉nagle，否则延时全是nagle的等待时间
+    int nodelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    if (connect(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) != 0)
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static int send_all(int sock, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        int w = send(sock, buf, len, 0);
+        if (w <= 0)
+            return -1;
+        buf += w;
+        len -= w;
+    }
+    return 0;
+}
+
+/*
+读一个完整的响应：先读到\r\n\r\n为止拿到头部，
+再根据Content-Length把body读完，这样同一条连接可以接着发下一个请求
+*/
+static int read_response(int sock)
+{
+    char buf[512];
+    int used = 0;
+    char *body = NULL;
+
+    while (body == NULL)
+    {
+        if (used == sizeof(buf) - 1)
+            return -1;
+        int r = recv(sock, buf + used, sizeof(buf) - 1 - used, 0);
+        if (r <= 0)
+            return -1;
+        used += r;
+        buf[used] = '\0';
+        body = strstr(buf, "\r\n\r\n");
+    }
+    body += 4;
+
+    // esp_http_server回复的头部大小写是固定的，直接strstr即可
+    const char *cl = strstr(buf, "Content-Length:");
+    int content_len = cl ? atoi(cl + strlen("Content-Length:")) : 0;
+    int remaining = content_len - (used - (body - buf));
+    while (remaining > 0)
+    {
+        int r = recv(sock, buf, MIN(remaining, (int)sizeof(buf)), 0);
+        if (r <= 0)
+            return -1;
+        remaining -= r;
+    }
+    return 0;
+}
+
+static void bench_client_task(void *pvParam)
+{
+    bench_worker_t *w = (bench_worker_t *)pvParam;
+    char head[128];
+    size_t body_len = 0;
+
+    if (w->kind == BENCH_GET)
+    {
+        strcpy(head, "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+    }
+    else
+    {
+        body_len = (w->kind == BENCH_SMALL_POST) ? BENCH_SMALL_POST_LEN : BENCH_LARGE_POST_LEN;
+        snprintf(head, sizeof(head), "POST / HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: %u\r\n\r\n", (unsigned)body_len);
+    }
+    size_t head_len = strlen(head);
+
+    int sock = bench_connect();
+    while (sock >= 0 && esp_timer_get_time() < w->deadline_us)
+    {
+        int64_t start = esp_timer_get_time();
+        if (send_all(sock, head, head_len) != 0 ||
+            (body_len && send_all(sock, post_body, body_len) != 0) ||
+            read_response(sock) != 0)
+        {
+            // 连接被server关掉了(比如lru_purge)，记一次错误后重连
+            w->hist.errors++;
+            close(sock);
+            sock = bench_connect();
+            continue;
+        }
+        hist_record(&w->hist, (uint32_t)(esp_timer_get_time() - start));
+    }
+    if (sock >= 0)
+        close(sock);
+
+    xSemaphoreGive(done_sem);
+    vTaskDelete(NULL);
+}
+
+static void bench_run(bench_kind_t kind)
+{
+    static latency_hist_t total;
+    memset(&total, 0, sizeof(total));
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_CLIENTS; i++)
+    {
+        memset(&workers[i], 0, sizeof(workers[i]));
+        workers[i].kind = kind;
+        workers[i].deadline_us = start + BENCH_DURATION_MS * 1000LL;
+        xTaskCreate(bench_client_task, "bench_client", 4096, &workers[i], 5, NULL);
+    }
+    // 第i次give不一定是第i个任务给的，要等所有压测任务都结束再汇总
+    for (int i = 0; i < BENCH_CLIENTS; i++)
+        xSemaphoreTake(done_sem, portMAX_DELAY);
+    int64_t elapsed_us = esp_timer_get_time() - start;
+    for (int i = 0; i < BENCH_CLIENTS; i++)
+        hist_merge(&total, &workers[i].hist);
+
+    ESP_LOGI(TAG, "%-10s %6.0f req/s  p50=%" PRIu32 "us p99=%" PRIu32 "us p999=%" PRIu32 "us  n=%" PRIu32 " err=%" PRIu32,
+             bench_kind_name[kind],
+             total.count * 1e6 / elapsed_us,
+             hist_percentile(&total, 500),
+             hist_percentile(&total, 990),
+             hist_percentile(&total, 999),
+             total.count,
+             total.errors);
+}
+
+void app_main(void)
+{
+    nvs_flash_init();
+    esp_netif_init();
+    esp_event_loop_create_default();
+
+    /*回环地址不需要wifi，直接启动server*/
+    httpd_handle_t server = bench_server_start();
+    if (!server)
+        return;
+
+    memset(post_body, 'a', sizeof(post_body));
+    done_sem = xSemaphoreCreateCounting(BENCH_CLIENTS, 0);
+
+    ESP_LOGI(TAG, "max_open_sockets=%d stack_size=%d lru_purge=%d recv_wait_timeout=%d clients=%d",
+             BENCH_MAX_OPEN_SOCKETS, BENCH_STACK_SIZE, BENCH_LRU_PURGE_ENABLE, BENCH_RECV_WAIT_TIMEOUT, BENCH_CLIENTS);
+    bench_run(BENCH_GET);
+    bench_run(BENCH_SMALL_POST);
+    bench_run(BENCH_LARGE_POST);
+
+    httpd_stop(server);
+}
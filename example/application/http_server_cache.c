@@ -0,0 +1,356 @@
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+#include "lwip/netdb.h"
+#include "lwip/dns.h"
+#include "sdkconfig.h"
+#include "esp_timer.h"
+#include "esp_http_server.h"
+
+/*这里配置wifi的ssid与密码*/
+#define wifi_ssid "ppxxxg22"
+#define wifi_passwd "12345678910"
+
+static const char *TAG = "example";
+
+/*
+这里两个函数是连接wifi的
+*/
+void sta_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    // wifi事件组中连接wifi和连接wifi失败两个事件
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
+    {
+        // 连接wifi
+        esp_wifi_connect();
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        ESP_LOGW(TAG, "connected failed! retrying...");
+        esp_wifi_connect();
+    }
+
+    // ip事件组中获取到ip
+    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+    {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        ESP_LOGI("TEST_ESP32", "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+    }
+}
+
+void wifi_init_sta(void)
+{
+    /*初始化"网卡"，前面已经完成了所以这里不需要*/
+    // esp_netif_init();
+    // esp_event_loop_create_default();
+    esp_netif_create_default_wifi_sta();
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    esp_wifi_init(&cfg);
+
+    // 为WIFI事件组中所有事件注册回调函数
+    esp_event_handler_instance_register(WIFI_EVENT,
+                                        ESP_EVENT_ANY_ID,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+    // 为IP事件组中获取IP注册回调函数，注意这两个是不同的事件组
+    esp_event_handler_instance_register(IP_EVENT,
+                                        IP_EVENT_STA_GOT_IP,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+
+    // 配置sta连接的ap的ssid和passwd，并启动wifi
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = wifi_ssid,
+            .password = wifi_passwd,
+        },
+    };
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_start();
+
+    ESP_LOGI(TAG, "wifi_init_sta finished.");
+}
+
+/*
+GET响应缓存：
+很多GET接口在几秒内返回的内容都一样，没必要每次都重新生成body和头部。
+这里把状态行+头部+body整段拼好存起来，命中时直接一次httpd_send发出去，
+过期(TTL)或者手动invalidate之后，下一次请求再重新生成
+*/
+
+/* 生成body的回调函数，和snprintf一样往buf里写，返回完整的长度，出错返回-1 */
+typedef int (*resp_cache_build_t)(char *buf, size_t size, void *arg);
+
+typedef struct
+{
+    const char *uri;          // 对应的路径，只用于打印统计
+    const char *content_type; // Content-Type
+    uint32_t ttl_ms;          // 缓存有效期，0表示只能手动invalidate
+    size_t max_body;          // build的缓冲区大小，body最长max_body-1
+    resp_cache_build_t build; // 生成body的函数
+    void *build_arg;          // build的参数
+
+    /*下面是运行时的状态，初始化为0即可*/
+    SemaphoreHandle_t lock;
+    char *resp;         // 响应的缓冲区，前面预留头部的位置
+    char *resp_data;    // 拼好的完整响应在resp中的起始位置
+    size_t resp_len;    // 完整响应的长度
+    int64_t expire_us;  // 过期时间
+    bool valid;         // 是否有可用的缓存
+    uint32_t hits;      // 命中次数
+    uint32_t misses;    // 未命中次数
+    uint64_t bytes_saved; // 命中时省掉重新生成的字节数
+} resp_cache_entry_t;
+
+/* 使缓存失效，数据更新后调用，可以在任意任务中调用 */
+void resp_cache_invalidate(resp_cache_entry_t *entry)
+{
+    xSemaphoreTake(entry->lock, portMAX_DELAY);
+    entry->valid = false;
+    xSemaphoreGive(entry->lock);
+}
+
+/* 重新生成body并拼接出完整的响应，需要持有lock */
+static esp_err_t resp_cache_rebuild(resp_cache_entry_t *entry)
+{
+    // 头部长度是固定上限，body用max_body，一次申请够
+    const size_t head_max = 128;
+    if (entry->resp == NULL)
+    {
+        entry->resp = malloc(head_max + entry->max_body);
+        if (entry->resp == NULL)
+            return ESP_ERR_NO_MEM;
+    }
+
+    // 先把body生成到头部后面预留的位置，知道长度后再写头部
+    char *body = entry->resp + head_max;
+    int body_len = entry->build(body, entry->max_body, entry->build_arg);
+    // build和snprintf一样，返回值等于max_body时最后一个字节已经被截掉了
+    if (body_len < 0 || (size_t)body_len >= entry->max_body)
+        return ESP_FAIL;
+
+    char head[128];
+    int head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.1 200 OK\r\n"
+                            "Content-Type: %s\r\n"
+                            "Content-Length: %d\r\n"
+                            "\r\n",
+                            entry->content_type, body_len);
+    if (head_len < 0 || (size_t)head_len >= head_max)
+        return ESP_FAIL;
+
+    // 头部紧贴着body放，这样整个响应在内存里是连续的，可以一次发出去
+    entry->resp_data = entry->resp + head_max - head_len;
+    memcpy(entry->resp_data, head, head_len);
+    entry->resp_len = head_len + body_len;
+    entry->valid = true;
+    entry->expire_us = esp_timer_get_time() + (int64_t)entry->ttl_ms * 1000;
+    return ESP_OK;
+}
+
+/*
+带缓存的GET handler，注册uri时把resp_cache_entry_t放到user_ctx里
+*/
+esp_err_t resp_cache_handler(httpd_req_t *req)
+{
+    resp_cache_entry_t *entry = (resp_cache_entry_t *)req->user_ctx;
+    esp_err_t ret = ESP_OK;
+
+    xSemaphoreTake(entry->lock, portMAX_DELAY);
+
+    bool expired = entry->ttl_ms > 0 && esp_timer_get_time() >= entry->expire_us;
+    if (entry->valid && !expired)
+    {
+        entry->hits++;
+        entry->bytes_saved += entry->resp_len;
+    }
+    else
+    {
+        entry->misses++;
+        ret = resp_cache_rebuild(entry);
+    }
+
+    if (ret == ESP_OK)
+    {
+        /*
+        httpd_send直接往socket里写原始数据，不会再加任何头部，
+        一次可能写不完，所以循环发送
+        */
+        size_t sent = 0;
+        while (sent < entry->resp_len)
+        {
+            int n = httpd_send(req, entry->resp_data + sent, entry->resp_len - sent);
+            if (n <= 0)
+            {
+                ret = ESP_FAIL;
+                break;
+            }
+            sent += n;
+        }
+    }
+    else
+    {
+        entry->valid = false;
+    }
+
+    xSemaphoreGive(entry->lock);
+    // 返回ESP_FAIL会让server关闭这个连接
+    return ret;
+}
+
+/*
+下面是两个示例接口的body生成函数
+*/
+static int build_status(char *buf, size_t size, void *arg)
+{
+    return snprintf(buf, size, "{\"uptime_ms\":%lld,\"free_heap\":%" PRIu32 "}",
+                    esp_timer_get_time() / 1000, esp_get_free_heap_size());
+}
+
+static int build_config(char *buf, size_t size, void *arg)
+{
+    const char *config = (const char *)arg;
+    return snprintf(buf, size, "%s", config);
+}
+
+// 两个带缓存的接口，status缓存2s，config只在修改后手动invalidate
+static resp_cache_entry_t status_cache = {
+    .uri = "/status",
+    .content_type = "application/json",
+    .ttl_ms = 2000,
+    .max_body = 256,
+    .build = build_status,
+};
+
+static char config_text[128] = "{\"interval\":10}";
+static resp_cache_entry_t config_cache = {
+    .uri = "/config",
+    .content_type = "application/json",
+    .ttl_ms = 0,
+    .max_body = sizeof(config_text),
+    .build = build_config,
+    .build_arg = config_text,
+};
+
+static resp_cache_entry_t *cache_entries[] = {&status_cache, &config_cache};
+
+/* 统计接口，输出每个路径的命中、未命中次数和省掉的字节数，这个接口本身不缓存 */
+esp_err_t cache_stats_handler(httpd_req_t *req)
+{
+    char resp[256];
+    int len = 0;
+    for (int i = 0; i < sizeof(cache_entries) / sizeof(cache_entries[0]); i++)
+    {
+        resp_cache_entry_t *e = cache_entries[i];
+        // 计数是在lock里改的，读也要加锁，不然64位的bytes_saved可能读到一半
+        xSemaphoreTake(e->lock, portMAX_DELAY);
+        uint32_t hits = e->hits;
+        uint32_t misses = e->misses;
+        uint64_t bytes_saved = e->bytes_saved;
+        xSemaphoreGive(e->lock);
+        len += snprintf(resp + len, sizeof(resp) - len, "%s hits=%" PRIu32 " misses=%" PRIu32 " saved=%llu\n",
+                        e->uri, hits, misses, (unsigned long long)bytes_saved);
+        if (len >= sizeof(resp))
+            break;
+    }
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+/* 修改配置，修改后让config的缓存失效 */
+esp_err_t config_post_handler(httpd_req_t *req)
+{
+    char content[sizeof(config_text)];
+    size_t recv_size = MIN(req->content_len, sizeof(content) - 1);
+    int ret = httpd_req_recv(req, content, recv_size);
+    if (ret <= 0)
+    {
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+            httpd_resp_send_408(req);
+        return ESP_FAIL;
+    }
+    content[ret] = '\0';
+
+    // 修改数据和invalidate要在同一把锁里，否则可能缓存住修改了一半的数据
+    xSemaphoreTake(config_cache.lock, portMAX_DELAY);
+    strcpy(config_text, content);
+    config_cache.valid = false;
+    xSemaphoreGive(config_cache.lock);
+
+    httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+/* 启动 Web 服务器的函数 */
+void http_server_init(void)
+{
+    // 初始化每个缓存的锁
+    for (int i = 0; i < sizeof(cache_entries) / sizeof(cache_entries[0]); i++)
+        cache_entries[i]->lock = xSemaphoreCreateMutex();
+
+    /*带缓存的接口都用resp_cache_handler，区别只在user_ctx*/
+    httpd_uri_t uri_status = {
+        .uri = "/status",
+        .method = HTTP_GET,
+        .handler = resp_cache_handler,
+        .user_ctx = &status_cache};
+    httpd_uri_t uri_config = {
+        .uri = "/config",
+        .method = HTTP_GET,
+        .handler = resp_cache_handler,
+        .user_ctx = &config_cache};
+    httpd_uri_t uri_config_post = {
+        .uri = "/config",
+        .method = HTTP_POST,
+        .handler = config_post_handler,
+        .user_ctx = NULL};
+    httpd_uri_t uri_stats = {
+        .uri = "/cache_stats",
+        .method = HTTP_GET,
+        .handler = cache_stats_handler,
+        .user_ctx = NULL};
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    httpd_handle_t server = NULL;
+
+    ESP_LOGI(TAG, "starting server!");
+    if (httpd_start(&server, &config) == ESP_OK)
+    {
+        httpd_register_uri_handler(server, &uri_status);
+        httpd_register_uri_handler(server, &uri_config);
+        httpd_register_uri_handler(server, &uri_config_post);
+        httpd_register_uri_handler(server, &uri_stats);
+    }
+    if (!server)
+    {
+        ESP_LOGE(TAG, "Error starting server!");
+    }
+}
+
+void app_main(void)
+{
+    nvs_flash_init();
+    esp_netif_init();
+    esp_event_loop_create_default();
+
+    /*先连接wifi*/
+    wifi_init_sta();
+    vTaskDelay(3000 / portTICK_PERIOD_MS);
+
+    /*然后开启http服务*/
+    http_server_init();
+}
@@ -0,0 +1,478 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+#include "lwip/netdb.h"
+#include "lwip/dns.h"
+#include "sdkconfig.h"
+#include "esp_timer.h"
+
+/*这里配置wifi的ssid与密码*/
+#define wifi_ssid "test_wifi"
+#define wifi_passwd "12345678910"
+
+static const char *TAG = "example";
+
+/*
+这里两个函数是连接wifi的
+*/
+void sta_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    // wifi事件组中连接wifi和连接wifi失败两个事件
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
+    {
+        // 连接wifi
+        esp_wifi_connect();
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        ESP_LOGW(TAG, "connected failed! retrying...");
+        esp_wifi_connect();
+    }
+
+    // ip事件组中获取到ip
+    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+    {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        ESP_LOGI("TEST_ESP32", "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+    }
+}
+
+void wifi_init_sta(void)
+{
+    /*初始化"网卡"，前面已经完成了所以这里不需要*/
+    // esp_netif_init();
+    // esp_event_loop_create_default();
+    esp_netif_create_default_wifi_sta();
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    esp_wifi_init(&cfg);
+
+    // 为WIFI事件组中所有事件注册回调函数
+    esp_event_handler_instance_register(WIFI_EVENT,
+                                        ESP_EVENT_ANY_ID,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+    // 为IP事件组中获取IP注册回调函数，注意这两个是不同的事件组
+    esp_event_handler_instance_register(IP_EVENT,
+                                        IP_EVENT_STA_GOT_IP,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+
+    // 配置sta连接的ap的ssid和passwd，并启动wifi
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = wifi_ssid,
+            .password = wifi_passwd,
+        },
+    };
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_start();
+
+    ESP_LOGI(TAG, "wifi_init_sta finished.");
+}
+
+/*
+MQTT批量发布：
+esp_mqtt_client_publish每发一条消息都要编码一次topic、写一次socket，
+每秒几百条传感器数据时，开销主要在这些逐条的操作上。
+这里自己维护一条到broker的TCP连接(只实现QoS0的发布)，
+消息先放在缓冲区里，定时把多条PUBLISH报文拼在一起用一次send发出去。
+对于只关心最新值的数据，同一个topic在发送之前的新值会直接覆盖旧值
+*/
+
+#define BATCH_BROKER_IP "192.168.43.65"
+#define BATCH_BROKER_PORT 1883
+#define BATCH_CLIENT_ID "esp32_batch"
+#define BATCH_KEEPALIVE_S 60
+
+#define BATCH_MAX_TOPICS 16        // 最多注册几个topic
+#define BATCH_MAX_TOPIC_LEN 64     // topic最大长度
+#define BATCH_MAX_PAYLOAD 64       // 覆盖模式下每个topic的最大payload
+#define BATCH_BUF_SIZE 4096        // 一次flush最多发送的字节数
+#define BATCH_FLUSH_INTERVAL_MS 50 // 多久flush一次
+
+#define BENCH_RATE 1000            // 测试时每秒提交多少条遥测
+#define BENCH_SECONDS 10
+
+typedef struct
+{
+    // 提前编码好的 固定头以外的topic部分：2字节长度+topic
+    uint8_t topic_enc[2 + BATCH_MAX_TOPIC_LEN];
+    size_t topic_enc_len;
+    // 覆盖模式下等待发送的最新值
+    uint8_t payload[BATCH_MAX_PAYLOAD];
+    size_t payload_len;
+    bool dirty;
+    uint32_t seq; // 每次更新加1，flush发完以后用来判断发送期间有没有新值
+} batch_topic_t;
+
+typedef struct
+{
+    uint32_t submitted; // 提交的消息数
+    uint32_t coalesced; // 被新值覆盖掉、不需要再发送的消息数
+    uint32_t dropped;   // 缓冲区满了丢掉的消息数(包括断线时积压的)
+    uint32_t packets;   // 实际发送的PUBLISH报文数
+    uint32_t writes;    // send的调用次数
+    uint64_t bytes;     // 发送的字节数
+} batch_stats_t;
+
+static batch_topic_t batch_topics[BATCH_MAX_TOPICS];
+static int batch_topic_count;
+static batch_stats_t batch_stats;
+static SemaphoreHandle_t batch_lock;
+static int batch_sock = -1;
+static int64_t batch_last_send_us;
+
+// 追加模式的消息直接编码好放在这里
+static uint8_t batch_pending[BATCH_BUF_SIZE];
+static size_t batch_pending_len;
+static uint32_t batch_pending_packets;
+// flush时拼好的要发送的数据
+static uint8_t batch_send_buf[BATCH_BUF_SIZE];
+// 这次flush带上了哪些topic，以及当时的seq
+static bool batch_send_topic[BATCH_MAX_TOPICS];
+static uint32_t batch_send_seq[BATCH_MAX_TOPICS];
+
+/* MQTT的剩余长度是变长编码，每字节7位，最高位表示后面还有 */
+static size_t mqtt_encode_len(uint8_t *buf, size_t len)
+{
+    size_t n = 0;
+    do
+    {
+        uint8_t b = len & 0x7F;
+        len >>= 7;
+        buf[n++] = len ? (b | 0x80) : b;
+    } while (len);
+    return n;
+}
+
+/* 编码一个QoS0的PUBLISH报文，空间不够返回0 */
+static size_t mqtt_encode_publish(uint8_t *buf, size_t size, const batch_topic_t *t, const void *payload, size_t len)
+{
+    size_t remaining = t->topic_enc_len + len;
+    uint8_t head[5];
+    head[0] = 0x30; // PUBLISH，QoS0，不保留
+    size_t head_len = 1 + mqtt_encode_len(head + 1, remaining);
+    if (head_len + remaining > size)
+        return 0;
+    memcpy(buf, head, head_len);
+    memcpy(buf + head_len, t->topic_enc, t->topic_enc_len);
+    memcpy(buf + head_len + t->topic_enc_len, payload, len);
+    return head_len + remaining;
+}
+
+static int batch_send_all(const uint8_t *buf, size_t len)
+{
+    while (len > 0)
+    {
+        int w = send(batch_sock, buf, len, 0);
+        if (w <= 0)
+            return -1;
+        buf += w;
+        len -= w;
+    }
+    batch_last_send_us = esp_timer_get_time();
+    return 0;
+}
+
+/* 连接broker并完成CONNECT/CONNACK握手 */
+static int batch_connect(void)
+{
+    struct sockaddr_in dest_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(BATCH_BROKER_PORT),
+    };
+    inet_pton(AF_INET, BATCH_BROKER_IP, &dest_addr.sin_addr);
+
+    batch_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (batch_sock < 0)
+        return -1;
+    if (connect(batch_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) != 0)
+    {
+        ESP_LOGE(TAG, "Socket unable to connect: errno %d", errno);
+        close(batch_sock);
+        batch_sock = -1;
+        return -1;
+    }
+
+    // CONNECT报文：协议名MQTT、版本4、clean session、keepalive、client id
+    uint8_t pkt[64];
+    size_t id_len = strlen(BATCH_CLIENT_ID);
+    uint8_t var[] = {0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, BATCH_KEEPALIVE_S >> 8, BATCH_KEEPALIVE_S & 0xFF};
+    size_t n = 0;
+    pkt[n++] = 0x10;
+    n += mqtt_encode_len(pkt + n, sizeof(var) + 2 + id_len);
+    memcpy(pkt + n, var, sizeof(var));
+    n += sizeof(var);
+    pkt[n++] = id_len >> 8;
+    pkt[n++] = id_len & 0xFF;
+    memcpy(pkt + n, BATCH_CLIENT_ID, id_len);
+    n += id_len;
+
+    uint8_t connack[4];
+    if (batch_send_all(pkt, n) != 0 || recv(batch_sock, connack, sizeof(connack), MSG_WAITALL) != 4 ||
+        connack[0] != 0x20 || connack[3] != 0)
+    {
+        ESP_LOGE(TAG, "MQTT connect refused");
+        close(batch_sock);
+        batch_sock = -1;
+        return -1;
+    }
+
+    // 之后只会收到PINGRESP，设置成非阻塞，在flush时顺便读掉
+    fcntl(batch_sock, F_SETFL, fcntl(batch_sock, F_GETFL, 0) | O_NONBLOCK);
+    // 已经自己攒批了，关掉nagle
+    int nodelay = 1;
+    setsockopt(batch_sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    ESP_LOGI(TAG, "MQTT connected");
+    return 0;
+}
+
+/* 注册一个topic，提前编码好，返回topic的id */
+int mqtt_batch_topic(const char *topic)
+{
+    size_t len = strlen(topic);
+    if (batch_topic_count >= BATCH_MAX_TOPICS || len > BATCH_MAX_TOPIC_LEN)
+        return -1;
+    batch_topic_t *t = &batch_topics[batch_topic_count];
+    t->topic_enc[0] = len >> 8;
+    t->topic_enc[1] = len & 0xFF;
+    memcpy(t->topic_enc + 2, topic, len);
+    t->topic_enc_len = 2 + len;
+    return batch_topic_count++;
+}
+
+/*
+覆盖模式：只保留最新值，发送之前的新值直接替换旧值
+适合温度、电量这类只关心最新数据的遥测
+*/
+esp_err_t mqtt_batch_set(int topic_id, const void *payload, size_t len)
+{
+    if (topic_id < 0 || topic_id >= batch_topic_count || len > BATCH_MAX_PAYLOAD)
+        return ESP_ERR_INVALID_ARG;
+    batch_topic_t *t = &batch_topics[topic_id];
+
+    xSemaphoreTake(batch_lock, portMAX_DELAY);
+    batch_stats.submitted++;
+    if (t->dirty)
+        batch_stats.coalesced++;
+    memcpy(t->payload, payload, len);
+    t->payload_len = len;
+    t->dirty = true;
+    t->seq++;
+    xSemaphoreGive(batch_lock);
+    return ESP_OK;
+}
+
+/*
+追加模式：每条消息都会发送，按提交顺序排队
+适合事件、日志这类不能丢的消息，断线时也留在缓冲区里，重连后再发，
+只有缓冲区满了才会丢(返回ESP_ERR_NO_MEM并计入dropped)
+*/
+esp_err_t mqtt_batch_append(int topic_id, const void *payload, size_t len)
+{
+    if (topic_id < 0 || topic_id >= batch_topic_count)
+        return ESP_ERR_INVALID_ARG;
+
+    xSemaphoreTake(batch_lock, portMAX_DELAY);
+    batch_stats.submitted++;
+    size_t n = mqtt_encode_publish(batch_pending + batch_pending_len, sizeof(batch_pending) - batch_pending_len,
+                                   &batch_topics[topic_id], payload, len);
+    if (n == 0)
+        batch_stats.dropped++;
+    else
+        batch_pending_packets++;
+    batch_pending_len += n;
+    xSemaphoreGive(batch_lock);
+    return n ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+/* 发送失败，关掉连接，下一次flush时重连 */
+static void batch_disconnect(void)
+{
+    close(batch_sock);
+    batch_sock = -1;
+}
+
+/*
+把排队的消息拼到一起，一次发出去。
+先确认连接正常再取数据，send全部成功后才把发出去的部分从队列里去掉，
+断线或者发送失败时数据还留在队列里，重连后再发(发送到一半断开的那批可能会重复)
+*/
+esp_err_t mqtt_batch_flush(void)
+{
+    // 读掉broker发来的PINGRESP，连接被关掉时recv返回0
+    uint8_t discard[16];
+    while (batch_sock >= 0)
+    {
+        int r = recv(batch_sock, discard, sizeof(discard), 0);
+        if (r > 0)
+            continue;
+        if (r == 0 || errno != EAGAIN)
+            batch_disconnect();
+        break;
+    }
+    if (batch_sock < 0 && batch_connect() != 0)
+        return ESP_FAIL;
+
+    size_t len = 0;
+    size_t pending_len = 0;
+    uint32_t pending_packets = 0;
+    uint32_t packets = 0;
+
+    // 持有锁时只做拷贝和编码，发送时不持有锁，不会挡住提交消息的任务
+    xSemaphoreTake(batch_lock, portMAX_DELAY);
+    memcpy(batch_send_buf, batch_pending, batch_pending_len);
+    len = pending_len = batch_pending_len;
+    packets = pending_packets = batch_pending_packets;
+    for (int i = 0; i < batch_topic_count; i++)
+    {
+        batch_topic_t *t = &batch_topics[i];
+        batch_send_topic[i] = false;
+        if (!t->dirty)
+            continue;
+        size_t n = mqtt_encode_publish(batch_send_buf + len, sizeof(batch_send_buf) - len, t, t->payload, t->payload_len);
+        if (n == 0)
+            continue; // 放不下的留到下一次
+        len += n;
+        batch_send_topic[i] = true;
+        batch_send_seq[i] = t->seq;
+        packets++;
+    }
+    xSemaphoreGive(batch_lock);
+
+    bool ping = false;
+    if (len == 0)
+    {
+        // 没有数据时按keepalive发送PINGREQ
+        if (esp_timer_get_time() - batch_last_send_us < BATCH_KEEPALIVE_S * 500000LL)
+            return ESP_OK;
+        batch_send_buf[0] = 0xC0;
+        batch_send_buf[1] = 0;
+        len = 2;
+        ping = true;
+    }
+
+    // 非阻塞socket，发送缓冲区满时等一下再发
+    size_t sent = 0;
+    uint32_t writes = 0;
+    while (sent < len)
+    {
+        int w = send(batch_sock, batch_send_buf + sent, len - sent, 0);
+        if (w < 0 && errno == EAGAIN)
+        {
+            vTaskDelay(1);
+            continue;
+        }
+        if (w <= 0)
+        {
+            ESP_LOGW(TAG, "send failed errno=%d, reconnecting", errno);
+            batch_disconnect();
+            return ESP_FAIL;
+        }
+        sent += w;
+        writes++;
+    }
+    batch_last_send_us = esp_timer_get_time();
+
+    // 发完了再从队列里去掉，发送期间追加的消息在后面，挪到前面
+    xSemaphoreTake(batch_lock, portMAX_DELAY);
+    if (!ping)
+    {
+        memmove(batch_pending, batch_pending + pending_len, batch_pending_len - pending_len);
+        batch_pending_len -= pending_len;
+        batch_pending_packets -= pending_packets;
+        for (int i = 0; i < batch_topic_count; i++)
+        {
+            // 发送期间又有新值的话还要再发一次
+            if (batch_send_topic[i] && batch_topics[i].seq == batch_send_seq[i])
+                batch_topics[i].dirty = false;
+        }
+        batch_stats.packets += packets;
+    }
+    batch_stats.writes += writes;
+    batch_stats.bytes += len;
+    xSemaphoreGive(batch_lock);
+    return ESP_OK;
+}
+
+static void mqtt_batch_flush_task(void *pvParam)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1)
+    {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(BATCH_FLUSH_INTERVAL_MS));
+        mqtt_batch_flush();
+    }
+}
+
+void mqtt_batch_start(void)
+{
+    batch_lock = xSemaphoreCreateMutex();
+    batch_connect();
+    xTaskCreate(mqtt_batch_flush_task, "mqtt_flush", 3072, NULL, 5, NULL);
+}
+
+void app_main(void)
+{
+    nvs_flash_init();
+    esp_netif_init();
+    esp_event_loop_create_default();
+
+    /*先连接wifi*/
+    wifi_init_sta();
+    vTaskDelay(3000 / portTICK_PERIOD_MS);
+
+    /*topic要在启动前注册好*/
+    int sensors[8];
+    char topic[32];
+    for (int i = 0; i < 8; i++)
+    {
+        snprintf(topic, sizeof(topic), "sensor/%d/value", i);
+        sensors[i] = mqtt_batch_topic(topic);
+    }
+    int events = mqtt_batch_topic("device/events");
+    mqtt_batch_start();
+
+    /*
+    每秒1000条遥测，一共10s。vTaskDelay(1)是一个tick，CONFIG_FREERTOS_HZ=100时是10ms，
+    所以每次醒来按经过的时间补齐该发的条数，不管tick是多少速度都一样
+    */
+    char payload[32];
+    int total = BENCH_RATE * BENCH_SECONDS;
+    int i = 0;
+    int64_t start = esp_timer_get_time();
+    while (i < total)
+    {
+        int64_t due = (esp_timer_get_time() - start) * BENCH_RATE / 1000000;
+        for (; i < total && i <= due; i++)
+        {
+            int len = snprintf(payload, sizeof(payload), "%d", i);
+            mqtt_batch_set(sensors[i % 8], payload, len);
+            // 每1000条产生一个事件，事件不能被覆盖
+            if (i % 1000 == 0)
+                mqtt_batch_append(events, "tick", 4);
+        }
+        vTaskDelay(1);
+    }
+    int64_t elapsed_us = esp_timer_get_time() - start;
+
+    xSemaphoreTake(batch_lock, portMAX_DELAY);
+    batch_stats_t s = batch_stats;
+    xSemaphoreGive(batch_lock);
+    ESP_LOGI(TAG, "submitted %" PRIu32 " (%.0f msg/s), coalesced %" PRIu32 ", dropped %" PRIu32,
+             s.submitted, s.submitted * 1e6 / elapsed_us, s.coalesced, s.dropped);
+    ESP_LOGI(TAG, "sent %" PRIu32 " packets in %" PRIu32 " writes, %llu bytes",
+             s.packets, s.writes, (unsigned long long)s.bytes);
+}
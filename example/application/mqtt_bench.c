@@ -0,0 +1,363 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_idf_version.h"
+#include "nvs_flash.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+#include "lwip/netdb.h"
+#include "lwip/dns.h"
+#include "sdkconfig.h"
+#include "mqtt_client.h"
+
+/*
+mqtt-client压测例子：
+自己订阅自己发布的topic，消息里带上发送时的时间戳，收到后就能算出经过broker转一圈的延时。
+对QoS0/1/2和不同大小的payload分别统计发布速率、接收速率、p50/p99延时、丢失数、
+压测过程中的最小剩余内存和esp-mqtt内部outbox的峰值大小。
+broker可以在电脑上用mosquitto跑一个(mosquitto -v -p 1883)，尽量和板子在同一个局域网里，
+改下面的参数重新编译，就能对比不同的esp_mqtt_client_config_t设置
+*/
+
+/*这里配置wifi的ssid与密码*/
+#define wifi_ssid "test_wifi"
+#define wifi_passwd "12345678910"
+
+static const char *TAG = "example";
+
+/*
+这里两个函数是连接wifi的
+*/
+void sta_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    // wifi事件组中连接wifi和连接wifi失败两个事件
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
+    {
+        // 连接wifi
+        esp_wifi_connect();
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        ESP_LOGW(TAG, "connected failed! retrying...");
+        esp_wifi_connect();
+    }
+
+    // ip事件组中获取到ip
+    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+    {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        ESP_LOGI("TEST_ESP32", "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+    }
+}
+
+void wifi_init_sta(void)
+{
+    /*初始化"网卡"，前面已经完成了所以这里不需要*/
+    // esp_netif_init();
+    // esp_event_loop_create_default();
+    esp_netif_create_default_wifi_sta();
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    esp_wifi_init(&cfg);
+
+    // 为WIFI事件组中所有事件注册回调函数
+    esp_event_handler_instance_register(WIFI_EVENT,
+                                        ESP_EVENT_ANY_ID,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+    // 为IP事件组中获取IP注册回调函数，注意这两个是不同的事件组
+    esp_event_handler_instance_register(IP_EVENT,
+                                        IP_EVENT_STA_GOT_IP,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+
+    // 配置sta连接的ap的ssid和passwd，并启动wifi
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = wifi_ssid,
+            .password = wifi_passwd,
+        },
+    };
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_start();
+
+    ESP_LOGI(TAG, "wifi_init_sta finished.");
+}
+
+/*需要对比的esp_mqtt_client_config_t参数*/
+#define BENCH_BROKER_URI "mqtt://192.168.43.65"
+#define BENCH_BUFFER_SIZE 1024     // 接收缓冲区，比payload小时消息会分片收到
+#define BENCH_OUT_BUFFER_SIZE 1024 // 发送缓冲区，0表示和接收缓冲区一样大
+#define BENCH_OUTBOX_LIMIT 0       // outbox的字节上限，0表示不限制，IDF5.1以上才有这个配置
+#define BENCH_TASK_PRIORITY 5      // mqtt任务的优先级
+#define BENCH_TASK_STACK 6144      // mqtt任务的栈大小
+
+/*压测参数*/
+#define BENCH_TOPIC "/bench/loop"
+#define BENCH_MESSAGES 500         // 每个场景发多少条
+#define BENCH_MAX_INFLIGHT 16      // QoS1/2最多有多少条没收到确认，防止outbox无限增长
+#define BENCH_DRAIN_TIMEOUT_MS 5000 // 发完后最多等多久收回所有消息
+
+static const int bench_sizes[] = {16, 256, 1024, 4096};
+
+/******************************延时直方图******************************/
+
+/* 和http_server_bench.c里的直方图一样，说明见那里 */
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (32 * HIST_SUB_COUNT)
+
+typedef struct
+{
+    uint32_t buckets[HIST_BUCKETS];
+    uint32_t count;
+    uint32_t max;
+} latency_hist_t;
+
+static int hist_index(uint32_t us)
+{
+    if (us < HIST_SUB_COUNT)
+        return us;
+    // 最高位决定区间，后面的4位决定区间内的桶
+    int msb = 31 - __builtin_clz(us);
+    int sub = (us >> (msb - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB_COUNT + sub;
+}
+
+// 返回桶的下界，作为这个桶的代表值
+static uint32_t hist_value(int index)
+{
+    if (index < HIST_SUB_COUNT)
+        return index;
+    int msb = index / HIST_SUB_COUNT + HIST_SUB_BITS - 1;
+    int sub = index % HIST_SUB_COUNT;
+    return (1u << msb) | ((uint32_t)sub << (msb - HIST_SUB_BITS));
+}
+
+static void hist_record(latency_hist_t *h, uint32_t us)
+{
+    h->buckets[hist_index(us)]++;
+    h->count++;
+    if (us > h->max)
+        h->max = us;
+}
+
+// 分位数，比如p99传入990
+static uint32_t hist_percentile(const latency_hist_t *h, uint32_t permille)
+{
+    uint64_t target = ((uint64_t)h->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= target && seen > 0)
+            return hist_value(i);
+    }
+    return 0;
+}
+
+/******************************压测******************************/
+
+/*每条消息开头的8字节，后面用0x55填满到指定大小*/
+typedef struct
+{
+    uint32_t seq;
+    uint32_t sent_us; // 发送时的esp_timer_get_time()低32位，够算70分钟以内的延时
+} bench_stamp_t;
+
+#define BENCH_CONNECTED_BIT BIT0
+#define BENCH_SUBSCRIBED_BIT BIT1
+
+static EventGroupHandle_t bench_event_group;
+// QoS1/2每收到一次MQTT_EVENT_PUBLISHED释放一次，用来限制未确认的消息数
+static SemaphoreHandle_t inflight_sem;
+static char payload[4096];
+
+// 下面这些在mqtt任务里更新，在压测任务里读
+static latency_hist_t hist;
+static volatile uint32_t received;
+static volatile uint32_t published;
+static volatile uint32_t bench_round; // 丢掉上一轮残留的消息
+static bool bench_skip_msg;           // 当前分片所属的消息是上一轮的，后面的分片也不统计
+
+/*mqtt事件回调函数*/
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    esp_mqtt_event_handle_t event = event_data;
+
+    switch ((esp_mqtt_event_id_t)event_id)
+    {
+    case MQTT_EVENT_CONNECTED:
+        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+        xEventGroupSetBits(bench_event_group, BENCH_CONNECTED_BIT);
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        xEventGroupClearBits(bench_event_group, BENCH_CONNECTED_BIT | BENCH_SUBSCRIBED_BIT);
+        break;
+    case MQTT_EVENT_SUBSCRIBED:
+        xEventGroupSetBits(bench_event_group, BENCH_SUBSCRIBED_BIT);
+        break;
+    case MQTT_EVENT_PUBLISHED:
+        // QoS1收到PUBACK、QoS2收到PUBCOMP时触发
+        published++;
+        xSemaphoreGive(inflight_sem);
+        break;
+    case MQTT_EVENT_DATA:
+        // 大消息会分片，时间戳在第一片里，最后一片到了才算收完
+        if (event->current_data_offset == 0)
+        {
+            bench_stamp_t stamp;
+            // 序号的高8位是轮次，不是这一轮的消息整条都不统计
+            bench_skip_msg = event->data_len < (int)sizeof(bench_stamp_t);
+            if (!bench_skip_msg)
+            {
+                memcpy(&stamp, event->data, sizeof(stamp));
+                bench_skip_msg = (stamp.seq >> 24) != (bench_round & 0xff);
+            }
+            if (!bench_skip_msg)
+                hist_record(&hist, (uint32_t)esp_timer_get_time() - stamp.sent_us);
+        }
+        if (bench_skip_msg)
+            break;
+        if (event->current_data_offset + event->data_len >= event->total_data_len)
+            received++;
+        break;
+    case MQTT_EVENT_ERROR:
+        ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+        break;
+    default:
+        break;
+    }
+}
+
+/*初始化mqtt，并返回一个mqtt的handler*/
+static esp_mqtt_client_handle_t mqtt_app_start(void)
+{
+    esp_mqtt_client_config_t mqtt_cfg = {
+        .broker.address.uri = BENCH_BROKER_URI,
+        .buffer.size = BENCH_BUFFER_SIZE,
+        .buffer.out_size = BENCH_OUT_BUFFER_SIZE,
+        .task.priority = BENCH_TASK_PRIORITY,
+        .task.stack_size = BENCH_TASK_STACK,
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+        .outbox.limit = BENCH_OUTBOX_LIMIT,
+#endif
+    };
+    esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
+    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+    esp_mqtt_client_start(client);
+    return client;
+}
+
+static void bench_run(esp_mqtt_client_handle_t client, int qos, int size)
+{
+    memset(&hist, 0, sizeof(hist));
+    received = 0;
+    published = 0;
+    bench_round++;
+
+    // 信号量里留下的计数清掉，重新放满BENCH_MAX_INFLIGHT个
+    while (xSemaphoreTake(inflight_sem, 0) == pdTRUE)
+        ;
+    for (int i = 0; i < BENCH_MAX_INFLIGHT; i++)
+        xSemaphoreGive(inflight_sem);
+
+    uint32_t heap_before = esp_get_free_heap_size();
+    uint32_t heap_min = heap_before;
+    int outbox_max = 0;
+    int pub_fail = 0;
+    uint32_t sent = 0;
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < BENCH_MESSAGES; i++)
+    {
+        // QoS0没有确认，直接发
+        if (qos > 0 && xSemaphoreTake(inflight_sem, pdMS_TO_TICKS(BENCH_DRAIN_TIMEOUT_MS)) != pdTRUE)
+        {
+            ESP_LOGW(TAG, "no ack for %d ms, stop this round", BENCH_DRAIN_TIMEOUT_MS);
+            break;
+        }
+        bench_stamp_t stamp = {
+            .seq = ((bench_round & 0xff) << 24) | i,
+            .sent_us = (uint32_t)esp_timer_get_time(),
+        };
+        memcpy(payload, &stamp, sizeof(stamp));
+        if (esp_mqtt_client_publish(client, BENCH_TOPIC, payload, size, qos, 0) < 0)
+            pub_fail++;
+        else
+            sent++;
+
+        // 每发一条采样一次内存和outbox
+        uint32_t heap = esp_get_free_heap_size();
+        if (heap < heap_min)
+            heap_min = heap;
+        int outbox = esp_mqtt_client_get_outbox_size(client);
+        if (outbox > outbox_max)
+            outbox_max = outbox;
+    }
+    int64_t publish_us = esp_timer_get_time() - start;
+
+    // 等所有消息从broker转回来
+    int64_t deadline = esp_timer_get_time() + BENCH_DRAIN_TIMEOUT_MS * 1000LL;
+    while (received < sent && esp_timer_get_time() < deadline)
+        vTaskDelay(pdMS_TO_TICKS(10));
+    int64_t elapsed_us = esp_timer_get_time() - start;
+
+    ESP_LOGI(TAG, "qos%d %5dB  pub %6.0f msg/s  recv %6.0f msg/s %7.1f KB/s  p50=%" PRIu32 "us p99=%" PRIu32 "us max=%" PRIu32 "us  lost=%" PRIu32 " fail=%d",
+             qos, size,
+             sent * 1e6 / publish_us,
+             received * 1e6 / elapsed_us,
+             (double)received * size * 1e6 / elapsed_us / 1024,
+             hist_percentile(&hist, 500),
+             hist_percentile(&hist, 990),
+             hist.max,
+             sent - received,
+             pub_fail);
+    ESP_LOGI(TAG, "          heap used max %" PRIu32 " bytes, outbox max %d bytes, acked %" PRIu32,
+             heap_before - heap_min, outbox_max, published);
+}
+
+void app_main(void)
+{
+    nvs_flash_init();
+    esp_netif_init();
+    esp_event_loop_create_default();
+
+    /*先连接wifi*/
+    wifi_init_sta();
+
+    bench_event_group = xEventGroupCreate();
+    inflight_sem = xSemaphoreCreateCounting(BENCH_MAX_INFLIGHT, 0);
+    memset(payload, 0x55, sizeof(payload));
+
+    esp_mqtt_client_handle_t client = mqtt_app_start();
+    xEventGroupWaitBits(bench_event_group, BENCH_CONNECTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+
+    // 订阅用QoS2，这样收到的消息QoS和发布时一样
+    esp_mqtt_client_subscribe(client, BENCH_TOPIC, 2);
+    xEventGroupWaitBits(bench_event_group, BENCH_SUBSCRIBED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+
+    ESP_LOGI(TAG, "buffer=%d out_buffer=%d outbox_limit=%d task_priority=%d inflight=%d",
+             BENCH_BUFFER_SIZE, BENCH_OUT_BUFFER_SIZE, BENCH_OUTBOX_LIMIT, BENCH_TASK_PRIORITY, BENCH_MAX_INFLIGHT);
+    for (int qos = 0; qos <= 2; qos++)
+    {
+        for (int i = 0; i < (int)(sizeof(bench_sizes) / sizeof(bench_sizes[0])); i++)
+        {
+            bench_run(client, qos, bench_sizes[i]);
+            // 让上一轮迟到的消息和确认都处理完
+            vTaskDelay(pdMS_TO_TICKS(500));
+        }
+    }
+    ESP_LOGI(TAG, "min free heap since boot %" PRIu32, esp_get_minimum_free_heap_size());
+}
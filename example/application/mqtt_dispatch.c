@@ -0,0 +1,412 @@
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+#include "lwip/netdb.h"
+#include "lwip/dns.h"
+#include "sdkconfig.h"
+#include "mqtt_client.h"
+
+/*这里配置wifi的ssid与密码*/
+#define wifi_ssid "test_wifi"
+#define wifi_passwd "12345678910"
+
+static const char *TAG = "example";
+
+/*
+这里两个函数是连接wifi的
+*/
+void sta_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    // wifi事件组中连接wifi和连接wifi失败两个事件
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
+    {
+        // 连接wifi
+        esp_wifi_connect();
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        ESP_LOGW(TAG, "connected failed! retrying...");
+        esp_wifi_connect();
+    }
+
+    // ip事件组中获取到ip
+    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+    {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        ESP_LOGI("TEST_ESP32", "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+    }
+}
+
+void wifi_init_sta(void)
+{
+    /*初始化"网卡"，前面已经完成了所以这里不需要*/
+    // esp_netif_init();
+    // esp_event_loop_create_default();
+    esp_netif_create_default_wifi_sta();
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    esp_wifi_init(&cfg);
+
+    // 为WIFI事件组中所有事件注册回调函数
+    esp_event_handler_instance_register(WIFI_EVENT,
+                                        ESP_EVENT_ANY_ID,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+    // 为IP事件组中获取IP注册回调函数，注意这两个是不同的事件组
+    esp_event_handler_instance_register(IP_EVENT,
+                                        IP_EVENT_STA_GOT_IP,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+
+    // 配置sta连接的ap的ssid和passwd，并启动wifi
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = wifi_ssid,
+            .password = wifi_passwd,
+        },
+    };
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_start();
+
+    ESP_LOGI(TAG, "wifi_init_sta finished.");
+}
+
+/*
+topic分发：
+订阅了几百个设备topic时，如果在MQTT_EVENT_DATA里逐个strncmp，
+事件任务的时间基本都花在字符串比较上。
+这里把订阅的topic过滤器(支持+和#通配符)按层级建成一棵前缀树，
+收到消息时按层查找，每一层通过哈希表直接找到子节点，耗时只和topic的层数有关，
+并且直接使用event->topic和event->data，不做拷贝
+*/
+
+#define DISPATCH_MAX_NODES 1024   // 前缀树最多的节点数，每个不同的层级占一个，每个约16字节
+#define DISPATCH_MAX_HANDLERS 512 // 最多注册的handler数
+#define DISPATCH_HASH_SIZE 2048   // 子节点哈希表大小，2的幂，至少是节点数的两倍
+#define DISPATCH_MAX_DEPTH 16     // topic最多的层数
+
+/* 收到消息时的回调，topic和data都不是'\0'结尾的，要用长度 */
+typedef void (*mqtt_topic_handler_t)(const char *topic, int topic_len, const char *data, int data_len, void *arg);
+
+typedef struct
+{
+    mqtt_topic_handler_t handler;
+    void *arg;
+    int16_t next; // 同一个节点上的下一个handler，-1表示没有
+} dispatch_handler_t;
+
+typedef struct
+{
+    const char *level;  // 这一层的名字，只在建树时分配一次
+    uint8_t level_len;
+    int16_t parent;
+    int16_t plus;       // '+'子节点，-1表示没有
+    int16_t handlers;   // 完全匹配到这里的handler链表
+    int16_t hash_handlers; // '#'匹配的handler链表，'#'只能在最后一层，所以直接挂在父节点上
+} dispatch_node_t;
+
+static dispatch_node_t nodes[DISPATCH_MAX_NODES];
+static int node_count;
+static dispatch_handler_t handlers[DISPATCH_MAX_HANDLERS];
+static int handler_count;
+// 子节点哈希表，存放节点下标+1，0表示空
+static int16_t child_table[DISPATCH_HASH_SIZE];
+
+/* (父节点, 层级名)的哈希，FNV-1a */
+static uint32_t dispatch_hash(int parent, const char *level, int len)
+{
+    uint32_t h = 2166136261u ^ (uint32_t)parent;
+    for (int i = 0; i < len; i++)
+    {
+        h ^= (uint8_t)level[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* 在父节点下查找名字为level的子节点，找不到返回-1 */
+static int dispatch_find_child(int parent, const char *level, int len)
+{
+    uint32_t i = dispatch_hash(parent, level, len) & (DISPATCH_HASH_SIZE - 1);
+    // 线性探测
+    while (child_table[i] != 0)
+    {
+        dispatch_node_t *n = &nodes[child_table[i] - 1];
+        if (n->parent == parent && n->level_len == len && memcmp(n->level, level, len) == 0)
+            return child_table[i] - 1;
+        i = (i + 1) & (DISPATCH_HASH_SIZE - 1);
+    }
+    return -1;
+}
+
+static int dispatch_new_node(int parent, const char *level, int len)
+{
+    if (node_count >= DISPATCH_MAX_NODES)
+        return -1;
+    // 根节点和"/topic"这种空的层级不用分配，esp-idf的malloc(0)会返回NULL
+    const char *name = "";
+    if (len > 0)
+    {
+        char *buf = malloc(len);
+        if (buf == NULL)
+            return -1;
+        memcpy(buf, level, len);
+        name = buf;
+    }
+    int idx = node_count++;
+    nodes[idx] = (dispatch_node_t){
+        .level = name,
+        .level_len = len,
+        .parent = parent,
+        .plus = -1,
+        .handlers = -1,
+        .hash_handlers = -1,
+    };
+    return idx;
+}
+
+/* 找到或者新建一个子节点 */
+static int dispatch_get_child(int parent, const char *level, int len)
+{
+    int idx = dispatch_find_child(parent, level, len);
+    if (idx >= 0)
+        return idx;
+    // 节点数限制在哈希表的一半以内，保证探测链不会太长
+    if (node_count >= DISPATCH_HASH_SIZE / 2)
+        return -1;
+    idx = dispatch_new_node(parent, level, len);
+    if (idx < 0)
+        return -1;
+    uint32_t i = dispatch_hash(parent, level, len) & (DISPATCH_HASH_SIZE - 1);
+    while (child_table[i] != 0)
+        i = (i + 1) & (DISPATCH_HASH_SIZE - 1);
+    child_table[i] = idx + 1;
+    return idx;
+}
+
+static esp_err_t dispatch_push_handler(int16_t *list, mqtt_topic_handler_t handler, void *arg)
+{
+    if (handler_count >= DISPATCH_MAX_HANDLERS)
+        return ESP_ERR_NO_MEM;
+    handlers[handler_count] = (dispatch_handler_t){.handler = handler, .arg = arg, .next = *list};
+    *list = handler_count++;
+    return ESP_OK;
+}
+
+/* 初始化，创建根节点，失败的话不能注册 */
+esp_err_t mqtt_dispatch_init(void)
+{
+    node_count = 0;
+    handler_count = 0;
+    memset(child_table, 0, sizeof(child_table));
+    return dispatch_new_node(-1, "", 0) == 0 ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+/*
+注册一个topic过滤器，比如 "device/+/status"、"device/12/#"
+只在初始化时调用，不要和mqtt_dispatch同时调用
+*/
+esp_err_t mqtt_dispatch_register(const char *filter, mqtt_topic_handler_t handler, void *arg)
+{
+    int node = 0;
+    const char *p = filter;
+    while (1)
+    {
+        const char *slash = strchr(p, '/');
+        int len = slash ? (int)(slash - p) : (int)strlen(p);
+
+        if (len == 1 && p[0] == '#')
+        {
+            // '#'必须是最后一层
+            if (slash)
+                return ESP_ERR_INVALID_ARG;
+            return dispatch_push_handler(&nodes[node].hash_handlers, handler, arg);
+        }
+        if (len == 1 && p[0] == '+')
+        {
+            if (nodes[node].plus < 0)
+            {
+                int idx = dispatch_new_node(node, "+", 1);
+                if (idx < 0)
+                    return ESP_ERR_NO_MEM;
+                nodes[node].plus = idx;
+            }
+            node = nodes[node].plus;
+        }
+        else
+        {
+            if (len > 255 || memchr(p, '+', len) || memchr(p, '#', len))
+                return ESP_ERR_INVALID_ARG;
+            node = dispatch_get_child(node, p, len);
+            if (node < 0)
+                return ESP_ERR_NO_MEM;
+        }
+
+        if (!slash)
+            break;
+        p = slash + 1;
+    }
+    return dispatch_push_handler(&nodes[node].handlers, handler, arg);
+}
+
+static void dispatch_call(int list, const char *topic, int topic_len, const char *data, int data_len)
+{
+    for (int i = list; i >= 0; i = handlers[i].next)
+        handlers[i].handler(topic, topic_len, data, data_len, handlers[i].arg);
+}
+
+/*
+从node开始匹配第level层及以后的部分，
+每一层可能同时走精确匹配和'+'两条路，所以用递归
+*/
+static void dispatch_match(int node, const char *const *starts, const int *lens, int level, int depth,
+                           const char *topic, int topic_len, const char *data, int data_len)
+{
+    // '#'匹配当前层及以后的所有层(包括0层，"a/#"也匹配"a")
+    // 以'$'开头的topic(比如$SYS)第一层不匹配通配符
+    bool sys = level == 0 && depth > 0 && starts[0][0] == '$';
+    if (!sys)
+        dispatch_call(nodes[node].hash_handlers, topic, topic_len, data, data_len);
+
+    if (level == depth)
+    {
+        dispatch_call(nodes[node].handlers, topic, topic_len, data, data_len);
+        return;
+    }
+
+    int child = dispatch_find_child(node, starts[level], lens[level]);
+    if (child >= 0)
+        dispatch_match(child, starts, lens, level + 1, depth, topic, topic_len, data, data_len);
+    if (nodes[node].plus >= 0 && !sys)
+        dispatch_match(nodes[node].plus, starts, lens, level + 1, depth, topic, topic_len, data, data_len);
+}
+
+/* 把一条消息分发给所有匹配的handler，返回topic的层数，topic非法返回-1 */
+int mqtt_dispatch(const char *topic, int topic_len, const char *data, int data_len)
+{
+    // 先把topic按'/'切开，只记录每层的起始位置和长度，不拷贝
+    const char *starts[DISPATCH_MAX_DEPTH];
+    int lens[DISPATCH_MAX_DEPTH];
+    int depth = 0;
+    const char *p = topic;
+    const char *end = topic + topic_len;
+    while (1)
+    {
+        if (depth == DISPATCH_MAX_DEPTH)
+            return -1;
+        const char *slash = memchr(p, '/', end - p);
+        starts[depth] = p;
+        lens[depth] = slash ? slash - p : end - p;
+        depth++;
+        if (!slash)
+            break;
+        p = slash + 1;
+    }
+
+    dispatch_match(0, starts, lens, 0, depth, topic, topic_len, data, data_len);
+    return depth;
+}
+
+/******************************示例handler******************************/
+
+static void device_status_handler(const char *topic, int topic_len, const char *data, int data_len, void *arg)
+{
+    ESP_LOGI(TAG, "status %.*s: %.*s", topic_len, topic, data_len, data);
+}
+
+static void device_config_handler(const char *topic, int topic_len, const char *data, int data_len, void *arg)
+{
+    ESP_LOGI(TAG, "config %.*s: %.*s", topic_len, topic, data_len, data);
+}
+
+static void log_all_handler(const char *topic, int topic_len, const char *data, int data_len, void *arg)
+{
+    int *count = (int *)arg;
+    (*count)++;
+}
+
+static int message_count;
+
+/* 订阅的topic过滤器，连接上之后逐个订阅，同时注册到分发器里 */
+static const struct
+{
+    const char *filter;
+    mqtt_topic_handler_t handler;
+    void *arg;
+} subscriptions[] = {
+    {"device/+/status", device_status_handler, NULL},
+    {"device/+/config/#", device_config_handler, NULL},
+    {"#", log_all_handler, &message_count},
+};
+
+/*mqtt事件回调函数*/
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    esp_mqtt_event_handle_t event = event_data;
+    esp_mqtt_client_handle_t client = event->client;
+
+    switch ((esp_mqtt_event_id_t)event_id)
+    {
+    case MQTT_EVENT_CONNECTED:
+        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+        for (int i = 0; i < sizeof(subscriptions) / sizeof(subscriptions[0]); i++)
+            esp_mqtt_client_subscribe(client, subscriptions[i].filter, 0);
+        break;
+    case MQTT_EVENT_DATA:
+        // 消息被分片时只有第一片带topic，分片的处理参考MQTT分片重组的例子
+        if (event->topic_len > 0)
+            mqtt_dispatch(event->topic, event->topic_len, event->data, event->data_len);
+        break;
+    default:
+        break;
+    }
+}
+
+/*初始化mqtt，并返回一个mqtt的handler*/
+static esp_mqtt_client_handle_t mqtt_app_start(void)
+{
+    esp_mqtt_client_config_t mqtt_cfg = {
+        .broker.address.uri = "mqtt://192.168.43.65",
+        .broker.address.port = 1883,
+        .credentials.username = "admin",
+        .credentials.client_id = "public",
+        .credentials.authentication.password = "12345678910"};
+    esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
+    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+    esp_mqtt_client_start(client);
+    return client;
+}
+
+void app_main(void)
+{
+    nvs_flash_init();
+    esp_netif_init();
+    esp_event_loop_create_default();
+
+    /*分发器要在mqtt启动之前建好*/
+    if (mqtt_dispatch_init() != ESP_OK)
+        return;
+    for (int i = 0; i < sizeof(subscriptions) / sizeof(subscriptions[0]); i++)
+    {
+        if (mqtt_dispatch_register(subscriptions[i].filter, subscriptions[i].handler, subscriptions[i].arg) != ESP_OK)
+            ESP_LOGE(TAG, "register %s failed", subscriptions[i].filter);
+    }
+
+    /*先连接wifi*/
+    wifi_init_sta();
+    vTaskDelay(3000 / portTICK_PERIOD_MS);
+
+    /*启动mqtt-client*/
+    mqtt_app_start();
+}
@@ -0,0 +1,575 @@
+#include <string.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+#include "lwip/netdb.h"
+#include "lwip/dns.h"
+#include "sdkconfig.h"
+#include "mqtt_client.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+/*这里配置wifi的ssid与密码*/
+#define wifi_ssid "test_wifi"
+#define wifi_passwd "12345678910"
+
+static const char *TAG = "example";
+
+/*
+这里两个函数是连接wifi的
+*/
+void sta_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    // wifi事件组中连接wifi和连接wifi失败两个事件
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
+    {
+        // 连接wifi
+        esp_wifi_connect();
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        ESP_LOGW(TAG, "connected failed! retrying...");
+        esp_wifi_connect();
+    }
+
+    // ip事件组中获取到ip
+    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+    {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        ESP_LOGI("TEST_ESP32", "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+    }
+}
+
+void wifi_init_sta(void)
+{
+    /*初始化"网卡"，前面已经完成了所以这里不需要*/
+    // esp_netif_init();
+    // esp_event_loop_create_default();
+    esp_netif_create_default_wifi_sta();
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    esp_wifi_init(&cfg);
+
+    // 为WIFI事件组中所有事件注册回调函数
+    esp_event_handler_instance_register(WIFI_EVENT,
+                                        ESP_EVENT_ANY_ID,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+    // 为IP事件组中获取IP注册回调函数，注意这两个是不同的事件组
+    esp_event_handler_instance_register(IP_EVENT,
+                                        IP_EVENT_STA_GOT_IP,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+
+    // 配置sta连接的ap的ssid和passwd，并启动wifi
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = wifi_ssid,
+            .password = wifi_passwd,
+        },
+    };
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_start();
+
+    ESP_LOGI(TAG, "wifi_init_sta finished.");
+}
+
+/*
+MQTT离线缓存：
+wifi断开时esp_mqtt_client_publish发出的消息都会丢掉。
+这里在flash上单独划一个分区，当作只追加的日志来存消息，
+断线期间的消息都写到日志里，MQTT_EVENT_CONNECTED之后再按顺序、按固定速率重发，
+收到确认的消息会被标记，整个扇区都确认完之后擦除回收。
+
+需要在partitions.csv中加一个分区，比如：
+# Name,   Type, SubType, Offset,  Size
+outbox,   data, 0x40,    ,        64K
+*/
+
+#define OUTBOX_PARTITION "outbox"
+#define OUTBOX_MAX_SECTORS 64          // 分区最多多少个扇区，64K分区是16个
+#define OUTBOX_MAX_RECORD 512          // 单条消息(topic+data)的最大长度
+#define OUTBOX_INFLIGHT 4              // 重发时最多几条QoS1消息在等待确认
+#define OUTBOX_REPLAY_INTERVAL_MS 20   // 重发的间隔，防止重连后一下子把broker和wifi打满
+
+#define OUTBOX_MAGIC 0xA55A
+/*
+NOR flash写入只能把1变成0，所以状态按位递减，不擦除也能改状态
+*/
+#define OUTBOX_STATE_WRITING 0xFFFE // 头部写了，数据可能没写完(写的时候掉电)
+#define OUTBOX_STATE_VALID 0xFFFC   // 完整的消息，等待发送
+#define OUTBOX_STATE_ACKED 0xFFF8   // 已经发送成功
+
+typedef struct
+{
+    uint16_t magic;
+    uint16_t state;
+    uint32_t seq;
+    uint16_t topic_len;
+    uint16_t data_len;
+    uint8_t qos;
+    uint8_t reserved[3];
+    uint32_t crc; // topic+data的crc
+} outbox_hdr_t;
+
+#define OUTBOX_ALIGN(x) (((x) + 3) & ~3)
+
+static const esp_partition_t *ob_part;
+static int ob_sectors;
+static uint16_t ob_pending[OUTBOX_MAX_SECTORS]; // 每个扇区中还没确认的消息数
+static int ob_head_sector;   // 正在写的扇区
+static uint32_t ob_head_off; // 写的位置
+static int ob_tail_sector;   // 最老的有数据的扇区
+static int ob_read_sector;   // 下一条要重发的消息
+static uint32_t ob_read_off;
+static uint32_t ob_next_seq;
+static uint32_t ob_count;    // 日志中没确认的消息总数
+static uint32_t ob_dropped;  // 分区满了被丢掉的消息数
+static SemaphoreHandle_t ob_lock;
+
+static esp_mqtt_client_handle_t client;
+static EventGroupHandle_t mqtt_event_group;
+#define MQTT_CONNECTED_BIT BIT0
+
+// 等待确认的消息，msg_id对应日志中的位置，都需要持有ob_lock访问
+#define OB_SLOT_FREE -1
+#define OB_SLOT_RESERVED 0 // 重发任务正在发送，还没拿到msg_id
+static struct
+{
+    int msg_id;
+    uint32_t pos;
+    uint32_t seq;
+} ob_inflight[OUTBOX_INFLIGHT];
+// PUBACK可能在esp_mqtt_client_publish返回之前就到了，这时还对不上msg_id，先记下来
+static int ob_early_ack = -1;
+
+static uint32_t ob_pos(int sector, uint32_t off)
+{
+    return sector * SPI_FLASH_SEC_SIZE + off;
+}
+
+static void ob_set_state(uint32_t pos, uint16_t state)
+{
+    esp_partition_write(ob_part, pos + offsetof(outbox_hdr_t, state), &state, sizeof(state));
+}
+
+/* 擦除最老的扇区，如果里面还有没确认的消息就算作丢弃，需要持有锁 */
+static void ob_drop_tail(void)
+{
+    ob_dropped += ob_pending[ob_tail_sector];
+    ob_count -= ob_pending[ob_tail_sector];
+    ob_pending[ob_tail_sector] = 0;
+    esp_partition_erase_range(ob_part, ob_pos(ob_tail_sector, 0), SPI_FLASH_SEC_SIZE);
+    // 这个扇区里等待确认的消息也不用再管了
+    for (int i = 0; i < OUTBOX_INFLIGHT; i++)
+    {
+        if (ob_inflight[i].msg_id != OB_SLOT_FREE && ob_inflight[i].pos / SPI_FLASH_SEC_SIZE == ob_tail_sector)
+            ob_inflight[i].msg_id = OB_SLOT_FREE;
+    }
+    if (ob_read_sector == ob_tail_sector)
+    {
+        ob_read_sector = (ob_tail_sector + 1) % ob_sectors;
+        ob_read_off = 0;
+    }
+    ob_tail_sector = (ob_tail_sector + 1) % ob_sectors;
+}
+
+/* 从尾部开始回收已经全部确认的扇区，需要持有锁 */
+static void ob_compact(void)
+{
+    while (ob_tail_sector != ob_head_sector && ob_pending[ob_tail_sector] == 0 && ob_read_sector != ob_tail_sector)
+    {
+        esp_partition_erase_range(ob_part, ob_pos(ob_tail_sector, 0), SPI_FLASH_SEC_SIZE);
+        ob_tail_sector = (ob_tail_sector + 1) % ob_sectors;
+    }
+    // 全部确认完了，从头开始写，减少擦除次数
+    if (ob_count == 0 && ob_tail_sector == ob_head_sector && ob_read_sector == ob_head_sector && ob_read_off == ob_head_off)
+    {
+        esp_partition_erase_range(ob_part, ob_pos(ob_head_sector, 0), SPI_FLASH_SEC_SIZE);
+        ob_head_off = 0;
+        ob_read_off = 0;
+    }
+}
+
+/* 把一条消息追加到日志末尾 */
+static esp_err_t ob_append(const char *topic, const char *data, int len, int qos)
+{
+    size_t topic_len = strlen(topic);
+    if (topic_len + len > OUTBOX_MAX_RECORD)
+        return ESP_ERR_INVALID_SIZE;
+    uint32_t size = OUTBOX_ALIGN(sizeof(outbox_hdr_t) + topic_len + len);
+
+    xSemaphoreTake(ob_lock, portMAX_DELAY);
+    // 当前扇区放不下，换到下一个扇区，消息不跨扇区
+    if (ob_head_off + size > SPI_FLASH_SEC_SIZE)
+    {
+        int next = (ob_head_sector + 1) % ob_sectors;
+        // 分区满了，丢掉最老的扇区
+        if (next == ob_tail_sector)
+        {
+            ESP_LOGW(TAG, "outbox full, dropping %d oldest messages", ob_pending[ob_tail_sector]);
+            ob_drop_tail();
+        }
+        esp_partition_erase_range(ob_part, ob_pos(next, 0), SPI_FLASH_SEC_SIZE);
+        ob_head_sector = next;
+        ob_head_off = 0;
+    }
+
+    outbox_hdr_t hdr = {
+        .magic = OUTBOX_MAGIC,
+        .state = OUTBOX_STATE_WRITING,
+        .seq = ob_next_seq++,
+        .topic_len = topic_len,
+        .data_len = len,
+        .qos = qos,
+    };
+    hdr.crc = esp_rom_crc32_le(0, (const uint8_t *)topic, topic_len);
+    hdr.crc = esp_rom_crc32_le(hdr.crc, (const uint8_t *)data, len);
+
+    // 先写头部和数据，全部写完后再把状态改成VALID，掉电时不会留下半条消息
+    uint32_t pos = ob_pos(ob_head_sector, ob_head_off);
+    esp_partition_write(ob_part, pos, &hdr, sizeof(hdr));
+    esp_partition_write(ob_part, pos + sizeof(hdr), topic, topic_len);
+    esp_partition_write(ob_part, pos + sizeof(hdr) + topic_len, data, len);
+    ob_set_state(pos, OUTBOX_STATE_VALID);
+
+    ob_head_off += size;
+    ob_pending[ob_head_sector]++;
+    ob_count++;
+    xSemaphoreGive(ob_lock);
+    return ESP_OK;
+}
+
+/*
+找到下一条要重发的消息，读出topic和数据，返回它在日志中的位置，没有返回-1
+*/
+static int64_t ob_next(char *topic, char *data, outbox_hdr_t *hdr)
+{
+    int64_t found = -1;
+    xSemaphoreTake(ob_lock, portMAX_DELAY);
+    while (!(ob_read_sector == ob_head_sector && ob_read_off >= ob_head_off))
+    {
+        uint32_t pos = ob_pos(ob_read_sector, ob_read_off);
+        if (ob_read_off + sizeof(*hdr) <= SPI_FLASH_SEC_SIZE)
+            esp_partition_read(ob_part, pos, hdr, sizeof(*hdr));
+        // 扇区剩下的部分没有写过，跳到下一个扇区
+        if (ob_read_off + sizeof(*hdr) > SPI_FLASH_SEC_SIZE || hdr->magic != OUTBOX_MAGIC ||
+            hdr->topic_len + hdr->data_len > OUTBOX_MAX_RECORD)
+        {
+            if (ob_read_sector == ob_head_sector)
+                break;
+            ob_read_sector = (ob_read_sector + 1) % ob_sectors;
+            ob_read_off = 0;
+            continue;
+        }
+        ob_read_off += OUTBOX_ALIGN(sizeof(*hdr) + hdr->topic_len + hdr->data_len);
+        if (hdr->state != OUTBOX_STATE_VALID)
+            continue;
+
+        esp_partition_read(ob_part, pos + sizeof(*hdr), topic, hdr->topic_len);
+        esp_partition_read(ob_part, pos + sizeof(*hdr) + hdr->topic_len, data, hdr->data_len);
+        topic[hdr->topic_len] = '\0';
+        uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)topic, hdr->topic_len);
+        crc = esp_rom_crc32_le(crc, (const uint8_t *)data, hdr->data_len);
+        if (crc != hdr->crc)
+        {
+            // 数据损坏，直接当作已确认
+            ESP_LOGW(TAG, "outbox record %" PRIu32 " corrupted", hdr->seq);
+            ob_set_state(pos, OUTBOX_STATE_ACKED);
+            ob_pending[pos / SPI_FLASH_SEC_SIZE]--;
+            ob_count--;
+            continue;
+        }
+        found = pos;
+        break;
+    }
+    xSemaphoreGive(ob_lock);
+    return found;
+}
+
+/* 标记一条消息已经发送成功，需要持有锁 */
+static void ob_ack_locked(uint32_t pos, uint32_t seq)
+{
+    outbox_hdr_t hdr;
+    // 发送期间这个扇区可能因为分区满被擦掉了，确认一下还是同一条消息
+    esp_partition_read(ob_part, pos, &hdr, sizeof(hdr));
+    if (hdr.magic == OUTBOX_MAGIC && hdr.seq == seq && hdr.state == OUTBOX_STATE_VALID)
+    {
+        ob_set_state(pos, OUTBOX_STATE_ACKED);
+        ob_pending[pos / SPI_FLASH_SEC_SIZE]--;
+        ob_count--;
+        ob_compact();
+    }
+}
+
+/*
+启动时扫描整个分区，恢复写的位置和没确认的消息
+*/
+static esp_err_t outbox_init(void)
+{
+    ob_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, OUTBOX_PARTITION);
+    if (ob_part == NULL)
+    {
+        ESP_LOGE(TAG, "partition %s not found", OUTBOX_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+    ob_sectors = MIN(ob_part->size / SPI_FLASH_SEC_SIZE, OUTBOX_MAX_SECTORS);
+    ob_lock = xSemaphoreCreateMutex();
+
+    bool has_data[OUTBOX_MAX_SECTORS] = {0};
+    uint32_t end_off[OUTBOX_MAX_SECTORS] = {0};
+    uint32_t max_seq = 0;
+    bool any = false;
+
+    for (int s = 0; s < ob_sectors; s++)
+    {
+        uint32_t off = 0;
+        outbox_hdr_t hdr;
+        while (off + sizeof(hdr) <= SPI_FLASH_SEC_SIZE)
+        {
+            esp_partition_read(ob_part, ob_pos(s, off), &hdr, sizeof(hdr));
+            if (hdr.magic != OUTBOX_MAGIC || hdr.topic_len + hdr.data_len > OUTBOX_MAX_RECORD)
+                break;
+            has_data[s] = true;
+            if (hdr.state == OUTBOX_STATE_VALID)
+            {
+                ob_pending[s]++;
+                ob_count++;
+            }
+            if (!any || (int32_t)(hdr.seq - max_seq) > 0)
+            {
+                max_seq = hdr.seq;
+                ob_head_sector = s;
+            }
+            any = true;
+            off += OUTBOX_ALIGN(sizeof(hdr) + hdr.topic_len + hdr.data_len);
+        }
+        // 后面不是擦除状态，说明写头部时掉电了，这个扇区不能再继续写
+        if (off + sizeof(hdr) <= SPI_FLASH_SEC_SIZE && hdr.magic != 0xFFFF)
+            off = SPI_FLASH_SEC_SIZE;
+        end_off[s] = off;
+    }
+
+    if (!any)
+    {
+        // 空的分区，整个擦一遍
+        esp_partition_erase_range(ob_part, 0, ob_sectors * SPI_FLASH_SEC_SIZE);
+        ob_head_sector = ob_tail_sector = ob_read_sector = 0;
+        ob_head_off = ob_read_off = 0;
+        ob_next_seq = 0;
+        return ESP_OK;
+    }
+
+    // 按环形顺序，写入扇区的下一个有数据的扇区就是最老的
+    ob_head_off = end_off[ob_head_sector];
+    ob_next_seq = max_seq + 1;
+    ob_tail_sector = ob_head_sector;
+    for (int i = 1; i < ob_sectors; i++)
+    {
+        int s = (ob_head_sector + i) % ob_sectors;
+        if (has_data[s])
+        {
+            ob_tail_sector = s;
+            break;
+        }
+    }
+    ob_read_sector = ob_tail_sector;
+    ob_read_off = 0;
+
+    xSemaphoreTake(ob_lock, portMAX_DELAY);
+    ob_compact();
+    xSemaphoreGive(ob_lock);
+    ESP_LOGI(TAG, "outbox recovered %" PRIu32 " messages", ob_count);
+    return ESP_OK;
+}
+
+/*
+发送消息：连接正常并且日志为空时直接发送，
+否则追加到日志中，等重连后按顺序重发
+*/
+esp_err_t outbox_publish(const char *topic, const char *data, int len, int qos)
+{
+    if (len == 0)
+        len = strlen(data);
+    bool connected = xEventGroupGetBits(mqtt_event_group) & MQTT_CONNECTED_BIT;
+    xSemaphoreTake(ob_lock, portMAX_DELAY);
+    bool empty = ob_count == 0;
+    xSemaphoreGive(ob_lock);
+    if (connected && empty && esp_mqtt_client_publish(client, topic, data, len, qos, 0) >= 0)
+        return ESP_OK;
+    return ob_append(topic, data, len, qos);
+}
+
+/* 断线后重新从最老的没确认的消息开始发 */
+static void outbox_rewind(void)
+{
+    xSemaphoreTake(ob_lock, portMAX_DELAY);
+    ob_read_sector = ob_tail_sector;
+    ob_read_off = 0;
+    for (int i = 0; i < OUTBOX_INFLIGHT; i++)
+        ob_inflight[i].msg_id = OB_SLOT_FREE;
+    ob_early_ack = -1;
+    xSemaphoreGive(ob_lock);
+}
+
+/* 收到PUBACK时调用 */
+static void outbox_on_published(int msg_id)
+{
+    if (msg_id <= 0)
+        return;
+    xSemaphoreTake(ob_lock, portMAX_DELAY);
+    for (int i = 0; i < OUTBOX_INFLIGHT; i++)
+    {
+        if (ob_inflight[i].msg_id == msg_id)
+        {
+            ob_inflight[i].msg_id = OB_SLOT_FREE;
+            ob_ack_locked(ob_inflight[i].pos, ob_inflight[i].seq);
+            xSemaphoreGive(ob_lock);
+            return;
+        }
+    }
+    // 对不上的可能是直接发送的消息，也可能是重发任务还没来得及记下msg_id
+    ob_early_ack = msg_id;
+    xSemaphoreGive(ob_lock);
+}
+
+/* 重发任务：连上之后把日志中的消息按顺序、按固定间隔发出去 */
+static void outbox_replay_task(void *pvParam)
+{
+    static char topic[OUTBOX_MAX_RECORD + 1];
+    static char data[OUTBOX_MAX_RECORD];
+    outbox_hdr_t hdr;
+    while (1)
+    {
+        xEventGroupWaitBits(mqtt_event_group, MQTT_CONNECTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+
+        // 找一个空闲的等待确认的位置，先占住，发送期间不会被别人拿走
+        int slot = -1;
+        xSemaphoreTake(ob_lock, portMAX_DELAY);
+        for (int i = 0; i < OUTBOX_INFLIGHT; i++)
+        {
+            if (ob_inflight[i].msg_id == OB_SLOT_FREE)
+                slot = i;
+        }
+        if (slot >= 0)
+            ob_inflight[slot].msg_id = OB_SLOT_RESERVED;
+        xSemaphoreGive(ob_lock);
+
+        int64_t pos = slot >= 0 ? ob_next(topic, data, &hdr) : -1;
+        if (pos < 0)
+        {
+            if (slot >= 0)
+            {
+                xSemaphoreTake(ob_lock, portMAX_DELAY);
+                if (ob_inflight[slot].msg_id == OB_SLOT_RESERVED)
+                    ob_inflight[slot].msg_id = OB_SLOT_FREE;
+                xSemaphoreGive(ob_lock);
+            }
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        xSemaphoreTake(ob_lock, portMAX_DELAY);
+        ob_inflight[slot].pos = pos;
+        ob_inflight[slot].seq = hdr.seq;
+        ob_early_ack = -1;
+        xSemaphoreGive(ob_lock);
+
+        // 发送时不能持有ob_lock，esp-mqtt派发事件时持有client的锁，反过来拿会死锁
+        int msg_id = esp_mqtt_client_publish(client, topic, data, hdr.data_len, hdr.qos, 0);
+        if (msg_id < 0)
+        {
+            // 发送失败(多半是又断线了)，等重连后从头再来
+            outbox_rewind();
+            vTaskDelay(pdMS_TO_TICKS(OUTBOX_REPLAY_INTERVAL_MS));
+            continue;
+        }
+
+        xSemaphoreTake(ob_lock, portMAX_DELAY);
+        // 发送期间断线重连或者扇区被擦掉时这个位置已经被释放了，消息会重新发
+        if (ob_inflight[slot].msg_id == OB_SLOT_RESERVED)
+        {
+            if (hdr.qos == 0 || ob_early_ack == msg_id)
+            {
+                // QoS0没有确认，写进socket就算成功；PUBACK已经先到了也直接确认
+                ob_inflight[slot].msg_id = OB_SLOT_FREE;
+                ob_ack_locked(pos, hdr.seq);
+            }
+            else
+                ob_inflight[slot].msg_id = msg_id;
+        }
+        xSemaphoreGive(ob_lock);
+        vTaskDelay(pdMS_TO_TICKS(OUTBOX_REPLAY_INTERVAL_MS));
+    }
+}
+
+/*mqtt事件回调函数*/
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    esp_mqtt_event_handle_t event = event_data;
+
+    switch ((esp_mqtt_event_id_t)event_id)
+    {
+    case MQTT_EVENT_CONNECTED:
+        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED, %" PRIu32 " messages to replay", ob_count);
+        outbox_rewind();
+        xEventGroupSetBits(mqtt_event_group, MQTT_CONNECTED_BIT);
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        xEventGroupClearBits(mqtt_event_group, MQTT_CONNECTED_BIT);
+        break;
+    case MQTT_EVENT_PUBLISHED:
+        outbox_on_published(event->msg_id);
+        break;
+    default:
+        break;
+    }
+}
+
+void app_main(void)
+{
+    nvs_flash_init();
+    esp_netif_init();
+    esp_event_loop_create_default();
+
+    mqtt_event_group = xEventGroupCreate();
+    if (outbox_init() != ESP_OK)
+        return;
+    outbox_rewind();
+    xTaskCreate(outbox_replay_task, "outbox_replay", 4096, NULL, 5, NULL);
+
+    /*先连接wifi*/
+    wifi_init_sta();
+
+    esp_mqtt_client_config_t mqtt_cfg = {
+        .broker.address.uri = "mqtt://192.168.43.65",
+        .broker.address.port = 1883,
+        .credentials.username = "admin",
+        .credentials.client_id = "public",
+        .credentials.authentication.password = "12345678910"};
+    client = esp_mqtt_client_init(&mqtt_cfg);
+    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+    esp_mqtt_client_start(client);
+
+    // 不管有没有连上都直接发，断线期间的消息会先存到flash里
+    char payload[32];
+    for (int i = 0;; i++)
+    {
+        int len = snprintf(payload, sizeof(payload), "%d", i);
+        outbox_publish("telemetry/counter", payload, len, 1);
+        vTaskDelay(1000 / portTICK_PERIOD_MS);
+    }
+}
@@ -0,0 +1,403 @@
+#include <string.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+#include "lwip/netdb.h"
+#include "lwip/dns.h"
+#include "sdkconfig.h"
+#include "mqtt_client.h"
+
+/*这里配置wifi的ssid与密码*/
+#define wifi_ssid "test_wifi"
+#define wifi_passwd "12345678910"
+
+static const char *TAG = "example";
+
+/*
+这里两个函数是连接wifi的
+*/
+void sta_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    // wifi事件组中连接wifi和连接wifi失败两个事件
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
+    {
+        // 连接wifi
+        esp_wifi_connect();
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        ESP_LOGW(TAG, "connected failed! retrying...");
+        esp_wifi_connect();
+    }
+
+    // ip事件组中获取到ip
+    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+    {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        ESP_LOGI("TEST_ESP32", "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+    }
+}
+
+void wifi_init_sta(void)
+{
+    /*初始化"网卡"，前面已经完成了所以这里不需要*/
+    // esp_netif_init();
+    // esp_event_loop_create_default();
+    esp_netif_create_default_wifi_sta();
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    esp_wifi_init(&cfg);
+
+    // 为WIFI事件组中所有事件注册回调函数
+    esp_event_handler_instance_register(WIFI_EVENT,
+                                        ESP_EVENT_ANY_ID,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+    // 为IP事件组中获取IP注册回调函数，注意这两个是不同的事件组
+    esp_event_handler_instance_register(IP_EVENT,
+                                        IP_EVENT_STA_GOT_IP,
+                                        &sta_event_handler,
+                                        NULL,
+                                        NULL);
+
+    // 配置sta连接的ap的ssid和passwd，并启动wifi
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = wifi_ssid,
+            .password = wifi_passwd,
+        },
+    };
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_start();
+
+    ESP_LOGI(TAG, "wifi_init_sta finished.");
+}
+
+/*
+MQTT分片消息重组：
+payload比mqtt的接收缓冲区(buffer.size)大时，一条消息会分成多次MQTT_EVENT_DATA，
+每次带current_data_offset和total_data_len，只有第一片带topic。
+这里把分片拼回完整的消息，放到缓冲池里交给处理任务，
+单条消息和所有消息占用的内存都有上限，超过单条上限的消息不缓存，
+而是按片直接交给sink回调(比如边收边写flash)
+*/
+
+#define REASM_TOPIC_MAX 64        // topic最大长度
+#define REASM_SLOTS 4             // 最多同时持有几条完整消息(包括正在重组的)
+#define REASM_MSG_MAX (16 * 1024) // 单条消息最大缓存多少字节，超过的走sink
+#define REASM_TOTAL_MAX (32 * 1024) // 所有缓冲区加起来最多多少字节
+
+typedef enum
+{
+    REASM_FREE,
+    REASM_FILLING, // 正在接收分片
+    REASM_READY,   // 已经交给处理任务，等待release
+} reasm_state_t;
+
+typedef struct
+{
+    reasm_state_t state;
+    char topic[REASM_TOPIC_MAX];
+    int topic_len;
+    char *data;
+    int len;      // 已经收到的长度
+    int total;    // 消息的总长度
+    size_t cap;   // data的容量，release之后缓冲区留着给下一条消息用
+} reasm_msg_t;
+
+/*
+超过REASM_MSG_MAX的消息每收到一片就调用一次，offset+len==total表示最后一片
+消息没收完就被丢掉(分片乱序、来了新消息、断线)时会再调用一次，data为NULL、len为-1，
+sink要在这时丢掉已经写了一半的数据
+*/
+typedef void (*reasm_sink_t)(const char *topic, int topic_len, const char *data, int len, int offset, int total, void *arg);
+
+typedef struct
+{
+    uint32_t messages;  // 重组完成的消息数
+    uint32_t fragments; // 收到的分片数
+    uint32_t streamed;  // 走sink的消息数
+    uint32_t dropped;   // 因为内存不够、分片乱序、队列满而丢掉的消息数
+    size_t mem_peak;    // 缓冲区占用的峰值
+} reasm_stats_t;
+
+static reasm_msg_t reasm_slots[REASM_SLOTS];
+static size_t reasm_mem;           // 当前所有缓冲区的总容量
+static reasm_stats_t reasm_stats;
+static SemaphoreHandle_t reasm_lock;
+static QueueHandle_t reasm_queue;  // 完整的消息通过这个队列交给处理任务
+static reasm_sink_t reasm_sink;
+static void *reasm_sink_arg;
+
+// 当前正在接收的消息，同一条连接上的分片是连续到达的，所以同时只有一条
+static reasm_msg_t *reasm_cur;
+// 当前消息在走sink
+static bool reasm_streaming;
+static char reasm_stream_topic[REASM_TOPIC_MAX];
+static int reasm_stream_topic_len;
+static int reasm_expect_offset;
+
+/*
+给一条total字节的消息找一个槽和缓冲区，需要持有锁
+优先复用容量够的空闲缓冲区，内存不够时先释放其他空闲槽缓存的缓冲区
+*/
+static reasm_msg_t *reasm_alloc(int total)
+{
+    // 先找容量够的空闲槽里最小的一个，直接复用
+    reasm_msg_t *fit = NULL;
+    reasm_msg_t *spare = NULL;
+    for (int i = 0; i < REASM_SLOTS; i++)
+    {
+        reasm_msg_t *m = &reasm_slots[i];
+        if (m->state != REASM_FREE)
+            continue;
+        if (m->cap >= (size_t)total && (fit == NULL || m->cap < fit->cap))
+            fit = m;
+        if (spare == NULL)
+            spare = m;
+    }
+    if (fit)
+        return fit;
+    if (spare == NULL)
+        return NULL;
+
+    // 没有合适的，释放空闲槽缓存的缓冲区腾出内存，再重新分配
+    for (int i = 0; i < REASM_SLOTS; i++)
+    {
+        reasm_msg_t *m = &reasm_slots[i];
+        if (m->state == REASM_FREE && m->data && (m == spare || reasm_mem + total > REASM_TOTAL_MAX))
+        {
+            reasm_mem -= m->cap;
+            free(m->data);
+            m->data = NULL;
+            m->cap = 0;
+        }
+    }
+    if (reasm_mem + total > REASM_TOTAL_MAX)
+        return NULL;
+
+    spare->data = malloc(total);
+    if (spare->data == NULL)
+        return NULL;
+    spare->cap = total;
+    reasm_mem += total;
+    reasm_stats.mem_peak = MAX(reasm_stats.mem_peak, reasm_mem);
+    return spare;
+}
+
+/* 处理任务用完消息后调用，缓冲区留在池里 */
+void mqtt_reasm_release(reasm_msg_t *msg)
+{
+    xSemaphoreTake(reasm_lock, portMAX_DELAY);
+    msg->state = REASM_FREE;
+    xSemaphoreGive(reasm_lock);
+}
+
+/* 丢掉当前正在接收的消息，走sink的消息要通知sink */
+static void reasm_abort(void)
+{
+    if (reasm_cur)
+        mqtt_reasm_release(reasm_cur);
+    if (reasm_streaming)
+        reasm_sink(reasm_stream_topic, reasm_stream_topic_len, NULL, -1, reasm_expect_offset, -1, reasm_sink_arg);
+    reasm_cur = NULL;
+    reasm_streaming = false;
+    reasm_stats.dropped++;
+}
+
+/* 在MQTT_EVENT_DISCONNECTED中调用，断线后没收完的消息不会再有后续分片 */
+void mqtt_reasm_reset(void)
+{
+    if (reasm_cur || reasm_streaming)
+        reasm_abort();
+    reasm_expect_offset = -1;
+}
+
+/*
+在MQTT_EVENT_DATA中调用，把分片拼起来
+*/
+void mqtt_reasm_feed(esp_mqtt_event_handle_t event)
+{
+    reasm_stats.fragments++;
+
+    // 第一片：带topic，offset为0
+    if (event->current_data_offset == 0)
+    {
+        // 上一条消息还没收完就来了新消息(比如断线重连)，上一条只能丢掉
+        if (reasm_cur || reasm_streaming)
+            reasm_abort();
+
+        int total = event->total_data_len;
+        int topic_len = MIN(event->topic_len, REASM_TOPIC_MAX);
+        if (total > REASM_MSG_MAX)
+        {
+            reasm_streaming = true;
+            reasm_stats.streamed++;
+            memcpy(reasm_stream_topic, event->topic, topic_len);
+            reasm_stream_topic_len = topic_len;
+        }
+        else
+        {
+            xSemaphoreTake(reasm_lock, portMAX_DELAY);
+            reasm_cur = reasm_alloc(total);
+            if (reasm_cur)
+                reasm_cur->state = REASM_FILLING;
+            xSemaphoreGive(reasm_lock);
+            if (reasm_cur == NULL)
+            {
+                // 内存不够，整条消息都丢掉，后面的分片offset不为0会被忽略
+                reasm_stats.dropped++;
+                reasm_expect_offset = -1;
+                return;
+            }
+            memcpy(reasm_cur->topic, event->topic, topic_len);
+            reasm_cur->topic_len = topic_len;
+            reasm_cur->len = 0;
+            reasm_cur->total = total;
+        }
+        reasm_expect_offset = 0;
+    }
+
+    // 分片必须按顺序连续到达，否则这条消息已经不完整了
+    if (event->current_data_offset != reasm_expect_offset)
+    {
+        if (reasm_cur || reasm_streaming)
+            reasm_abort();
+        return;
+    }
+    // 没有正在接收的消息(比如第一片就因为内存不够丢掉了)
+    if (reasm_cur == NULL && !reasm_streaming)
+        return;
+    reasm_expect_offset += event->data_len;
+
+    if (reasm_streaming)
+    {
+        reasm_sink(reasm_stream_topic, reasm_stream_topic_len, event->data, event->data_len,
+                   event->current_data_offset, event->total_data_len, reasm_sink_arg);
+        if (reasm_expect_offset >= event->total_data_len)
+            reasm_streaming = false;
+        return;
+    }
+
+    if (reasm_cur->len + event->data_len > reasm_cur->total)
+    {
+        reasm_abort();
+        return;
+    }
+    memcpy(reasm_cur->data + reasm_cur->len, event->data, event->data_len);
+    reasm_cur->len += event->data_len;
+
+    // 收完了，交给处理任务
+    if (reasm_cur->len == reasm_cur->total)
+    {
+        reasm_cur->state = REASM_READY;
+        if (xQueueSend(reasm_queue, &reasm_cur, 0) == pdTRUE)
+            reasm_stats.messages++;
+        else
+        {
+            mqtt_reasm_release(reasm_cur);
+            reasm_stats.dropped++;
+        }
+        reasm_cur = NULL;
+    }
+}
+
+void mqtt_reasm_init(reasm_sink_t sink, void *arg)
+{
+    reasm_lock = xSemaphoreCreateMutex();
+    // 队列长度等于槽数，所以只要拿到了槽就一定放得进队列
+    reasm_queue = xQueueCreate(REASM_SLOTS, sizeof(reasm_msg_t *));
+    reasm_sink = sink;
+    reasm_sink_arg = arg;
+}
+
+/******************************使用示例******************************/
+
+/* 超大的消息直接按片处理，比如写到flash的OTA分区 */
+static void big_message_sink(const char *topic, int topic_len, const char *data, int len, int offset, int total, void *arg)
+{
+    if (len < 0)
+    {
+        // 消息没收完，已经写进去的offset字节要作废
+        ESP_LOGW(TAG, "stream %.*s aborted at %d", topic_len, topic, offset);
+        return;
+    }
+    ESP_LOGI(TAG, "stream %.*s %d/%d", topic_len, topic, offset + len, total);
+}
+
+/* 处理完整消息的任务，mqtt事件任务只负责拼接，不会被处理消息的耗时挡住 */
+static void message_task(void *pvParam)
+{
+    reasm_msg_t *msg;
+    while (1)
+    {
+        if (xQueueReceive(reasm_queue, &msg, portMAX_DELAY))
+        {
+            ESP_LOGI(TAG, "message %.*s, %d bytes", msg->topic_len, msg->topic, msg->len);
+            // 用完一定要release，否则缓冲池会被占满
+            mqtt_reasm_release(msg);
+        }
+    }
+}
+
+/*mqtt事件回调函数*/
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    esp_mqtt_event_handle_t event = event_data;
+    esp_mqtt_client_handle_t client = event->client;
+
+    switch ((esp_mqtt_event_id_t)event_id)
+    {
+    case MQTT_EVENT_CONNECTED:
+        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+        esp_mqtt_client_subscribe(client, "device/config", 1);
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        mqtt_reasm_reset();
+        break;
+    case MQTT_EVENT_DATA:
+        // 不论是否分片都交给重组层
+        mqtt_reasm_feed(event);
+        break;
+    default:
+        break;
+    }
+}
+
+void app_main(void)
+{
+    nvs_flash_init();
+    esp_netif_init();
+    esp_event_loop_create_default();
+
+    mqtt_reasm_init(big_message_sink, NULL);
+    xTaskCreate(message_task, "message_task", 4096, NULL, 5, NULL);
+
+    /*先连接wifi*/
+    wifi_init_sta();
+    vTaskDelay(3000 / portTICK_PERIOD_MS);
+
+    esp_mqtt_client_config_t mqtt_cfg = {
+        .broker.address.uri = "mqtt://192.168.43.65",
+        .broker.address.port = 1883,
+        .credentials.username = "admin",
+        .credentials.client_id = "public",
+        .credentials.authentication.password = "12345678910",
+        // 接收缓冲区，payload比这个大时就会分片
+        .buffer.size = 1024};
+    esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
+    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+    esp_mqtt_client_start(client);
+}
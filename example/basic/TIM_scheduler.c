@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gptimer.h"
+#include "esp_random.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+static const char *TAG = "example";
+
+/*
+硬件定时器周期调度的例子：
+TIM_hardware.c一个gptimer只能定一个周期，报警值送到队列里，处理慢了只能打印"Missed one count event"。
+这里一个自动重载的gptimer驱动多个不同周期的任务：
+1. 每个任务有周期和相位偏移，定时器的周期取所有周期和相位的最大公约数，中断里每个任务倒数，到0就通知它
+2. 释放的时间点都是按硬件计数算出来的绝对时间(phase + k*period)，不像vTaskDelay循环那样
+   每次都在上一次执行完的基础上再等，执行时间、被抢占的时间不会累积成漂移
+3. 中断里count_value是报警之后又数了多少，用它把中断延时也算进去，得到理想的释放时间，
+   任务开始执行的时间减去它就是抖动，每个任务一个直方图
+4. 上一次还没执行完又到了释放时间算一次超时(overrun)，这一次直接跳过，后面的释放时间不变
+控制环要求抖动在100us以内，周期短的任务优先级要高(单调速率)
+*/
+
+#define SCHED_MAX_JOBS 8
+#define SCHED_RESOLUTION_HZ 1000000 // 1us/tick
+#define SCHED_MIN_TICK_US 50        // 中断太频繁会把CPU占满
+#define SCHED_JITTER_LIMIT_US 100   // 报告里p99超过这个数会标出来
+
+/******************************抖动直方图******************************/
+
+/*
+和http_server_bench.c里的直方图一样，说明见那里
+抖动一般是几us到几百us，16*16个桶覆盖到0.5s，超过的算在最后一个桶里
+*/
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (16 * HIST_SUB_COUNT)
+
+typedef struct
+{
+    uint32_t buckets[HIST_BUCKETS];
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+} latency_hist_t;
+
+static int hist_index(uint32_t us)
+{
+    if (us < HIST_SUB_COUNT)
+        return us;
+    // 最高位决定区间，后面的4位决定区间内的桶
+    int msb = 31 - __builtin_clz(us);
+    int sub = (us >> (msb - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1);
+    int index = (msb - HIST_SUB_BITS + 1) * HIST_SUB_COUNT + sub;
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+// 返回桶的下界，作为这个桶的代表值
+static uint32_t hist_value(int index)
+{
+    if (index < HIST_SUB_COUNT)
+        return index;
+    int msb = index / HIST_SUB_COUNT + HIST_SUB_BITS - 1;
+    int sub = index % HIST_SUB_COUNT;
+    return (1u << msb) | ((uint32_t)sub << (msb - HIST_SUB_BITS));
+}
+
+static void hist_record(latency_hist_t *h, uint32_t us)
+{
+    h->buckets[hist_index(us)]++;
+    h->count++;
+    h->sum += us;
+    if (us > h->max)
+        h->max = us;
+}
+
+// 分位数，比如p99传入990
+static uint32_t hist_percentile(const latency_hist_t *h, uint32_t permille)
+{
+    uint64_t target = ((uint64_t)h->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= target && seen > 0)
+            return hist_value(i);
+    }
+    return 0;
+}
+
+/******************************调度器******************************/
+
+typedef void (*sched_fn_t)(void *arg);
+
+typedef struct
+{
+    char name[16];
+    sched_fn_t fn;
+    void *arg;
+    uint32_t period_us;
+    uint32_t phase_us;
+    UBaseType_t priority;
+    uint32_t stack_size;
+    TaskHandle_t task;
+    // 中断里用的
+    uint32_t period_ticks;     // 周期是定时器周期的几倍
+    uint32_t countdown;        // 还有几个定时器周期释放
+    volatile bool busy;        // 中断释放时置位，任务执行完清零
+    volatile int64_t release_us; // 理想的释放时间，busy的时候中断不会改它
+    volatile uint32_t overruns;
+    volatile uint32_t releases; // 到了释放时间的次数，包括跳过的，不清零
+    // 任务里用的，打印时在lock里复制
+    portMUX_TYPE lock;
+    latency_hist_t jitter;
+    uint32_t max_exec_us;
+    uint32_t runs;
+} sched_job_t;
+
+static sched_job_t jobs[SCHED_MAX_JOBS];
+static int job_count;
+static gptimer_handle_t sched_timer;
+static int64_t sched_start_us;
+static bool sched_running;
+
+// 每个定时器周期进一次，给到期的任务发通知
+static bool IRAM_ATTR sched_timer_cb(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *user_data)
+{
+    BaseType_t high_task_awoken = pdFALSE;
+    // 自动重载到0，现在的计数就是报警以后过了多少us，减掉就是理想的释放时间
+    int64_t release_us = esp_timer_get_time() - (int64_t)edata->count_value * 1000000 / SCHED_RESOLUTION_HZ;
+    for (int i = 0; i < job_count; i++)
+    {
+        sched_job_t *job = &jobs[i];
+        if (--job->countdown)
+            continue;
+        job->countdown = job->period_ticks;
+        job->releases++;
+        if (job->busy)
+        {
+            // 上一次还没执行完，跳过这一次，下一次还是按原来的相位释放
+            // sched_report会读了再清零，要在lock里加，不然中间加的那次会丢
+            taskENTER_CRITICAL_ISR(&job->lock);
+            job->overruns++;
+            taskEXIT_CRITICAL_ISR(&job->lock);
+            continue;
+        }
+        job->release_us = release_us;
+        job->busy = true;
+        vTaskNotifyGiveFromISR(job->task, &high_task_awoken);
+    }
+    return (high_task_awoken == pdTRUE);
+}
+
+static void sched_job_task(void *param)
+{
+    sched_job_t *job = param;
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int64_t start = esp_timer_get_time();
+        int64_t jitter = start - job->release_us;
+        job->fn(job->arg);
+        uint32_t exec = esp_timer_get_time() - start;
+
+        taskENTER_CRITICAL(&job->lock);
+        // 两个时间读的时候有几us的误差，不会是负数
+        hist_record(&job->jitter, jitter > 0 ? jitter : 0);
+        if (exec > job->max_exec_us)
+            job->max_exec_us = exec;
+        job->runs++;
+        taskEXIT_CRITICAL(&job->lock);
+        job->busy = false;
+    }
+}
+
+/*
+添加一个周期任务，要在sched_start之前调用。
+第一次在phase_us + period_us时执行，之后每period_us执行一次
+*/
+esp_err_t sched_add_job(const char *name, uint32_t period_us, uint32_t phase_us,
+                        sched_fn_t fn, void *arg, UBaseType_t priority, uint32_t stack_size)
+{
+    if (sched_running || period_us == 0 || phase_us >= period_us)
+        return ESP_ERR_INVALID_ARG;
+    if (job_count >= SCHED_MAX_JOBS)
+        return ESP_ERR_NO_MEM;
+    sched_job_t *job = &jobs[job_count];
+    memset(job, 0, sizeof(*job));
+    snprintf(job->name, sizeof(job->name), "%s", name);
+    job->fn = fn;
+    job->arg = arg;
+    job->period_us = period_us;
+    job->phase_us = phase_us;
+    job->priority = priority;
+    job->stack_size = stack_size;
+    portMUX_INITIALIZE(&job->lock);
+    job_count++;
+    return ESP_OK;
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b)
+    {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/*算出定时器周期，创建任务，启动定时器*/
+esp_err_t sched_start(void)
+{
+    if (sched_running || job_count == 0)
+        return ESP_ERR_INVALID_STATE;
+
+    // 定时器周期要能整除所有的周期和相位
+    uint32_t tick = 0;
+    for (int i = 0; i < job_count; i++)
+        tick = gcd(gcd(tick, jobs[i].period_us), jobs[i].phase_us);
+    if (tick < SCHED_MIN_TICK_US)
+    {
+        ESP_LOGE(TAG, "timer period %" PRIu32 "us too short, align periods and phases", tick);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (int i = 0; i < job_count; i++)
+    {
+        sched_job_t *job = &jobs[i];
+        job->period_ticks = job->period_us / tick;
+        job->countdown = (job->phase_us + job->period_us) / tick;
+        if (xTaskCreate(sched_job_task, job->name, job->stack_size, job, job->priority, &job->task) != pdPASS)
+            return ESP_ERR_NO_MEM;
+    }
+
+    gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = SCHED_RESOLUTION_HZ,
+    };
+    ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &sched_timer));
+    gptimer_event_callbacks_t cbs = {
+        .on_alarm = sched_timer_cb,
+    };
+    ESP_ERROR_CHECK(gptimer_register_event_callbacks(sched_timer, &cbs, NULL));
+    ESP_ERROR_CHECK(gptimer_enable(sched_timer));
+    // 硬件自动重载，周期不受中断延时影响
+    gptimer_alarm_config_t alarm_config = {
+        .reload_count = 0,
+        .alarm_count = (uint64_t)tick * SCHED_RESOLUTION_HZ / 1000000,
+        .flags.auto_reload_on_alarm = true,
+    };
+    ESP_ERROR_CHECK(gptimer_set_alarm_action(sched_timer, &alarm_config));
+    sched_running = true;
+    ESP_LOGI(TAG, "scheduler: %d jobs, timer period %" PRIu32 "us", job_count, tick);
+    sched_start_us = esp_timer_get_time();
+    return gptimer_start(sched_timer);
+}
+
+/*
+打印每个任务的抖动、执行时间和超时次数，打印完清零。
+releases是启动以来一共释放了几次，和按经过的时间算出来的次数比，看有没有漂移
+*/
+void sched_report(void)
+{
+    int64_t elapsed = esp_timer_get_time() - sched_start_us;
+    ESP_LOGI(TAG, "%-12s %6s %5s %6s %5s %5s %5s %5s %6s %8s %17s",
+             "job", "period", "phase", "runs", "avg", "p50", "p99", "max", "exec", "overruns", "releases/expected");
+    for (int i = 0; i < job_count; i++)
+    {
+        sched_job_t *job = &jobs[i];
+        static latency_hist_t hist;
+        taskENTER_CRITICAL(&job->lock);
+        hist = job->jitter;
+        uint32_t runs = job->runs;
+        uint32_t max_exec = job->max_exec_us;
+        memset(&job->jitter, 0, sizeof(job->jitter));
+        job->runs = 0;
+        job->max_exec_us = 0;
+        uint32_t overruns = job->overruns;
+        job->overruns = 0;
+        taskEXIT_CRITICAL(&job->lock);
+        int64_t expected = elapsed > job->phase_us ? (elapsed - job->phase_us) / job->period_us : 0;
+        if (hist.count == 0)
+        {
+            ESP_LOGI(TAG, "%-12s %6" PRIu32 " %5" PRIu32 " %6d", job->name, job->period_us, job->phase_us, 0);
+            continue;
+        }
+        uint32_t p99 = hist_percentile(&hist, 990);
+        ESP_LOGI(TAG, "%-12s %6" PRIu32 " %5" PRIu32 " %6" PRIu32 " %5" PRIu32 " %5" PRIu32 " %5" PRIu32 " %5" PRIu32 " %6" PRIu32 " %8" PRIu32 " %8" PRIu32 "/%-8" PRIi64 "%s",
+                 job->name, job->period_us, job->phase_us, runs, (uint32_t)(hist.sum / hist.count),
+                 hist_percentile(&hist, 500), p99, hist.max, max_exec, overruns, job->releases, expected,
+                 p99 > SCHED_JITTER_LIMIT_US ? " (jitter!)" : "");
+    }
+}
+
+/******************************例子******************************/
+
+typedef struct
+{
+    uint32_t work_us;       // 每次执行多久
+    uint32_t spike_us;      // 偶尔执行特别久，用来演示超时
+    uint32_t spike_percent;
+} demo_work_t;
+
+static void demo_job(void *arg)
+{
+    demo_work_t *work = arg;
+    uint32_t us = work->work_us;
+    if (work->spike_percent && esp_random() % 100 < work->spike_percent)
+        us = work->spike_us;
+    esp_rom_delay_us(us);
+}
+
+static demo_work_t ctrl_fast_work = {.work_us = 40};
+static demo_work_t ctrl_work = {.work_us = 100};
+static demo_work_t sensor_work = {.work_us = 1300};
+static demo_work_t log_work = {.work_us = 500, .spike_us = 7000, .spike_percent = 10};
+
+void app_main(void)
+{
+    /*
+    周期短的优先级高，相位错开，不在同一个定时器周期里一起释放：
+    ctrl_2k在250 mod 500，ctrl_1k在0 mod 1000，
+    sensor_100和log_200都在500 mod 1000，再用mod 5000错开(500和1500)
+    */
+    sched_add_job("ctrl_2k", 500, 250, demo_job, &ctrl_fast_work, 12, 2048);
+    sched_add_job("ctrl_1k", 1000, 0, demo_job, &ctrl_work, 11, 2048);
+    sched_add_job("sensor_100", 10000, 500, demo_job, &sensor_work, 8, 2048);
+    // 偶尔执行7ms，超过5ms的周期，会有超时
+    sched_add_job("log_200", 5000, 1500, demo_job, &log_work, 5, 2048);
+    ESP_ERROR_CHECK(sched_start());
+
+    // log_200有超时被跳过，releases和expected也应该一样，说明后面的释放时间没有往后推
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(5000));
+        sched_report();
+    }
+}
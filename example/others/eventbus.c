@@ -0,0 +1,519 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_event_base.h"
+
+/*
+高频事件总线例子：
+esp_event_post_to每个事件都要把event_data拷贝进队列，分发时再遍历所有注册的handler，
+内部事件频率很高时开销比较大。这里实现一个配套的事件总线：
+1. 事件放在环形缓冲区里，一次可以投递多个，分发任务一次取出一批，加锁和唤醒的次数都少了
+2. handler按(base, id)放在哈希表里，分发时直接查表
+3. 小数据(不超过BUS_INLINE_MAX)直接放在事件里，大数据用带引用计数的payload传指针，不用拷贝
+app_main中和esp_event_post_to对比4字节和256字节数据的吞吐量和投递耗时
+*/
+
+static const char *TAG = "example";
+
+#define BUS_QUEUE_LEN 64          // 环形缓冲区能放多少个事件，必须是2的幂
+#define BUS_BATCH_MAX 16          // 分发任务一次最多取多少个事件
+#define BUS_HASH_SIZE 64          // handler哈希表大小，必须是2的幂，要比(base, id)的组合数大
+#define BUS_HANDLERS_PER_KEY 4    // 每个(base, id)最多几个handler
+#define BUS_INLINE_MAX 8          // 不超过这个大小的数据直接拷贝进事件
+#define BUS_POOL_BLOCKS 32        // payload内存池的块数
+#define BUS_POOL_BLOCK_SIZE 256   // 内存池每块的大小，更大的payload用malloc
+#define BUS_DATA_MAX UINT16_MAX   // 事件数据的最大长度，长度字段是uint16_t
+
+/******************************带引用计数的payload******************************/
+
+typedef struct bus_payload
+{
+    atomic_int refs;
+    uint16_t size;
+    uint8_t from_pool;
+    struct bus_payload *next; // 空闲链表
+    uint8_t data[];
+} bus_payload_t;
+
+// 内存池，避免每个事件都malloc
+static uint8_t pool_mem[BUS_POOL_BLOCKS][sizeof(bus_payload_t) + BUS_POOL_BLOCK_SIZE] __attribute__((aligned(4)));
+static bus_payload_t *pool_free;
+
+/*
+整个总线共用一个自旋锁，临界区里只做几次指针和下标的操作，
+比互斥量便宜得多，esp32c3单核时就是关中断
+*/
+static portMUX_TYPE bus_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/*申请一个payload，引用计数为1，失败或者超过BUS_DATA_MAX返回NULL*/
+bus_payload_t *bus_payload_alloc(size_t size)
+{
+    if (size > BUS_DATA_MAX)
+        return NULL;
+    bus_payload_t *p = NULL;
+    if (size <= BUS_POOL_BLOCK_SIZE)
+    {
+        taskENTER_CRITICAL(&bus_mux);
+        p = pool_free;
+        if (p)
+            pool_free = p->next;
+        taskEXIT_CRITICAL(&bus_mux);
+    }
+    if (p)
+    {
+        p->from_pool = 1;
+    }
+    else
+    {
+        // 池子用完了或者数据太大
+        p = malloc(sizeof(bus_payload_t) + size);
+        if (!p)
+            return NULL;
+        p->from_pool = 0;
+    }
+    atomic_init(&p->refs, 1);
+    p->size = size;
+    return p;
+}
+
+void bus_payload_retain(bus_payload_t *p)
+{
+    atomic_fetch_add(&p->refs, 1);
+}
+
+void bus_payload_release(bus_payload_t *p)
+{
+    if (atomic_fetch_sub(&p->refs, 1) != 1)
+        return;
+    if (p->from_pool)
+    {
+        taskENTER_CRITICAL(&bus_mux);
+        p->next = pool_free;
+        pool_free = p;
+        taskEXIT_CRITICAL(&bus_mux);
+    }
+    else
+    {
+        free(p);
+    }
+}
+
+/*handler拿到的data如果来自payload，可以通过它找回payload并retain，留到以后再用*/
+bus_payload_t *bus_payload_of(const void *data)
+{
+    return (bus_payload_t *)((const uint8_t *)data - offsetof(bus_payload_t, data));
+}
+
+/******************************handler哈希表******************************/
+
+// 和esp_event的handler参数一样，多了数据长度
+typedef void (*bus_handler_t)(void *arg, esp_event_base_t base, int32_t id, const void *data, size_t len);
+
+typedef struct
+{
+    esp_event_base_t base; // NULL表示空位
+    int32_t id;
+    int count;
+    struct
+    {
+        bus_handler_t fn;
+        void *arg;
+    } handlers[BUS_HANDLERS_PER_KEY];
+} bus_slot_t;
+
+static bus_slot_t bus_table[BUS_HASH_SIZE];
+
+// base是字符串常量的地址，直接用地址做哈希
+static inline uint32_t bus_hash(esp_event_base_t base, int32_t id)
+{
+    uint32_t h = (uint32_t)(uintptr_t)base ^ ((uint32_t)id * 0x9E3779B1u);
+    return (h ^ (h >> 15)) & (BUS_HASH_SIZE - 1);
+}
+
+/*线性探测，没找到返回NULL*/
+static bus_slot_t *bus_lookup(esp_event_base_t base, int32_t id)
+{
+    for (uint32_t i = bus_hash(base, id), n = 0; n < BUS_HASH_SIZE; i = (i + 1) & (BUS_HASH_SIZE - 1), n++)
+    {
+        bus_slot_t *s = &bus_table[i];
+        if (s->base == NULL)
+            return NULL;
+        if (s->base == base && s->id == id)
+            return s;
+    }
+    return NULL;
+}
+
+/*
+注册handler，id可以是ESP_EVENT_ANY_ID，表示这个base下的所有事件。
+表只会追加不会删除，分发时不加锁，所以先写好handler再增加count
+*/
+esp_err_t bus_register(esp_event_base_t base, int32_t id, bus_handler_t fn, void *arg)
+{
+    esp_err_t err = ESP_ERR_NO_MEM;
+    taskENTER_CRITICAL(&bus_mux);
+    for (uint32_t i = bus_hash(base, id), n = 0; n < BUS_HASH_SIZE; i = (i + 1) & (BUS_HASH_SIZE - 1), n++)
+    {
+        bus_slot_t *s = &bus_table[i];
+        if (s->base != NULL && (s->base != base || s->id != id))
+            continue;
+        if (s->count < BUS_HANDLERS_PER_KEY)
+        {
+            s->handlers[s->count].fn = fn;
+            s->handlers[s->count].arg = arg;
+            s->id = id;
+            atomic_thread_fence(memory_order_release);
+            s->base = base;
+            s->count++;
+            err = ESP_OK;
+        }
+        break;
+    }
+    taskEXIT_CRITICAL(&bus_mux);
+    return err;
+}
+
+/******************************环形缓冲区和分发******************************/
+
+typedef struct
+{
+    esp_event_base_t base;
+    int32_t id;
+    uint16_t len;
+    bus_payload_t *ref; // NULL表示数据在inline_data里
+    uint8_t inline_data[BUS_INLINE_MAX];
+} bus_event_t;
+
+// 批量投递时每个事件的描述，data和ref二选一
+typedef struct
+{
+    esp_event_base_t base;
+    int32_t id;
+    const void *data; // 不超过BUS_INLINE_MAX时拷贝，否则申请payload再拷贝
+    size_t len;
+    bus_payload_t *ref; // 不为NULL时直接传引用，所有权交给总线
+} bus_msg_t;
+
+static bus_event_t bus_ring[BUS_QUEUE_LEN];
+static uint32_t bus_head; // 下一个写的位置，只增不减，取余得到下标
+static uint32_t bus_tail; // 下一个读的位置
+static int bus_waiters;   // 因为缓冲区满了在等的投递者
+static TaskHandle_t bus_task;
+static SemaphoreHandle_t bus_space_sem;
+
+/*把一个事件写进环形缓冲区，调用前要持有锁并且确认有空位*/
+static void bus_put_locked(const bus_msg_t *m, bus_payload_t *ref)
+{
+    bus_event_t *e = &bus_ring[bus_head++ & (BUS_QUEUE_LEN - 1)];
+    e->base = m->base;
+    e->id = m->id;
+    e->len = m->len;
+    e->ref = ref;
+    if (!ref && m->len)
+        memcpy(e->inline_data, m->data, m->len);
+}
+
+/*
+批量投递，返回放进去的个数。
+一次加锁放尽量多的事件，只有缓冲区原来是空的才唤醒分发任务，
+满了就等分发任务腾出空间，超时后返回已经放进去的个数，
+遇到数据超过BUS_DATA_MAX或者申请不到payload的事件也在那里停下
+*/
+int bus_post_batch(const bus_msg_t *msgs, int count, TickType_t ticks_to_wait)
+{
+    int posted = 0;
+    TickType_t start = xTaskGetTickCount();
+
+    // 大数据先在锁外申请payload并拷贝好
+    bus_payload_t *refs[BUS_BATCH_MAX];
+    while (posted < count)
+    {
+        int chunk = MIN(count - posted, BUS_BATCH_MAX);
+        for (int i = 0; i < chunk; i++)
+        {
+            const bus_msg_t *m = &msgs[posted + i];
+            // 长度放不进uint16_t，投递了handler拿到的长度就不对了
+            if (m->len > BUS_DATA_MAX)
+            {
+                chunk = i;
+                break;
+            }
+            refs[i] = m->ref;
+            if (!refs[i] && m->len > BUS_INLINE_MAX)
+            {
+                refs[i] = bus_payload_alloc(m->len);
+                if (!refs[i])
+                {
+                    chunk = i;
+                    break;
+                }
+                memcpy(refs[i]->data, m->data, m->len);
+            }
+        }
+        if (chunk == 0)
+            break;
+
+        int done = 0;
+        bool waiting = false;
+        while (done < chunk)
+        {
+            taskENTER_CRITICAL(&bus_mux);
+            if (waiting)
+                bus_waiters--;
+            bool wake = bus_head == bus_tail;
+            while (done < chunk && bus_head - bus_tail < BUS_QUEUE_LEN)
+            {
+                bus_put_locked(&msgs[posted + done], refs[done]);
+                done++;
+            }
+            bool full = done < chunk;
+            // 还有空位并且还有别人在等，把唤醒传下去
+            bool pass_on = !full && bus_waiters > 0 && bus_head - bus_tail < BUS_QUEUE_LEN;
+            if (full)
+                bus_waiters++;
+            waiting = full;
+            taskEXIT_CRITICAL(&bus_mux);
+
+            if (wake)
+                xTaskNotifyGive(bus_task);
+            if (pass_on)
+                xSemaphoreGive(bus_space_sem);
+            if (!full)
+                break;
+
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            if (ticks_to_wait != portMAX_DELAY &&
+                (elapsed >= ticks_to_wait || xSemaphoreTake(bus_space_sem, ticks_to_wait - elapsed) != pdTRUE))
+            {
+                taskENTER_CRITICAL(&bus_mux);
+                bus_waiters--;
+                taskEXIT_CRITICAL(&bus_mux);
+                break;
+            }
+            if (ticks_to_wait == portMAX_DELAY)
+                xSemaphoreTake(bus_space_sem, portMAX_DELAY);
+        }
+
+        // 没放进去的payload要释放，调用者传进来的ref除外
+        for (int i = done; i < chunk; i++)
+        {
+            if (refs[i] && refs[i] != msgs[posted + i].ref)
+                bus_payload_release(refs[i]);
+        }
+        posted += done;
+        if (done < chunk)
+            break;
+    }
+    return posted;
+}
+
+esp_err_t bus_post(esp_event_base_t base, int32_t id, const void *data, size_t len, TickType_t ticks_to_wait)
+{
+    if (len > BUS_DATA_MAX)
+        return ESP_ERR_INVALID_SIZE;
+    bus_msg_t m = {.base = base, .id = id, .data = data, .len = len};
+    return bus_post_batch(&m, 1, ticks_to_wait) == 1 ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+/*直接传payload，不拷贝，成功后payload的这份引用归总线所有*/
+esp_err_t bus_post_ref(esp_event_base_t base, int32_t id, bus_payload_t *ref, TickType_t ticks_to_wait)
+{
+    bus_msg_t m = {.base = base, .id = id, .len = ref->size, .ref = ref};
+    return bus_post_batch(&m, 1, ticks_to_wait) == 1 ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+static void bus_call(bus_slot_t *s, const bus_event_t *e, const void *data)
+{
+    if (!s)
+        return;
+    for (int i = 0; i < s->count; i++)
+        s->handlers[i].fn(s->handlers[i].arg, e->base, e->id, data, e->len);
+}
+
+/*取出一批事件并分发，返回处理的个数*/
+static int bus_dispatch_pending(void)
+{
+    bus_event_t batch[BUS_BATCH_MAX];
+    int n = 0;
+
+    // 在锁里只拷贝事件，handler在锁外调用
+    taskENTER_CRITICAL(&bus_mux);
+    while (n < BUS_BATCH_MAX && bus_tail != bus_head)
+        batch[n++] = bus_ring[bus_tail++ & (BUS_QUEUE_LEN - 1)];
+    bool give = n > 0 && bus_waiters > 0;
+    taskEXIT_CRITICAL(&bus_mux);
+    if (give)
+        xSemaphoreGive(bus_space_sem);
+
+    for (int i = 0; i < n; i++)
+    {
+        bus_event_t *e = &batch[i];
+        const void *data = e->ref ? (const void *)e->ref->data : (const void *)e->inline_data;
+        bus_call(bus_lookup(e->base, e->id), e, data);
+        bus_call(bus_lookup(e->base, ESP_EVENT_ANY_ID), e, data);
+        if (e->ref)
+            bus_payload_release(e->ref);
+    }
+    return n;
+}
+
+static void bus_task_fn(void *pvParam)
+{
+    while (1)
+    {
+        // 缓冲区空了才睡眠，投递者发现原来是空的时候会唤醒
+        if (bus_dispatch_pending() == 0)
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+esp_err_t bus_init(UBaseType_t priority, uint32_t stack_size)
+{
+    for (int i = 0; i < BUS_POOL_BLOCKS; i++)
+    {
+        bus_payload_t *p = (bus_payload_t *)pool_mem[i];
+        p->next = pool_free;
+        pool_free = p;
+    }
+    bus_space_sem = xSemaphoreCreateBinary();
+    if (!bus_space_sem)
+        return ESP_ERR_NO_MEM;
+    if (xTaskCreate(bus_task_fn, "event_bus", stack_size, NULL, priority, &bus_task) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
+
+/******************************和esp_event对比******************************/
+
+ESP_EVENT_DECLARE_BASE(BENCH_EVENTS);
+ESP_EVENT_DEFINE_BASE(BENCH_EVENTS);
+
+enum
+{
+    BENCH_EVENT_SMALL,
+    BENCH_EVENT_LARGE,
+};
+
+#define BENCH_EVENTS_PER_RUN 20000
+#define BENCH_BATCH 16
+
+static esp_event_loop_handle_t loop;
+static volatile uint32_t handled;
+static volatile uint32_t checksum;
+
+static void loop_handler(void *handler_args, esp_event_base_t base, int32_t id, void *event_data)
+{
+    checksum += *(uint8_t *)event_data;
+    handled++;
+}
+
+static void bus_bench_handler(void *arg, esp_event_base_t base, int32_t id, const void *data, size_t len)
+{
+    checksum += *(const uint8_t *)data;
+    handled++;
+}
+
+typedef enum
+{
+    BENCH_ESP_EVENT,
+    BENCH_BUS_POST,
+    BENCH_BUS_BATCH,
+    BENCH_BUS_REF,
+} bench_mode_t;
+
+static const char *bench_mode_name[] = {"esp_event_post_to", "bus_post", "bus_post_batch", "bus_post_ref"};
+
+static void bench_run(bench_mode_t mode, size_t len)
+{
+    static uint8_t data[256];
+    bus_msg_t msgs[BENCH_BATCH];
+    int32_t id = len > BUS_INLINE_MAX ? BENCH_EVENT_LARGE : BENCH_EVENT_SMALL;
+    int64_t post_us = 0;
+    uint32_t post_max = 0;
+
+    for (int i = 0; i < BENCH_BATCH; i++)
+        msgs[i] = (bus_msg_t){.base = BENCH_EVENTS, .id = id, .data = data, .len = len};
+
+    handled = 0;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_EVENTS_PER_RUN;)
+    {
+        data[0] = i;
+        int64_t t0 = esp_timer_get_time();
+        switch (mode)
+        {
+        case BENCH_ESP_EVENT:
+            esp_event_post_to(loop, BENCH_EVENTS, id, data, len, portMAX_DELAY);
+            i++;
+            break;
+        case BENCH_BUS_POST:
+            bus_post(BENCH_EVENTS, id, data, len, portMAX_DELAY);
+            i++;
+            break;
+        case BENCH_BUS_BATCH:
+            i += bus_post_batch(msgs, BENCH_BATCH, portMAX_DELAY);
+            break;
+        case BENCH_BUS_REF:
+        {
+            // 真实场景里数据是直接生成在payload里的，这里只写一个字节
+            bus_payload_t *p = bus_payload_alloc(len);
+            if (!p)
+                break;
+            p->data[0] = i;
+            bus_post_ref(BENCH_EVENTS, id, p, portMAX_DELAY);
+            i++;
+            break;
+        }
+        }
+        uint32_t dt = esp_timer_get_time() - t0;
+        post_us += dt;
+        if (dt > post_max)
+            post_max = dt;
+    }
+    // 等分发完
+    while (handled < BENCH_EVENTS_PER_RUN)
+        vTaskDelay(1);
+    int64_t elapsed_us = esp_timer_get_time() - start;
+
+    int calls = mode == BENCH_BUS_BATCH ? BENCH_EVENTS_PER_RUN / BENCH_BATCH : BENCH_EVENTS_PER_RUN;
+    ESP_LOGI(TAG, "%-18s %3dB  %8.0f events/s  post avg %.2fus max %" PRIu32 "us",
+             bench_mode_name[mode], (int)len,
+             BENCH_EVENTS_PER_RUN * 1e6 / elapsed_us,
+             (double)post_us / calls,
+             post_max);
+}
+
+void app_main(void)
+{
+    // 两边的队列长度、优先级一致，分发任务比投递任务优先级低，让队列能攒起来
+    UBaseType_t prio = 5;
+    vTaskPrioritySet(NULL, prio);
+    esp_event_loop_args_t loop_args = {
+        .queue_size = BUS_QUEUE_LEN,
+        .task_name = "loop_task",
+        .task_priority = prio - 1,
+        .task_stack_size = 3072,
+        .task_core_id = tskNO_AFFINITY};
+    esp_event_loop_create(&loop_args, &loop);
+    esp_event_handler_instance_register_with(loop, BENCH_EVENTS, ESP_EVENT_ANY_ID, loop_handler, NULL, NULL);
+
+    bus_init(prio - 1, 3072);
+    bus_register(BENCH_EVENTS, BENCH_EVENT_SMALL, bus_bench_handler, NULL);
+    bus_register(BENCH_EVENTS, BENCH_EVENT_LARGE, bus_bench_handler, NULL);
+
+    static const size_t sizes[] = {4, 256};
+    for (int i = 0; i < 2; i++)
+    {
+        bench_run(BENCH_ESP_EVENT, sizes[i]);
+        bench_run(BENCH_BUS_POST, sizes[i]);
+        bench_run(BENCH_BUS_BATCH, sizes[i]);
+        if (sizes[i] > BUS_INLINE_MAX)
+            bench_run(BENCH_BUS_REF, sizes[i]);
+    }
+}
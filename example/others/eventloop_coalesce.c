@@ -0,0 +1,308 @@
+#include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_event_base.h"
+
+/*
+合并重复事件的例子：
+很多事件只关心最新的值，比如eventloop.c里的iteration，队列里排着的旧值处理了也没用。
+这里在esp_event前面加一层：每个(base, id)有一个槽位保存最新的数据，
+队列里还有没处理的同一个事件时，新投递的数据直接覆盖槽位，不再入队，
+所以不管投递得多快，每个(base, id)在队列里最多只有一个，handler也不会处理过时的数据。
+还可以给事件设置一个等待时间，期间的投递都合并成一个，有两种模式：
+节流：第一次投递后等待时间到了就入队，后面的投递不重新计时，一直投递时每个周期分发一次；
+防抖：每次投递都重新计时，停止投递等待时间以后才入队，一直投递的话就一直不分发
+*/
+
+static const char *TAG = "example";
+
+#define COALESCE_MAX_SLOTS 8          // 最多多少个(base, id)
+#define COALESCE_MAX_HANDLERS 4       // 每个(base, id)最多几个handler
+#define COALESCE_DATA_MAX 32          // 事件数据的最大长度
+
+typedef enum
+{
+    COALESCE_NOW,      // 尽快入队，不等待
+    COALESCE_THROTTLE, // 节流
+    COALESCE_DEBOUNCE, // 防抖
+} coalesce_mode_t;
+
+typedef struct
+{
+    esp_event_loop_handle_t loop;
+    esp_event_base_t base;
+    int32_t id;
+    coalesce_mode_t mode;
+    uint32_t delay_us;       // 节流或者防抖的等待时间
+    esp_timer_handle_t timer;
+
+    bool queued;             // 队列里(或者等待时间内)已经有这个事件了
+    bool waiting;            // 定时器在计时，还没入队
+    int in_queue;            // 事件循环队列里这个事件的个数
+    uint8_t data[COALESCE_DATA_MAX] __attribute__((aligned(4)));
+    size_t len;
+
+    int handler_count;
+    struct
+    {
+        esp_event_handler_t fn;
+        void *arg;
+    } handlers[COALESCE_MAX_HANDLERS];
+
+    uint32_t posted;         // 投递次数
+    uint32_t merged;         // 被合并掉的次数
+    uint32_t delivered;      // 实际分发的次数
+    int max_in_queue;        // 队列里同时存在的最大个数，正常不会超过1
+} coalesce_slot_t;
+
+static coalesce_slot_t slots[COALESCE_MAX_SLOTS];
+static int slot_count;
+static portMUX_TYPE coalesce_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static coalesce_slot_t *coalesce_find(esp_event_loop_handle_t loop, esp_event_base_t base, int32_t id)
+{
+    for (int i = 0; i < slot_count; i++)
+    {
+        if (slots[i].loop == loop && slots[i].base == base && slots[i].id == id)
+            return &slots[i];
+    }
+    return NULL;
+}
+
+/*
+事件循环里真正注册的handler，队列里的数据只是槽位的指针，
+先把最新的数据拷出来再清掉queued，handler执行期间新来的投递会重新入队
+*/
+static void coalesce_dispatch(void *handler_args, esp_event_base_t base, int32_t id, void *event_data)
+{
+    coalesce_slot_t *slot = *(coalesce_slot_t **)event_data;
+    // handler会把数据转成结构体，要对齐
+    uint8_t data[COALESCE_DATA_MAX] __attribute__((aligned(4)));
+
+    taskENTER_CRITICAL(&coalesce_mux);
+    memcpy(data, slot->data, slot->len);
+    slot->queued = false;
+    slot->in_queue--;
+    slot->delivered++;
+    taskEXIT_CRITICAL(&coalesce_mux);
+
+    for (int i = 0; i < slot->handler_count; i++)
+        slot->handlers[i].fn(slot->handlers[i].arg, base, id, data);
+}
+
+static esp_err_t coalesce_enqueue(coalesce_slot_t *slot, TickType_t ticks_to_wait)
+{
+    // 先计数再入队，否则入队后handler可能先执行完把计数减成负的
+    taskENTER_CRITICAL(&coalesce_mux);
+    slot->in_queue++;
+    slot->max_in_queue = MAX(slot->max_in_queue, slot->in_queue);
+    taskEXIT_CRITICAL(&coalesce_mux);
+
+    esp_err_t err = esp_event_post_to(slot->loop, slot->base, slot->id, &slot, sizeof(slot), ticks_to_wait);
+    if (err != ESP_OK)
+    {
+        // 没放进去，下次投递重新入队
+        taskENTER_CRITICAL(&coalesce_mux);
+        slot->in_queue--;
+        slot->queued = false;
+        taskEXIT_CRITICAL(&coalesce_mux);
+    }
+    return err;
+}
+
+// 等待时间到了，把这段时间里最新的数据入队
+static void coalesce_timer_cb(void *arg)
+{
+    coalesce_slot_t *slot = arg;
+    // 防抖重新计时和这里同时发生时，定时器可能多触发一次，已经入队了就不再入队
+    taskENTER_CRITICAL(&coalesce_mux);
+    bool waiting = slot->waiting;
+    slot->waiting = false;
+    taskEXIT_CRITICAL(&coalesce_mux);
+    if (!waiting)
+        return;
+    // 在esp_timer任务里，不能阻塞
+    if (coalesce_enqueue(slot, 0) != ESP_OK)
+        ESP_LOGW(TAG, "queue full, drop %s:%" PRIi32, slot->base, slot->id);
+}
+
+/*
+注册handler，和esp_event_handler_instance_register_with一样，不支持ESP_EVENT_ANY_ID。
+mode和delay_ms在同一个(base, id)第一次注册时生效，COALESCE_NOW时delay_ms不用。
+这个(base, id)的事件只能通过coalesce_post投递
+*/
+esp_err_t coalesce_register(esp_event_loop_handle_t loop, esp_event_base_t base, int32_t id,
+                            esp_event_handler_t fn, void *arg, coalesce_mode_t mode, uint32_t delay_ms)
+{
+    if (id == ESP_EVENT_ANY_ID)
+        return ESP_ERR_INVALID_ARG;
+
+    coalesce_slot_t *slot = coalesce_find(loop, base, id);
+    if (!slot)
+    {
+        if (slot_count >= COALESCE_MAX_SLOTS)
+            return ESP_ERR_NO_MEM;
+        slot = &slots[slot_count];
+        memset(slot, 0, sizeof(*slot));
+        slot->loop = loop;
+        slot->base = base;
+        slot->id = id;
+        slot->mode = delay_ms ? mode : COALESCE_NOW;
+        slot->delay_us = delay_ms * 1000;
+        if (slot->mode != COALESCE_NOW)
+        {
+            esp_timer_create_args_t timer_args = {
+                .callback = coalesce_timer_cb,
+                .arg = slot,
+                .name = "coalesce"};
+            esp_err_t err = esp_timer_create(&timer_args, &slot->timer);
+            if (err != ESP_OK)
+                return err;
+        }
+        esp_err_t err = esp_event_handler_instance_register_with(loop, base, id, coalesce_dispatch, NULL, NULL);
+        if (err != ESP_OK)
+            return err;
+        slot_count++;
+    }
+    if (slot->handler_count >= COALESCE_MAX_HANDLERS)
+        return ESP_ERR_NO_MEM;
+    slot->handlers[slot->handler_count].fn = fn;
+    slot->handlers[slot->handler_count].arg = arg;
+    slot->handler_count++;
+    return ESP_OK;
+}
+
+/*
+投递事件，队列里已经有同一个事件时只更新数据，不会阻塞。
+返回ESP_OK表示数据已经保存，handler一定会看到这次或者更新的数据
+*/
+esp_err_t coalesce_post(esp_event_loop_handle_t loop, esp_event_base_t base, int32_t id,
+                        const void *data, size_t len, TickType_t ticks_to_wait)
+{
+    if (len > COALESCE_DATA_MAX)
+        return ESP_ERR_INVALID_SIZE;
+    coalesce_slot_t *slot = coalesce_find(loop, base, id);
+    if (!slot)
+        return ESP_ERR_NOT_FOUND;
+
+    taskENTER_CRITICAL(&coalesce_mux);
+    memcpy(slot->data, data, len);
+    slot->len = len;
+    slot->posted++;
+    bool need_enqueue = !slot->queued;
+    // 防抖模式下还在计时的话重新计时，已经入队的就不用管了
+    bool restart = !need_enqueue && slot->waiting && slot->mode == COALESCE_DEBOUNCE;
+    if (need_enqueue)
+    {
+        slot->queued = true;
+        slot->waiting = slot->mode != COALESCE_NOW;
+    }
+    else
+        slot->merged++;
+    taskEXIT_CRITICAL(&coalesce_mux);
+
+    if (!need_enqueue && !restart)
+        return ESP_OK;
+    if (slot->mode == COALESCE_NOW)
+        return coalesce_enqueue(slot, ticks_to_wait);
+
+    /*
+    节流模式只在第一次投递时启动定时器，防抖模式每次投递都重新启动。
+    定时器可能还在跑(上一次重新计时和回调同时发生)，先停掉，
+    别的任务同时启动了的话返回ESP_ERR_INVALID_STATE，这时定时器已经在计时了，也算成功
+    */
+    esp_timer_stop(slot->timer);
+    esp_err_t err = esp_timer_start_once(slot->timer, slot->delay_us);
+    if (err == ESP_ERR_INVALID_STATE || restart)
+        return ESP_OK;
+    if (err != ESP_OK)
+    {
+        taskENTER_CRITICAL(&coalesce_mux);
+        slot->queued = false;
+        slot->waiting = false;
+        taskEXIT_CRITICAL(&coalesce_mux);
+    }
+    return err;
+}
+
+void coalesce_dump(void)
+{
+    for (int i = 0; i < slot_count; i++)
+    {
+        ESP_LOGI(TAG, "%s:%" PRIi32 " posted %" PRIu32 " merged %" PRIu32 " delivered %" PRIu32 " max in queue %d",
+                 slots[i].base, slots[i].id, slots[i].posted, slots[i].merged, slots[i].delivered, slots[i].max_in_queue);
+        // 每个(base, id)在队列里最多只有一个
+        if (slots[i].max_in_queue > 1)
+            ESP_LOGE(TAG, "%s:%" PRIi32 " was queued %d times at once", slots[i].base, slots[i].id, slots[i].max_in_queue);
+    }
+}
+
+/******************************例子******************************/
+
+// 声明一个事件基，这个可以在.h文件中定义
+ESP_EVENT_DECLARE_BASE(TASK_EVENTS);
+// 初始化事件基
+ESP_EVENT_DEFINE_BASE(TASK_EVENTS);
+
+enum
+{
+    TASK_ITERATION_EVENT, // 尽快处理最新的值
+    TASK_SENSOR_EVENT,    // 100ms节流
+    TASK_CONFIG_EVENT,    // 100ms防抖，连续修改时只处理停下来以后的最终值
+};
+
+esp_event_loop_handle_t loop;
+
+static void task_iteration_handler(void *handler_args, esp_event_base_t base, int32_t id, void *event_data)
+{
+    int iteration = *((int *)event_data);
+    ESP_LOGI(TAG, "handling %s:%s iteration %d", base, "TASK_ITERATION_EVENT", iteration);
+    // 模拟比较慢的处理
+    vTaskDelay(50 / portTICK_PERIOD_MS);
+}
+
+static void task_sensor_handler(void *handler_args, esp_event_base_t base, int32_t id, void *event_data)
+{
+    ESP_LOGI(TAG, "handling %s:%s value %d", base, "TASK_SENSOR_EVENT", *((int *)event_data));
+}
+
+static void task_config_handler(void *handler_args, esp_event_base_t base, int32_t id, void *event_data)
+{
+    ESP_LOGI(TAG, "handling %s:%s value %d", base, "TASK_CONFIG_EVENT", *((int *)event_data));
+}
+
+void app_main(void)
+{
+    // 和eventloop.c一样，队列长度只有5
+    esp_event_loop_args_t loop_args = {
+        .queue_size = 5,
+        .task_name = "loop_task",
+        .task_priority = uxTaskPriorityGet(NULL),
+        .task_stack_size = 3072,
+        .task_core_id = tskNO_AFFINITY};
+    esp_event_loop_create(&loop_args, &loop);
+
+    coalesce_register(loop, TASK_EVENTS, TASK_ITERATION_EVENT, task_iteration_handler, NULL, COALESCE_NOW, 0);
+    coalesce_register(loop, TASK_EVENTS, TASK_SENSOR_EVENT, task_sensor_handler, NULL, COALESCE_THROTTLE, 100);
+    coalesce_register(loop, TASK_EVENTS, TASK_CONFIG_EVENT, task_config_handler, NULL, COALESCE_DEBOUNCE, 100);
+
+    // 以远超处理能力的速度投递，队列不会满，投递也不会阻塞
+    int64_t start = esp_timer_get_time();
+    for (int iteration = 1; iteration <= 10000; iteration++)
+    {
+        coalesce_post(loop, TASK_EVENTS, TASK_ITERATION_EVENT, &iteration, sizeof(iteration), portMAX_DELAY);
+        coalesce_post(loop, TASK_EVENTS, TASK_SENSOR_EVENT, &iteration, sizeof(iteration), portMAX_DELAY);
+        coalesce_post(loop, TASK_EVENTS, TASK_CONFIG_EVENT, &iteration, sizeof(iteration), portMAX_DELAY);
+        if (iteration % 100 == 0)
+            vTaskDelay(1);
+    }
+    ESP_LOGI(TAG, "posted 30000 events in %" PRId64 " us", esp_timer_get_time() - start);
+
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+    coalesce_dump();
+}
@@ -0,0 +1,338 @@
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_event_base.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+
+/*
+分优先级的事件循环例子：
+一个esp_event_loop_handle_t里所有事件都是先进先出的，大量TASK_ITERATION_EVENT会把重要的事件堵在后面。
+这里每个优先级(lane)用一个不带任务的esp_event事件循环，各有各的队列，
+由一个分发任务按权重轮流从各个lane里取事件，调用esp_event_loop_run每次分发一个。
+注册handler的时候指定lane，之后这个事件基的事件都投递到这个lane；
+wifi、ip这些系统事件可以从默认事件循环转发到高优先级的lane。
+app_main中对比高负载下单个事件循环和分lane时重要事件的延时
+*/
+
+static const char *TAG = "example";
+
+typedef enum
+{
+    LANE_CRITICAL, // 连接相关的事件，必须及时处理
+    LANE_NORMAL,
+    LANE_BULK, // 大量的应用事件，可以等
+    LANE_MAX,
+} lane_t;
+
+// 每一轮每个lane最多分发几个事件，高优先级的lane先分发
+static const int lane_weight[LANE_MAX] = {8, 2, 1};
+static const int lane_queue_size[LANE_MAX] = {8, 16, 32};
+
+#define PRIO_MAX_BASES 16 // 最多多少个事件基指定了lane
+
+typedef struct
+{
+    esp_event_loop_handle_t lanes[LANE_MAX];
+    int pending[LANE_MAX]; // 每个lane里还没分发的事件数
+    int credit[LANE_MAX];  // 这一轮还能分发几个
+    portMUX_TYPE mux;
+    TaskHandle_t task;
+    struct
+    {
+        esp_event_base_t base;
+        lane_t lane;
+    } routes[PRIO_MAX_BASES];
+    int route_count;
+    lane_t default_lane; // 没有指定lane的事件基
+} prio_loop_t;
+
+/*
+按权重选一个有事件的lane：从高到低找还有额度的，都用完了再给所有lane补满额度，
+这样高优先级的lane先分发，低优先级的lane也不会被饿死
+*/
+static int prio_pick_lane(prio_loop_t *loop)
+{
+    for (int round = 0; round < 2; round++)
+    {
+        for (int i = 0; i < LANE_MAX; i++)
+        {
+            if (loop->pending[i] > 0 && loop->credit[i] > 0)
+            {
+                loop->credit[i]--;
+                loop->pending[i]--;
+                return i;
+            }
+        }
+        for (int i = 0; i < LANE_MAX; i++)
+            loop->credit[i] = lane_weight[i];
+    }
+    return -1;
+}
+
+static void prio_dispatch_task(void *pvParam)
+{
+    prio_loop_t *loop = pvParam;
+    while (1)
+    {
+        // 每投递成功一个事件通知一次，这里每次取一个
+        ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+
+        taskENTER_CRITICAL(&loop->mux);
+        int lane = prio_pick_lane(loop);
+        taskEXIT_CRITICAL(&loop->mux);
+
+        // 不带任务的事件循环，ticks_to_run为0时最多分发一个事件
+        if (lane >= 0)
+            esp_event_loop_run(loop->lanes[lane], 0);
+    }
+}
+
+/*创建所有lane和分发任务，default_lane是没有指定lane的事件基用的*/
+esp_err_t prio_loop_create(prio_loop_t *loop, lane_t default_lane, UBaseType_t priority, uint32_t stack_size)
+{
+    memset(loop, 0, sizeof(*loop));
+    portMUX_INITIALIZE(&loop->mux);
+    loop->default_lane = default_lane;
+
+    for (int i = 0; i < LANE_MAX; i++)
+    {
+        loop->credit[i] = lane_weight[i];
+        // task_name为NULL时不创建任务，由我们自己调用esp_event_loop_run
+        esp_event_loop_args_t args = {
+            .queue_size = lane_queue_size[i],
+            .task_name = NULL,
+        };
+        esp_err_t err = esp_event_loop_create(&args, &loop->lanes[i]);
+        if (err != ESP_OK)
+            return err;
+    }
+    if (xTaskCreate(prio_dispatch_task, "prio_loop", stack_size, loop, priority, &loop->task) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
+
+static lane_t prio_route(prio_loop_t *loop, esp_event_base_t base)
+{
+    for (int i = 0; i < loop->route_count; i++)
+    {
+        if (loop->routes[i].base == base)
+            return loop->routes[i].lane;
+    }
+    return loop->default_lane;
+}
+
+/*
+和esp_event_handler_instance_register_with一样，多了一个lane参数，
+注册之后这个事件基的所有事件都投递到这个lane，一个事件基只能在一个lane里
+*/
+esp_err_t prio_handler_register(prio_loop_t *loop, lane_t lane, esp_event_base_t base, int32_t id,
+                                esp_event_handler_t handler, void *arg, esp_event_handler_instance_t *instance)
+{
+    taskENTER_CRITICAL(&loop->mux);
+    int i;
+    for (i = 0; i < loop->route_count; i++)
+    {
+        if (loop->routes[i].base == base)
+            break;
+    }
+    esp_err_t err = ESP_OK;
+    if (i < loop->route_count)
+    {
+        if (loop->routes[i].lane != lane)
+            err = ESP_ERR_INVALID_STATE;
+    }
+    else if (loop->route_count < PRIO_MAX_BASES)
+    {
+        loop->routes[loop->route_count].base = base;
+        loop->routes[loop->route_count].lane = lane;
+        loop->route_count++;
+    }
+    else
+    {
+        err = ESP_ERR_NO_MEM;
+    }
+    taskEXIT_CRITICAL(&loop->mux);
+    if (err != ESP_OK)
+        return err;
+
+    return esp_event_handler_instance_register_with(loop->lanes[lane], base, id, handler, arg, instance);
+}
+
+/*和esp_event_post_to一样，只会被同一个lane的队列阻塞*/
+esp_err_t prio_post(prio_loop_t *loop, esp_event_base_t base, int32_t id,
+                    const void *data, size_t len, TickType_t ticks_to_wait)
+{
+    lane_t lane = prio_route(loop, base);
+    esp_err_t err = esp_event_post_to(loop->lanes[lane], base, id, data, len, ticks_to_wait);
+    if (err != ESP_OK)
+        return err;
+
+    taskENTER_CRITICAL(&loop->mux);
+    loop->pending[lane]++;
+    taskEXIT_CRITICAL(&loop->mux);
+    xTaskNotifyGive(loop->task);
+    return ESP_OK;
+}
+
+#define PRIO_MAX_FORWARDS 8
+
+// 转发时要知道事件数据的长度，handler里拿不到，注册时记下来
+typedef struct
+{
+    prio_loop_t *loop;
+    size_t data_size;
+} prio_forward_t;
+
+static prio_forward_t prio_forwards[PRIO_MAX_FORWARDS];
+static int prio_forward_count;
+
+// 默认事件循环的handler，把系统事件转发到对应的lane
+static void prio_forward_handler(void *handler_args, esp_event_base_t base, int32_t id, void *event_data)
+{
+    prio_forward_t *fwd = handler_args;
+    // 在默认事件循环的任务里，不能阻塞，lane满了就丢掉
+    if (prio_post(fwd->loop, base, id, event_data, event_data ? fwd->data_size : 0, 0) != ESP_OK)
+        ESP_LOGW(TAG, "lane full, drop %s:%" PRIi32, base, id);
+}
+
+/*
+把默认事件循环里的系统事件转发过来，比如
+prio_forward_default(&loop, IP_EVENT, IP_EVENT_STA_GOT_IP, sizeof(ip_event_got_ip_t));
+data_size是这个事件数据的大小，没有数据的事件传0
+*/
+esp_err_t prio_forward_default(prio_loop_t *loop, esp_event_base_t base, int32_t id, size_t data_size)
+{
+    if (prio_forward_count >= PRIO_MAX_FORWARDS)
+        return ESP_ERR_NO_MEM;
+    prio_forwards[prio_forward_count].loop = loop;
+    prio_forwards[prio_forward_count].data_size = data_size;
+    return esp_event_handler_instance_register(base, id, prio_forward_handler, &prio_forwards[prio_forward_count++], NULL);
+}
+
+/******************************对比******************************/
+
+// 声明一个事件基，这个可以在.h文件中定义
+ESP_EVENT_DECLARE_BASE(TASK_EVENTS);
+ESP_EVENT_DECLARE_BASE(CONN_EVENTS);
+// 初始化事件基
+ESP_EVENT_DEFINE_BASE(TASK_EVENTS);
+ESP_EVENT_DEFINE_BASE(CONN_EVENTS);
+
+enum
+{
+    TASK_ITERATION_EVENT,
+};
+
+enum
+{
+    CONN_STATE_EVENT, // 模拟连接状态变化，数据是投递时间
+};
+
+#define BENCH_DURATION_MS 3000
+#define BENCH_BULK_WORK_US 500   // 每个应用事件的处理时间
+#define BENCH_CONN_PERIOD_MS 50  // 多久来一个连接事件
+
+static volatile uint32_t conn_count;
+static volatile uint64_t conn_total_us;
+static volatile uint32_t conn_max_us;
+static volatile uint32_t bulk_count;
+static volatile bool bench_running;
+
+static void bulk_handler(void *handler_args, esp_event_base_t base, int32_t id, void *event_data)
+{
+    int64_t end = esp_timer_get_time() + BENCH_BULK_WORK_US;
+    while (esp_timer_get_time() < end)
+        ;
+    bulk_count++;
+}
+
+static void conn_handler(void *handler_args, esp_event_base_t base, int32_t id, void *event_data)
+{
+    uint32_t us = esp_timer_get_time() - *(int64_t *)event_data;
+    conn_count++;
+    conn_total_us += us;
+    if (us > conn_max_us)
+        conn_max_us = us;
+}
+
+static esp_event_loop_handle_t single_loop;
+static prio_loop_t prio_loop;
+static bool use_lanes;
+
+static esp_err_t bench_post(esp_event_base_t base, int32_t id, const void *data, size_t len)
+{
+    if (use_lanes)
+        return prio_post(&prio_loop, base, id, data, len, portMAX_DELAY);
+    return esp_event_post_to(single_loop, base, id, data, len, portMAX_DELAY);
+}
+
+// 尽可能快地投递应用事件，队列满了就阻塞
+static void flood_task(void *pvParam)
+{
+    int iteration = 0;
+    while (bench_running)
+    {
+        bench_post(TASK_EVENTS, TASK_ITERATION_EVENT, &iteration, sizeof(iteration));
+        iteration++;
+    }
+    vTaskDelete(NULL);
+}
+
+static void bench_run(bool lanes)
+{
+    use_lanes = lanes;
+    conn_count = 0;
+    conn_total_us = 0;
+    conn_max_us = 0;
+    bulk_count = 0;
+    bench_running = true;
+
+    xTaskCreate(flood_task, "flood_task", 3072, NULL, uxTaskPriorityGet(NULL) - 1, NULL);
+    int64_t end = esp_timer_get_time() + BENCH_DURATION_MS * 1000LL;
+    while (esp_timer_get_time() < end)
+    {
+        int64_t now = esp_timer_get_time();
+        bench_post(CONN_EVENTS, CONN_STATE_EVENT, &now, sizeof(now));
+        vTaskDelay(BENCH_CONN_PERIOD_MS / portTICK_PERIOD_MS);
+    }
+    bench_running = false;
+    // 等队列里剩下的事件处理完
+    vTaskDelay(500 / portTICK_PERIOD_MS);
+
+    ESP_LOGI(TAG, "%-12s conn events %" PRIu32 " avg %" PRIu32 "us max %" PRIu32 "us, bulk events %" PRIu32,
+             lanes ? "lanes" : "single loop", conn_count,
+             conn_count ? (uint32_t)(conn_total_us / conn_count) : 0, conn_max_us, bulk_count);
+}
+
+void app_main(void)
+{
+    esp_event_loop_create_default();
+    // 投递任务比分发任务优先级高，保证队列一直是满的
+    vTaskPrioritySet(NULL, 6);
+
+    // 对照组，一个队列，大小和所有lane加起来一样
+    esp_event_loop_args_t loop_args = {
+        .queue_size = 8 + 16 + 32,
+        .task_name = "loop_task",
+        .task_priority = 4,
+        .task_stack_size = 3072,
+        .task_core_id = tskNO_AFFINITY};
+    esp_event_loop_create(&loop_args, &single_loop);
+    esp_event_handler_instance_register_with(single_loop, TASK_EVENTS, TASK_ITERATION_EVENT, bulk_handler, NULL, NULL);
+    esp_event_handler_instance_register_with(single_loop, CONN_EVENTS, CONN_STATE_EVENT, conn_handler, NULL, NULL);
+
+    prio_loop_create(&prio_loop, LANE_NORMAL, 4, 3072);
+    prio_handler_register(&prio_loop, LANE_BULK, TASK_EVENTS, TASK_ITERATION_EVENT, bulk_handler, NULL, NULL);
+    prio_handler_register(&prio_loop, LANE_CRITICAL, CONN_EVENTS, CONN_STATE_EVENT, conn_handler, NULL, NULL);
+    // 连上wifi以后，wifi和ip事件也可以走高优先级的lane
+    // prio_handler_register(&prio_loop, LANE_CRITICAL, IP_EVENT, IP_EVENT_STA_GOT_IP, got_ip_handler, NULL, NULL);
+    // prio_forward_default(&prio_loop, IP_EVENT, IP_EVENT_STA_GOT_IP, sizeof(ip_event_got_ip_t));
+
+    bench_run(false);
+    bench_run(true);
+}
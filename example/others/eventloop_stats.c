@@ -0,0 +1,450 @@
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_event_base.h"
+#include "sdkconfig.h"
+
+/*
+事件循环统计例子：
+给esp_event包一层，统计
+1. 队列的最高水位，以及投递时因为队列满了被阻塞的次数和时间
+2. 从投递到开始分发的延时直方图
+3. 每个handler(按base/id区分)的调用次数、平均耗时、最大耗时
+随时可以拿一份快照打印或者上报，不用接调试器就能找出拖慢事件循环的handler。
+自己创建的事件循环，所有投递都要走ev_post，数据前面会加上投递时间；
+默认事件循环里wifi、ip的事件是系统直接投递的，只能统计handler的耗时
+*/
+
+static const char *TAG = "example";
+
+#define EV_STATS_MAX_HANDLERS 16 // 每个事件循环最多统计多少个handler
+#define EV_STATS_MAX_DATA 128    // 通过ev_post投递的数据最大长度
+
+/******************************延时直方图******************************/
+
+/* 和http_server_bench.c里的直方图一样，说明见那里 */
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (32 * HIST_SUB_COUNT)
+
+typedef struct
+{
+    uint32_t buckets[HIST_BUCKETS];
+    uint32_t count;
+    uint32_t max;
+} latency_hist_t;
+
+static int hist_index(uint32_t us)
+{
+    if (us < HIST_SUB_COUNT)
+        return us;
+    // 最高位决定区间，后面的4位决定区间内的桶
+    int msb = 31 - __builtin_clz(us);
+    int sub = (us >> (msb - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB_COUNT + sub;
+}
+
+// 返回桶的下界，作为这个桶的代表值
+static uint32_t hist_value(int index)
+{
+    if (index < HIST_SUB_COUNT)
+        return index;
+    int msb = index / HIST_SUB_COUNT + HIST_SUB_BITS - 1;
+    int sub = index % HIST_SUB_COUNT;
+    return (1u << msb) | ((uint32_t)sub << (msb - HIST_SUB_BITS));
+}
+
+static void hist_record(latency_hist_t *h, uint32_t us)
+{
+    h->buckets[hist_index(us)]++;
+    h->count++;
+    if (us > h->max)
+        h->max = us;
+}
+
+// 分位数，比如p99传入990
+static uint32_t hist_percentile(const latency_hist_t *h, uint32_t permille)
+{
+    uint64_t target = ((uint64_t)h->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= target && seen > 0)
+            return hist_value(i);
+    }
+    return 0;
+}
+
+/******************************带统计的事件循环******************************/
+
+// ev_post在数据前面加的头部
+typedef struct
+{
+    int64_t post_us;
+    bool dispatched; // 同一个事件的多个handler共用一份数据，只有第一个统计延时
+} ev_hdr_t;
+
+typedef struct ev_loop ev_loop_t;
+
+typedef struct
+{
+    ev_loop_t *loop;
+    esp_event_handler_t fn;
+    void *arg;
+    const char *name;
+    esp_event_base_t base;
+    int32_t id;
+    uint32_t calls;
+    uint64_t total_us;
+    uint32_t max_us;
+} ev_handler_stat_t;
+
+struct ev_loop
+{
+    esp_event_loop_handle_t handle; // NULL表示默认事件循环
+    int queue_size;
+    portMUX_TYPE mux;
+
+    int depth;         // 队列里还没分发的事件数，包括正在等待投递的，只统计ev_post投递的
+    int depth_max;     // 超过队列长度说明有投递者在等
+    uint32_t posted;
+    uint32_t blocked;  // 投递时队列满了需要等待的次数
+    uint32_t failed;   // 等待超时投递失败的次数
+    uint64_t blocked_us;
+    uint32_t blocked_us_max;
+    latency_hist_t dispatch; // 投递到开始分发的延时，包括投递时阻塞的时间
+
+    int handler_count;
+    ev_handler_stat_t handlers[EV_STATS_MAX_HANDLERS];
+};
+
+// 快照，拿到以后可以慢慢打印或者上报，不影响事件循环
+typedef struct
+{
+    int queue_size;
+    int depth_max;
+    uint32_t posted;
+    uint32_t blocked;
+    uint32_t failed;
+    uint32_t blocked_us_avg;
+    uint32_t blocked_us_max;
+    uint32_t dispatch_count;
+    uint32_t dispatch_p50;
+    uint32_t dispatch_p99;
+    uint32_t dispatch_max;
+    int handler_count;
+    struct
+    {
+        const char *name;
+        esp_event_base_t base;
+        int32_t id;
+        uint32_t calls;
+        uint32_t avg_us;
+        uint32_t max_us;
+    } handlers[EV_STATS_MAX_HANDLERS];
+} ev_stats_snapshot_t;
+
+/*第一次分发到这个事件时统计延时，并把它从队列深度里去掉*/
+static void ev_mark_dispatched(ev_loop_t *loop, ev_hdr_t *hdr)
+{
+    if (hdr->dispatched)
+        return;
+    hdr->dispatched = true;
+    uint32_t us = esp_timer_get_time() - hdr->post_us;
+    taskENTER_CRITICAL(&loop->mux);
+    loop->depth--;
+    hist_record(&loop->dispatch, us);
+    taskEXIT_CRITICAL(&loop->mux);
+}
+
+/*
+所有ev_post投递的事件都会经过这里，没有注册handler的事件也要从队列深度里去掉。
+esp_event先执行ESP_EVENT_ANY_BASE的handler，所以延时里不包含其他handler的耗时
+*/
+static void ev_catch_all(void *handler_args, esp_event_base_t base, int32_t id, void *event_data)
+{
+    ev_mark_dispatched(handler_args, event_data);
+}
+
+/*包在用户handler外面，统计耗时*/
+static void ev_trampoline(void *handler_args, esp_event_base_t base, int32_t id, void *event_data)
+{
+    ev_handler_stat_t *h = handler_args;
+    ev_loop_t *loop = h->loop;
+
+    if (loop->handle)
+    {
+        ev_mark_dispatched(loop, event_data);
+        event_data = (ev_hdr_t *)event_data + 1;
+    }
+
+    int64_t start = esp_timer_get_time();
+    h->fn(h->arg, base, id, event_data);
+    uint32_t us = esp_timer_get_time() - start;
+
+    taskENTER_CRITICAL(&loop->mux);
+    h->calls++;
+    h->total_us += us;
+    if (us > h->max_us)
+        h->max_us = us;
+    taskEXIT_CRITICAL(&loop->mux);
+}
+
+/*创建一个带统计的事件循环，参数和esp_event_loop_create一样*/
+esp_err_t ev_loop_create(const esp_event_loop_args_t *args, ev_loop_t *loop)
+{
+    memset(loop, 0, sizeof(*loop));
+    portMUX_INITIALIZE(&loop->mux);
+    loop->queue_size = args->queue_size;
+    esp_err_t err = esp_event_loop_create(args, &loop->handle);
+    if (err != ESP_OK)
+        return err;
+    return esp_event_handler_instance_register_with(loop->handle, ESP_EVENT_ANY_BASE, ESP_EVENT_ANY_ID,
+                                                    ev_catch_all, loop, NULL);
+}
+
+/*默认事件循环只统计handler耗时和ev_post的阻塞次数，要在esp_event_loop_create_default之后调用*/
+void ev_loop_default(ev_loop_t *loop)
+{
+    memset(loop, 0, sizeof(*loop));
+    portMUX_INITIALIZE(&loop->mux);
+    loop->queue_size = CONFIG_ESP_SYSTEM_EVENT_QUEUE_SIZE;
+}
+
+/*注册handler，name用来在快照里区分，可以直接用函数名*/
+esp_err_t ev_register(ev_loop_t *loop, esp_event_base_t base, int32_t id,
+                      esp_event_handler_t fn, void *arg, const char *name)
+{
+    taskENTER_CRITICAL(&loop->mux);
+    if (loop->handler_count >= EV_STATS_MAX_HANDLERS)
+    {
+        taskEXIT_CRITICAL(&loop->mux);
+        return ESP_ERR_NO_MEM;
+    }
+    ev_handler_stat_t *h = &loop->handlers[loop->handler_count++];
+    taskEXIT_CRITICAL(&loop->mux);
+
+    h->loop = loop;
+    h->fn = fn;
+    h->arg = arg;
+    h->name = name;
+    h->base = base;
+    h->id = id;
+    if (loop->handle)
+        return esp_event_handler_instance_register_with(loop->handle, base, id, ev_trampoline, h, NULL);
+    return esp_event_handler_instance_register(base, id, ev_trampoline, h, NULL);
+}
+
+/*
+投递事件，先不等待地投递一次，队列满了再记一次阻塞并按ticks_to_wait等待，
+这样就能知道投递者被卡了多少次、多久
+*/
+esp_err_t ev_post(ev_loop_t *loop, esp_event_base_t base, int32_t id,
+                  const void *data, size_t len, TickType_t ticks_to_wait)
+{
+    uint8_t buf[sizeof(ev_hdr_t) + EV_STATS_MAX_DATA] __attribute__((aligned(8)));
+    const void *post_data = data;
+    size_t post_len = len;
+
+    if (loop->handle)
+    {
+        if (len > EV_STATS_MAX_DATA)
+            return ESP_ERR_INVALID_SIZE;
+        ev_hdr_t *hdr = (ev_hdr_t *)buf;
+        hdr->post_us = esp_timer_get_time();
+        hdr->dispatched = false;
+        if (len)
+            memcpy(hdr + 1, data, len);
+        post_data = buf;
+        post_len = sizeof(ev_hdr_t) + len;
+
+        // 先算进深度，分发任务优先级高时可能在返回之前就分发完了
+        taskENTER_CRITICAL(&loop->mux);
+        loop->depth++;
+        if (loop->depth > loop->depth_max)
+            loop->depth_max = loop->depth;
+        taskEXIT_CRITICAL(&loop->mux);
+    }
+
+#define EV_DO_POST(ticks) (loop->handle ? esp_event_post_to(loop->handle, base, id, post_data, post_len, ticks) \
+                                        : esp_event_post(base, id, post_data, post_len, ticks))
+    esp_err_t err = EV_DO_POST(0);
+    uint32_t waited = 0;
+    bool was_blocked = err == ESP_ERR_TIMEOUT && ticks_to_wait > 0;
+    if (was_blocked)
+    {
+        int64_t start = esp_timer_get_time();
+        err = EV_DO_POST(ticks_to_wait);
+        waited = esp_timer_get_time() - start;
+    }
+#undef EV_DO_POST
+
+    taskENTER_CRITICAL(&loop->mux);
+    if (was_blocked)
+    {
+        loop->blocked++;
+        loop->blocked_us += waited;
+        if (waited > loop->blocked_us_max)
+            loop->blocked_us_max = waited;
+    }
+    if (err == ESP_OK)
+    {
+        loop->posted++;
+    }
+    else
+    {
+        loop->failed++;
+        if (loop->handle)
+            loop->depth--;
+    }
+    taskEXIT_CRITICAL(&loop->mux);
+    return err;
+}
+
+/*拿一份快照，reset为true时同时清零计数，方便按周期统计*/
+void ev_stats_snapshot(ev_loop_t *loop, ev_stats_snapshot_t *out, bool reset)
+{
+    // 直方图比较大，先拷出来，在锁外算分位数
+    static latency_hist_t dispatch;
+    memset(out, 0, sizeof(*out));
+
+    taskENTER_CRITICAL(&loop->mux);
+    out->queue_size = loop->queue_size;
+    out->depth_max = loop->depth_max;
+    out->posted = loop->posted;
+    out->blocked = loop->blocked;
+    out->failed = loop->failed;
+    out->blocked_us_avg = loop->blocked ? loop->blocked_us / loop->blocked : 0;
+    out->blocked_us_max = loop->blocked_us_max;
+    dispatch = loop->dispatch;
+    out->handler_count = loop->handler_count;
+    for (int i = 0; i < loop->handler_count; i++)
+    {
+        ev_handler_stat_t *h = &loop->handlers[i];
+        out->handlers[i].name = h->name;
+        out->handlers[i].base = h->base;
+        out->handlers[i].id = h->id;
+        out->handlers[i].calls = h->calls;
+        out->handlers[i].avg_us = h->calls ? h->total_us / h->calls : 0;
+        out->handlers[i].max_us = h->max_us;
+        if (reset)
+        {
+            h->calls = 0;
+            h->total_us = 0;
+            h->max_us = 0;
+        }
+    }
+    if (reset)
+    {
+        // 深度是实时值，不清零，最高水位从当前深度重新开始
+        loop->depth_max = loop->depth;
+        loop->posted = 0;
+        loop->blocked = 0;
+        loop->failed = 0;
+        loop->blocked_us = 0;
+        loop->blocked_us_max = 0;
+        memset(&loop->dispatch, 0, sizeof(loop->dispatch));
+    }
+    taskEXIT_CRITICAL(&loop->mux);
+
+    out->dispatch_count = dispatch.count;
+    out->dispatch_p50 = hist_percentile(&dispatch, 500);
+    out->dispatch_p99 = hist_percentile(&dispatch, 990);
+    out->dispatch_max = dispatch.max;
+}
+
+void ev_stats_dump(const char *label, const ev_stats_snapshot_t *s)
+{
+    ESP_LOGI(TAG, "[%s] queue %d/%d  posted %" PRIu32 " blocked %" PRIu32 " (avg %" PRIu32 "us max %" PRIu32 "us) failed %" PRIu32,
+             label, s->depth_max, s->queue_size, s->posted, s->blocked, s->blocked_us_avg, s->blocked_us_max, s->failed);
+    if (s->dispatch_count)
+        ESP_LOGI(TAG, "[%s] dispatch latency p50=%" PRIu32 "us p99=%" PRIu32 "us max=%" PRIu32 "us",
+                 label, s->dispatch_p50, s->dispatch_p99, s->dispatch_max);
+    for (int i = 0; i < s->handler_count; i++)
+    {
+        ESP_LOGI(TAG, "[%s]   %-20s %s:%" PRIi32 "  calls %" PRIu32 " avg %" PRIu32 "us max %" PRIu32 "us",
+                 label, s->handlers[i].name, s->handlers[i].base ? s->handlers[i].base : "ANY",
+                 s->handlers[i].id, s->handlers[i].calls, s->handlers[i].avg_us, s->handlers[i].max_us);
+    }
+}
+
+/******************************例子******************************/
+
+// 声明一个事件基，这个可以在.h文件中定义
+ESP_EVENT_DECLARE_BASE(TASK_EVENTS);
+// 初始化事件基
+ESP_EVENT_DEFINE_BASE(TASK_EVENTS);
+
+enum
+{
+    TASK_ITERATION_EVENT,
+    TASK_SLOW_EVENT,
+};
+
+static ev_loop_t loop;
+static ev_loop_t default_loop;
+
+static void iteration_handler(void *handler_args, esp_event_base_t base, int32_t id, void *event_data)
+{
+    int iteration = *((int *)event_data);
+    (void)iteration;
+}
+
+// 故意写得很慢的handler，模拟在事件回调里做了耗时的操作
+static void slow_handler(void *handler_args, esp_event_base_t base, int32_t id, void *event_data)
+{
+    int64_t end = esp_timer_get_time() + 3000;
+    while (esp_timer_get_time() < end)
+        ;
+}
+
+static void post_task(void *pvParam)
+{
+    for (int iteration = 0;; iteration++)
+    {
+        // 一次投递一串，队列只有5个，慢的handler会让投递者阻塞
+        for (int i = 0; i < 8; i++)
+            ev_post(&loop, TASK_EVENTS, TASK_ITERATION_EVENT, &iteration, sizeof(iteration), portMAX_DELAY);
+        if (iteration % 4 == 0)
+            ev_post(&loop, TASK_EVENTS, TASK_SLOW_EVENT, NULL, 0, portMAX_DELAY);
+        ev_post(&default_loop, TASK_EVENTS, TASK_ITERATION_EVENT, &iteration, sizeof(iteration), portMAX_DELAY);
+        vTaskDelay(20 / portTICK_PERIOD_MS);
+    }
+}
+
+void app_main(void)
+{
+    esp_event_loop_create_default();
+    ev_loop_default(&default_loop);
+
+    // 和eventloop.c一样的参数
+    esp_event_loop_args_t loop_args = {
+        .queue_size = 5,
+        .task_name = "loop_task",
+        .task_priority = uxTaskPriorityGet(NULL),
+        .task_stack_size = 3072,
+        .task_core_id = tskNO_AFFINITY};
+    ev_loop_create(&loop_args, &loop);
+
+    ev_register(&loop, TASK_EVENTS, TASK_ITERATION_EVENT, iteration_handler, NULL, "iteration_handler");
+    ev_register(&loop, TASK_EVENTS, TASK_SLOW_EVENT, slow_handler, NULL, "slow_handler");
+    // 默认事件循环上也可以注册，比如wifi、ip的handler，这里用自己的事件演示
+    ev_register(&default_loop, TASK_EVENTS, ESP_EVENT_ANY_ID, iteration_handler, NULL, "default_iteration");
+
+    xTaskCreate(post_task, "post_task", 3072, NULL, uxTaskPriorityGet(NULL), NULL);
+
+    static ev_stats_snapshot_t snap;
+    while (1)
+    {
+        vTaskDelay(2000 / portTICK_PERIOD_MS);
+        ev_stats_snapshot(&loop, &snap, true);
+        ev_stats_dump("loop", &snap);
+        ev_stats_snapshot(&default_loop, &snap, true);
+        ev_stats_dump("default", &snap);
+    }
+}
@@ -0,0 +1,649 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+/*
+MessagePack编解码例子：
+用snprintf拼JSON比较费CPU，浮点格式化尤其慢，数据量也大。
+这里实现一个不申请内存的MessagePack编码器/解码器，直接写进调用者给的缓冲区(比如mqtt或socket的发送缓冲区)，
+固定格式的遥测数据用X宏在编译期生成结构体、编码函数和解码函数，
+app_main中对比编码耗时和数据大小
+*/
+
+static const char *TAG = "example";
+
+/******************************编码******************************/
+
+typedef struct
+{
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    bool overflow; // 缓冲区不够，之后的写入都会被忽略
+} mp_writer_t;
+
+void mp_writer_init(mp_writer_t *w, void *buf, size_t cap)
+{
+    w->buf = buf;
+    w->cap = cap;
+    w->len = 0;
+    w->overflow = false;
+}
+
+static inline uint8_t *mp_reserve(mp_writer_t *w, size_t n)
+{
+    if (w->overflow || w->cap - w->len < n)
+    {
+        w->overflow = true;
+        return NULL;
+    }
+    uint8_t *p = w->buf + w->len;
+    w->len += n;
+    return p;
+}
+
+// MessagePack的多字节数都是大端
+static inline void mp_put_be16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void mp_put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+void mp_write_nil(mp_writer_t *w)
+{
+    uint8_t *p = mp_reserve(w, 1);
+    if (p)
+        p[0] = 0xc0;
+}
+
+void mp_write_bool(mp_writer_t *w, bool v)
+{
+    uint8_t *p = mp_reserve(w, 1);
+    if (p)
+        p[0] = v ? 0xc3 : 0xc2;
+}
+
+// 按数值大小选最短的编码
+void mp_write_uint(mp_writer_t *w, uint32_t v)
+{
+    uint8_t *p;
+    if (v < 0x80)
+    {
+        if ((p = mp_reserve(w, 1)))
+            p[0] = v;
+    }
+    else if (v <= 0xff)
+    {
+        if ((p = mp_reserve(w, 2)))
+        {
+            p[0] = 0xcc;
+            p[1] = v;
+        }
+    }
+    else if (v <= 0xffff)
+    {
+        if ((p = mp_reserve(w, 3)))
+        {
+            p[0] = 0xcd;
+            mp_put_be16(p + 1, v);
+        }
+    }
+    else if ((p = mp_reserve(w, 5)))
+    {
+        p[0] = 0xce;
+        mp_put_be32(p + 1, v);
+    }
+}
+
+void mp_write_int(mp_writer_t *w, int32_t v)
+{
+    uint8_t *p;
+    if (v >= 0)
+        mp_write_uint(w, v);
+    else if (v >= -32)
+    {
+        if ((p = mp_reserve(w, 1)))
+            p[0] = (uint8_t)v;
+    }
+    else if (v >= INT8_MIN)
+    {
+        if ((p = mp_reserve(w, 2)))
+        {
+            p[0] = 0xd0;
+            p[1] = (uint8_t)v;
+        }
+    }
+    else if (v >= INT16_MIN)
+    {
+        if ((p = mp_reserve(w, 3)))
+        {
+            p[0] = 0xd1;
+            mp_put_be16(p + 1, (uint16_t)v);
+        }
+    }
+    else if ((p = mp_reserve(w, 5)))
+    {
+        p[0] = 0xd2;
+        mp_put_be32(p + 1, (uint32_t)v);
+    }
+}
+
+// 直接拷贝float的二进制，esp32c3没有FPU，比格式化成字符串快得多
+void mp_write_float(mp_writer_t *w, float v)
+{
+    uint8_t *p = mp_reserve(w, 5);
+    if (p)
+    {
+        uint32_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        p[0] = 0xca;
+        mp_put_be32(p + 1, bits);
+    }
+}
+
+void mp_write_str(mp_writer_t *w, const char *s, size_t len)
+{
+    uint8_t *p;
+    if (len < 32)
+    {
+        if ((p = mp_reserve(w, 1)))
+            p[0] = 0xa0 | len;
+    }
+    else if (len <= 0xff)
+    {
+        if ((p = mp_reserve(w, 2)))
+        {
+            p[0] = 0xd9;
+            p[1] = len;
+        }
+    }
+    else if (len <= 0xffff)
+    {
+        if ((p = mp_reserve(w, 3)))
+        {
+            p[0] = 0xda;
+            mp_put_be16(p + 1, len);
+        }
+    }
+    else if ((p = mp_reserve(w, 5)))
+    {
+        p[0] = 0xdb;
+        mp_put_be32(p + 1, len);
+    }
+    if ((p = mp_reserve(w, len)))
+        memcpy(p, s, len);
+}
+
+void mp_write_bin(mp_writer_t *w, const void *data, size_t len)
+{
+    uint8_t *p;
+    if (len <= 0xff)
+    {
+        if ((p = mp_reserve(w, 2)))
+        {
+            p[0] = 0xc4;
+            p[1] = len;
+        }
+    }
+    else if (len <= 0xffff)
+    {
+        if ((p = mp_reserve(w, 3)))
+        {
+            p[0] = 0xc5;
+            mp_put_be16(p + 1, len);
+        }
+    }
+    else if ((p = mp_reserve(w, 5)))
+    {
+        p[0] = 0xc6;
+        mp_put_be32(p + 1, len);
+    }
+    if ((p = mp_reserve(w, len)))
+        memcpy(p, data, len);
+}
+
+// 数组和map只写个数，后面紧跟着写元素(map是key、value交替)
+void mp_write_container(mp_writer_t *w, uint8_t fix, uint8_t tag16, uint32_t n)
+{
+    uint8_t *p;
+    if (n < 16)
+    {
+        if ((p = mp_reserve(w, 1)))
+            p[0] = fix | n;
+    }
+    else if (n <= 0xffff)
+    {
+        if ((p = mp_reserve(w, 3)))
+        {
+            p[0] = tag16;
+            mp_put_be16(p + 1, n);
+        }
+    }
+    else if ((p = mp_reserve(w, 5)))
+    {
+        p[0] = tag16 + 1;
+        mp_put_be32(p + 1, n);
+    }
+}
+
+#define mp_write_array(w, n) mp_write_container(w, 0x90, 0xdc, n)
+#define mp_write_map(w, n) mp_write_container(w, 0x80, 0xde, n)
+
+/******************************解码******************************/
+
+typedef enum
+{
+    MP_NIL,
+    MP_BOOL,
+    MP_INT,
+    MP_FLOAT,
+    MP_STR,
+    MP_BIN,
+    MP_ARRAY,
+    MP_MAP,
+} mp_type_t;
+
+typedef struct
+{
+    mp_type_t type;
+    union
+    {
+        bool b;
+        int64_t i; // 正整数和负整数都放这里
+        double f;
+        struct
+        {
+            const uint8_t *ptr; // 字符串和bin不拷贝，直接指向输入缓冲区
+            uint32_t len;
+        } s;
+        uint32_t n; // 数组和map的元素个数
+    } v;
+} mp_obj_t;
+
+typedef struct
+{
+    const uint8_t *p;
+    const uint8_t *end;
+    bool error; // 数据不完整或者格式不认识
+} mp_reader_t;
+
+void mp_reader_init(mp_reader_t *r, const void *buf, size_t len)
+{
+    r->p = buf;
+    r->end = r->p + len;
+    r->error = false;
+}
+
+static inline const uint8_t *mp_take(mp_reader_t *r, size_t n)
+{
+    if (r->error || (size_t)(r->end - r->p) < n)
+    {
+        r->error = true;
+        return NULL;
+    }
+    const uint8_t *p = r->p;
+    r->p += n;
+    return p;
+}
+
+static inline uint32_t mp_be(const uint8_t *p, int n)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < n; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+/*读一个元素，数组和map只读出个数，元素要接着读*/
+bool mp_read(mp_reader_t *r, mp_obj_t *o)
+{
+    const uint8_t *p = mp_take(r, 1);
+    if (!p)
+        return false;
+    uint8_t t = p[0];
+    int n = 0; // 后面跟的长度或数值占几个字节
+
+    if (t < 0x80)
+    {
+        o->type = MP_INT;
+        o->v.i = t;
+        return true;
+    }
+    if (t >= 0xe0)
+    {
+        o->type = MP_INT;
+        o->v.i = (int8_t)t;
+        return true;
+    }
+    if ((t & 0xf0) == 0x80 || (t & 0xf0) == 0x90)
+    {
+        o->type = (t & 0xf0) == 0x80 ? MP_MAP : MP_ARRAY;
+        o->v.n = t & 0x0f;
+        return true;
+    }
+    if ((t & 0xe0) == 0xa0)
+    {
+        o->type = MP_STR;
+        o->v.s.len = t & 0x1f;
+        goto payload;
+    }
+
+    switch (t)
+    {
+    case 0xc0:
+        o->type = MP_NIL;
+        return true;
+    case 0xc2:
+    case 0xc3:
+        o->type = MP_BOOL;
+        o->v.b = t == 0xc3;
+        return true;
+    case 0xcc:
+    case 0xcd:
+    case 0xce:
+    case 0xcf:
+        n = 1 << (t - 0xcc);
+        if (!(p = mp_take(r, n)))
+            return false;
+        o->type = MP_INT;
+        if (n == 8)
+        {
+            // 超过int64_t的uint64放不下，不能悄悄截断成错误的值
+            uint64_t u = ((uint64_t)mp_be(p, 4) << 32) | mp_be(p + 4, 4);
+            if (u > INT64_MAX)
+            {
+                r->error = true;
+                return false;
+            }
+            o->v.i = (int64_t)u;
+        }
+        else
+            o->v.i = mp_be(p, n);
+        return true;
+    case 0xd0:
+    case 0xd1:
+    case 0xd2:
+        n = 1 << (t - 0xd0);
+        if (!(p = mp_take(r, n)))
+            return false;
+        o->type = MP_INT;
+        o->v.i = n == 1 ? (int8_t)p[0] : n == 2 ? (int16_t)mp_be(p, 2) : (int32_t)mp_be(p, 4);
+        return true;
+    case 0xca:
+    {
+        if (!(p = mp_take(r, 4)))
+            return false;
+        uint32_t bits = mp_be(p, 4);
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        o->type = MP_FLOAT;
+        o->v.f = f;
+        return true;
+    }
+    case 0xcb:
+    {
+        if (!(p = mp_take(r, 8)))
+            return false;
+        uint64_t bits = ((uint64_t)mp_be(p, 4) << 32) | mp_be(p + 4, 4);
+        memcpy(&o->v.f, &bits, sizeof(bits));
+        o->type = MP_FLOAT;
+        return true;
+    }
+    case 0xd9:
+    case 0xda:
+    case 0xdb:
+    case 0xc4:
+    case 0xc5:
+    case 0xc6:
+        o->type = t >= 0xd9 ? MP_STR : MP_BIN;
+        n = 1 << (t >= 0xd9 ? t - 0xd9 : t - 0xc4);
+        if (!(p = mp_take(r, n)))
+            return false;
+        o->v.s.len = mp_be(p, n);
+        goto payload;
+    case 0xdc:
+    case 0xdd:
+    case 0xde:
+    case 0xdf:
+        n = (t & 1) ? 4 : 2;
+        if (!(p = mp_take(r, n)))
+            return false;
+        o->type = t >= 0xde ? MP_MAP : MP_ARRAY;
+        o->v.n = mp_be(p, n);
+        return true;
+    default:
+        // ext类型这里用不到
+        r->error = true;
+        return false;
+    }
+
+payload:
+    if (!(o->v.s.ptr = mp_take(r, o->v.s.len)))
+        return false;
+    return true;
+}
+
+/*跳过一个元素，包括它里面嵌套的所有元素，用来忽略不认识的字段*/
+bool mp_skip(mp_reader_t *r)
+{
+    uint32_t pending = 1;
+    mp_obj_t o;
+    while (pending > 0)
+    {
+        if (!mp_read(r, &o))
+            return false;
+        pending--;
+        if (o.type == MP_ARRAY)
+            pending += o.v.n;
+        else if (o.type == MP_MAP)
+            pending += o.v.n * 2;
+    }
+    return true;
+}
+
+/******************************编译期生成的数据格式******************************/
+
+/*
+用X宏描述一条遥测数据，每个字段是 F(类型, 名字)，
+下面的宏会展开成结构体、MessagePack编码、解码、JSON编码(对比用)四个部分，
+加字段只需要改这一处，key字符串的长度也是编译期算好的
+*/
+#define TELEMETRY_FIELDS(F) \
+    F(u32, ts)              \
+    F(str, dev)             \
+    F(f32, temp)            \
+    F(f32, humi)            \
+    F(i32, rssi)            \
+    F(u32, batt_mv)         \
+    F(boolean, charging)
+
+// 每种类型的结构体成员，str只存指针，解码时指向输入缓冲区，长度放在name_len里
+#define MP_DECL_u32(name) uint32_t name;
+#define MP_DECL_i32(name) int32_t name;
+#define MP_DECL_f32(name) float name;
+#define MP_DECL_boolean(name) bool name;
+#define MP_DECL_str(name) const char *name; uint8_t name##_len;
+
+#define MP_FIELD_DECL(type, name) MP_DECL_##type(name)
+#define MP_FIELD_COUNT(type, name) +1
+
+typedef struct
+{
+    TELEMETRY_FIELDS(MP_FIELD_DECL)
+} telemetry_t;
+
+enum
+{
+    TELEMETRY_FIELD_COUNT = 0 TELEMETRY_FIELDS(MP_FIELD_COUNT)
+};
+
+// 每种类型的编码函数
+#define MP_ENC_u32(w, rec, name) mp_write_uint(w, (rec)->name)
+#define MP_ENC_i32(w, rec, name) mp_write_int(w, (rec)->name)
+#define MP_ENC_f32(w, rec, name) mp_write_float(w, (rec)->name)
+#define MP_ENC_boolean(w, rec, name) mp_write_bool(w, (rec)->name)
+#define MP_ENC_str(w, rec, name) mp_write_str(w, (rec)->name, (rec)->name##_len)
+
+#define MP_FIELD_ENCODE(type, name)                     \
+    mp_write_str(w, #name, sizeof(#name) - 1);          \
+    MP_ENC_##type(w, rec, name);
+
+/*编码成map，key是字段名，返回写入的字节数，缓冲区不够返回-1*/
+static int telemetry_encode(const telemetry_t *rec, void *buf, size_t cap)
+{
+    mp_writer_t writer, *w = &writer;
+    mp_writer_init(w, buf, cap);
+    mp_write_map(w, TELEMETRY_FIELD_COUNT);
+    TELEMETRY_FIELDS(MP_FIELD_ENCODE)
+    return w->overflow ? -1 : (int)w->len;
+}
+
+// 每种类型的解码，类型对不上或者超出范围就算出错
+#define MP_DEC_u32(o, rec, name) ((o)->type == MP_INT && (o)->v.i >= 0 && (o)->v.i <= UINT32_MAX ? ((rec)->name = (o)->v.i, true) : false)
+#define MP_DEC_i32(o, rec, name) ((o)->type == MP_INT && (o)->v.i >= INT32_MIN && (o)->v.i <= INT32_MAX ? ((rec)->name = (o)->v.i, true) : false)
+#define MP_DEC_f32(o, rec, name) ((o)->type == MP_FLOAT ? ((rec)->name = (o)->v.f, true) : (o)->type == MP_INT ? ((rec)->name = (o)->v.i, true) : false)
+#define MP_DEC_boolean(o, rec, name) ((o)->type == MP_BOOL ? ((rec)->name = (o)->v.b, true) : false)
+#define MP_DEC_str(o, rec, name) ((o)->type == MP_STR && (o)->v.s.len <= 0xff ? ((rec)->name = (const char *)(o)->v.s.ptr, (rec)->name##_len = (o)->v.s.len, true) : false)
+
+#define MP_FIELD_DECODE(type, name)                                            \
+    if (key.v.s.len == sizeof(#name) - 1 && !memcmp(key.v.s.ptr, #name, key.v.s.len)) \
+    {                                                                          \
+        if (!mp_read(&r, &val) || !MP_DEC_##type(&val, rec, name))             \
+            return false;                                                      \
+        continue;                                                              \
+    }
+
+/*
+解码，字段顺序无所谓，不认识的字段会跳过，方便以后加字段时新旧版本兼容。
+字符串不拷贝，rec里的指针指向buf，buf要比rec活得久
+*/
+static bool telemetry_decode(telemetry_t *rec, const void *buf, size_t len)
+{
+    mp_reader_t r;
+    mp_obj_t obj, key, val;
+    mp_reader_init(&r, buf, len);
+    memset(rec, 0, sizeof(*rec));
+
+    if (!mp_read(&r, &obj) || obj.type != MP_MAP)
+        return false;
+    for (uint32_t i = 0; i < obj.v.n; i++)
+    {
+        if (!mp_read(&r, &key) || key.type != MP_STR)
+            return false;
+        TELEMETRY_FIELDS(MP_FIELD_DECODE)
+        if (!mp_skip(&r))
+            return false;
+    }
+    return !r.error;
+}
+
+// JSON编码，只用来和MessagePack对比
+#define JSON_FMT_u32 "%" PRIu32
+#define JSON_FMT_i32 "%" PRId32
+#define JSON_FMT_f32 "%.2f"
+#define JSON_FMT_boolean "%s"
+#define JSON_FMT_str "\"%.*s\""
+#define JSON_ARG_u32(rec, name) (rec)->name
+#define JSON_ARG_i32(rec, name) (rec)->name
+#define JSON_ARG_f32(rec, name) (double)(rec)->name
+#define JSON_ARG_boolean(rec, name) (rec)->name ? "true" : "false"
+#define JSON_ARG_str(rec, name) (int)(rec)->name##_len, (rec)->name
+
+#define JSON_FIELD_ENCODE(type, name)                                                              \
+    n = snprintf(p, end - p, "%s\"" #name "\":" JSON_FMT_##type, p == start + 1 ? "" : ",", JSON_ARG_##type(rec, name)); \
+    if (n < 0 || n >= end - p)                                                                     \
+        return -1;                                                                                 \
+    p += n;
+
+static int telemetry_encode_json(const telemetry_t *rec, char *buf, size_t cap)
+{
+    char *start = buf, *p = buf, *end = buf + cap;
+    int n;
+    if (cap < 3)
+        return -1;
+    *p++ = '{';
+    TELEMETRY_FIELDS(JSON_FIELD_ENCODE)
+    if (end - p < 2)
+        return -1;
+    *p++ = '}';
+    *p = '\0';
+    return p - start;
+}
+
+/******************************对比******************************/
+
+#define BENCH_ROUNDS 10000
+
+void app_main(void)
+{
+    static uint8_t mp_buf[128];
+    static char json_buf[256];
+    const char dev[] = "esp32c3-a1b2c3";
+    telemetry_t rec = {
+        .ts = 1700000000,
+        .dev = dev,
+        .dev_len = sizeof(dev) - 1,
+        .temp = 23.45f,
+        .humi = 61.2f,
+        .rssi = -67,
+        .batt_mv = 3912,
+        .charging = false,
+    };
+
+    int mp_len = 0, json_len = 0;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+    {
+        rec.ts++;
+        mp_len = telemetry_encode(&rec, mp_buf, sizeof(mp_buf));
+    }
+    int64_t mp_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+    {
+        rec.ts++;
+        json_len = telemetry_encode_json(&rec, json_buf, sizeof(json_buf));
+    }
+    int64_t json_us = esp_timer_get_time() - start;
+
+    telemetry_t out;
+    start = esp_timer_get_time();
+    bool ok = true;
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+        ok &= telemetry_decode(&out, mp_buf, mp_len);
+    int64_t dec_us = esp_timer_get_time() - start;
+
+    ESP_LOGI(TAG, "json:    %d bytes, %.2f us/record  %s", json_len, (double)json_us / BENCH_ROUNDS, json_buf);
+    ESP_LOGI(TAG, "msgpack: %d bytes, %.2f us/record encode, %.2f us/record decode",
+             mp_len, (double)mp_us / BENCH_ROUNDS, (double)dec_us / BENCH_ROUNDS);
+    ESP_LOG_BUFFER_HEX(TAG, mp_buf, mp_len);
+
+    if (!ok || out.ts != rec.ts - BENCH_ROUNDS || out.rssi != rec.rssi || out.temp != rec.temp ||
+        out.dev_len != rec.dev_len || memcmp(out.dev, rec.dev, rec.dev_len) != 0)
+        ESP_LOGE(TAG, "decode mismatch");
+    else
+        ESP_LOGI(TAG, "decode ok: dev=%.*s ts=%" PRIu32 " temp=%.2f rssi=%" PRId32,
+                 out.dev_len, out.dev, out.ts, out.temp, out.rssi);
+
+    /*
+    发送时直接编码到发送缓冲区，比如：
+    int len = telemetry_encode(&rec, buf, sizeof(buf));
+    esp_mqtt_client_publish(client, "/telemetry", (const char *)buf, len, 0, 0);
+    send(sock, buf, len, 0);
+    */
+}